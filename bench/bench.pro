@@ -0,0 +1,48 @@
+#
+# vchar64-bench: micro-benchmarks for the hot paths.
+# Not built by default. To build it: qmake CONFIG+=bench
+#
+# Run it with --benchmark_out=results.json to compare runs.
+#
+
+QT += core gui network widgets
+
+TARGET = vchar64-bench
+win32 {
+    DESTDIR = ..
+} else {
+    DESTDIR = ../bin
+}
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+VERSION = 0.2.4
+GIT_VERSION = $$system(git describe --abbrev=4 --dirty --always --tags)
+DEFINES += GIT_VERSION=\\\"$$GIT_VERSION\\\" VERSION=\\\"$$VERSION\\\"
+DEFINES += BENCH_DATA_DIR=\\\"$$PWD/../tests\\\"
+
+CONFIG += c++11
+CONFIG += release
+
+include(../core/core.pri)
+include(../src/gui.pri)
+
+SOURCES += \
+    benchmark.cpp \
+    importbenchmarks.cpp \
+    koalabenchmarks.cpp \
+    main.cpp \
+    previewbenchmarks.cpp \
+    renderbenchmarks.cpp \
+    serveremulator.cpp \
+    vicemonitoremulator.cpp
+
+HEADERS += \
+    benchmark.h \
+    benchmarks.h \
+    serveremulator.h \
+    vicemonitoremulator.h
+
+!win32 {
+    QMAKE_CXXFLAGS += -Werror
+}
@@ -0,0 +1,261 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "benchmark.h"
+
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QHostInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+struct Benchmark {
+    QString name;
+    BenchmarkFunction function;
+};
+
+static QVector<Benchmark>& benchmarks()
+{
+    static QVector<Benchmark> registered;
+    return registered;
+}
+
+static qint64 clockToNanoseconds(std::clock_t ticks)
+{
+    return (qint64)(ticks * (1e9 / CLOCKS_PER_SEC));
+}
+
+BenchmarkState::BenchmarkState(qint64 iterations)
+    : _iterations(iterations)
+    , _remaining(iterations)
+    , _started(false)
+    , _running(false)
+    , _cpuStart(0)
+    , _realTime(0)
+    , _cpuTime(0)
+    , _itemsProcessed(0)
+    , _bytesProcessed(0)
+{
+}
+
+bool BenchmarkState::keepRunning()
+{
+    if (!_started)
+    {
+        _started = true;
+        resumeTiming();
+    }
+
+    if (_remaining > 0 && !hasError())
+    {
+        --_remaining;
+        return true;
+    }
+
+    if (_running)
+        pauseTiming();
+    return false;
+}
+
+void BenchmarkState::pauseTiming()
+{
+    Q_ASSERT(_running && "Timer not running");
+    _realTime += _timer.nsecsElapsed();
+    _cpuTime += clockToNanoseconds(std::clock() - _cpuStart);
+    _running = false;
+}
+
+void BenchmarkState::resumeTiming()
+{
+    Q_ASSERT(!_running && "Timer already running");
+    _running = true;
+    _cpuStart = std::clock();
+    _timer.start();
+}
+
+void BenchmarkState::setItemsProcessed(qint64 items)
+{
+    _itemsProcessed = items;
+}
+
+void BenchmarkState::setBytesProcessed(qint64 bytes)
+{
+    _bytesProcessed = bytes;
+}
+
+void BenchmarkState::setCounter(const QString& name, double value)
+{
+    _counters[name] = value;
+}
+
+void BenchmarkState::skipWithError(const QString& error)
+{
+    _error = error;
+}
+
+void registerBenchmark(const QString& name, const BenchmarkFunction& function)
+{
+    benchmarks().append({name, function});
+}
+
+static QJsonObject toJson(const QString& name, const BenchmarkState& state)
+{
+    const double seconds = state.realTime() / 1e9;
+
+    QJsonObject json;
+    json["name"] = name;
+    json["run_name"] = name;
+    json["run_type"] = QString("iteration");
+    json["iterations"] = state.iterations();
+    json["real_time"] = (double)state.realTime() / state.iterations();
+    json["cpu_time"] = (double)state.cpuTime() / state.iterations();
+    json["time_unit"] = QString("ns");
+    if (state.bytesProcessed() > 0 && seconds > 0)
+        json["bytes_per_second"] = state.bytesProcessed() / seconds;
+    if (state.itemsProcessed() > 0 && seconds > 0)
+        json["items_per_second"] = state.itemsProcessed() / seconds;
+    // same as Google Benchmark: the user counters are fields of the benchmark
+    for (auto it = state.counters().constBegin(); it != state.counters().constEnd(); ++it)
+        json[it.key()] = it.value();
+    return json;
+}
+
+static QString humanReadable(double value)
+{
+    const char* units[] = {"", "k", "M", "G"};
+    int unit = 0;
+    while (value >= 1000 && unit < 3)
+    {
+        value /= 1000;
+        unit++;
+    }
+    return QString("%1%2").arg(value, 0, 'f', 1).arg(units[unit]);
+}
+
+int runBenchmarks(const BenchmarkOptions& options)
+{
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    const QRegularExpression filter(options.filter);
+    if (!filter.isValid())
+    {
+        err << "Invalid filter: " << options.filter << "\n";
+        return 1;
+    }
+
+    int nameWidth = 10;
+    for (const auto& benchmark: benchmarks())
+    {
+        if (filter.match(benchmark.name).hasMatch())
+            nameWidth = std::max(nameWidth, benchmark.name.length());
+    }
+
+    out << QString("Benchmark").leftJustified(nameWidth)
+        << QString("Time").rightJustified(15)
+        << QString("CPU").rightJustified(15)
+        << QString("Iterations").rightJustified(12)
+        << "\n";
+    out << QString(nameWidth + 15 + 15 + 12 + 20, '-') << "\n";
+
+    const qint64 minTime = (qint64)(options.minTime * 1e9);
+    const qint64 maxIterations = 1000000000;
+    int errors = 0;
+
+    QJsonArray results;
+    for (const auto& benchmark: benchmarks())
+    {
+        if (!filter.match(benchmark.name).hasMatch())
+            continue;
+
+        // same strategy as Google Benchmark: keep increasing the iterations
+        // until the benchmark runs for at least minTime
+        qint64 iterations = 1;
+        for (;;)
+        {
+            BenchmarkState state(iterations);
+            benchmark.function(state);
+
+            if (state.hasError())
+            {
+                out << benchmark.name.leftJustified(nameWidth) << " ERROR: " << state.error() << "\n";
+                errors++;
+                break;
+            }
+
+            if (state.realTime() >= minTime || iterations >= maxIterations)
+            {
+                out << benchmark.name.leftJustified(nameWidth)
+                    << QString("%1 ns").arg((double)state.realTime() / iterations, 0, 'f', 0).rightJustified(15)
+                    << QString("%1 ns").arg((double)state.cpuTime() / iterations, 0, 'f', 0).rightJustified(15)
+                    << QString::number(iterations).rightJustified(12);
+                const double seconds = state.realTime() / 1e9;
+                if (state.bytesProcessed() > 0)
+                    out << " " << humanReadable(state.bytesProcessed() / seconds) << "B/s";
+                if (state.itemsProcessed() > 0)
+                    out << " " << humanReadable(state.itemsProcessed() / seconds) << " items/s";
+                for (auto it = state.counters().constBegin(); it != state.counters().constEnd(); ++it)
+                    out << " " << it.key() << "=" << humanReadable(it.value());
+                out << "\n";
+                out.flush();
+
+                results.append(toJson(benchmark.name, state));
+                break;
+            }
+
+            // predict the iterations needed, with a 40% margin, growing 10x at most
+            double multiplier = (minTime * 1.4) / std::max(state.realTime(), (qint64)1);
+            multiplier = std::min(std::max(multiplier, 2.0), 10.0);
+            iterations = std::min((qint64)(iterations * multiplier), maxIterations);
+        }
+    }
+
+    if (!options.outFilename.isEmpty())
+    {
+        QJsonObject context;
+        context["date"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+        context["host_name"] = QHostInfo::localHostName();
+        context["executable"] = QCoreApplication::applicationFilePath();
+        context["num_cpus"] = QThread::idealThreadCount();
+#ifdef QT_NO_DEBUG
+        context["library_build_type"] = QString("release");
+#else
+        context["library_build_type"] = QString("debug");
+#endif
+
+        QJsonObject root;
+        root["context"] = context;
+        root["benchmarks"] = results;
+
+        QFile file(options.outFilename);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            err << "Could not write: " << options.outFilename << "\n";
+            return 1;
+        }
+        file.write(QJsonDocument(root).toJson());
+    }
+
+    return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#pragma once
+
+#include <ctime>
+#include <functional>
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QString>
+
+/**
+ * @brief The BenchmarkState class drives the loop of one benchmark run.
+ * Modeled after Google Benchmark's benchmark::State:
+ *
+ *     while (state.keepRunning()) {
+ *         // code to measure
+ *     }
+ */
+class BenchmarkState
+{
+public:
+    explicit BenchmarkState(qint64 iterations);
+
+    /**
+     * @brief keepRunning starts the timer the first time it is called,
+     * and stops it once all the iterations were run
+     * @return true while there are iterations left to run
+     */
+    bool keepRunning();
+
+    /**
+     * @brief pauseTiming excludes the code that follows from the measurement.
+     * Useful to reset the data between iterations
+     */
+    void pauseTiming();
+    void resumeTiming();
+
+    /**
+     * @brief setItemsProcessed reports the items processed by all the iterations.
+     * Reported as items per second
+     */
+    void setItemsProcessed(qint64 items);
+    /**
+     * @brief setBytesProcessed reports the bytes processed by all the iterations.
+     * Reported as bytes per second
+     */
+    void setBytesProcessed(qint64 bytes);
+    /**
+     * @brief setCounter reports a custom value, like Google Benchmark's user counters.
+     * It is reported as is: divide it by the iterations for a per-iteration value
+     */
+    void setCounter(const QString& name, double value);
+
+    /**
+     * @brief skipWithError aborts the benchmark. It won't be reported
+     * @param error the reason
+     */
+    void skipWithError(const QString& error);
+
+    qint64 iterations() const { return _iterations; }
+    qint64 itemsProcessed() const { return _itemsProcessed; }
+    qint64 bytesProcessed() const { return _bytesProcessed; }
+    const QMap<QString, double>& counters() const { return _counters; }
+    const QString& error() const { return _error; }
+    bool hasError() const { return !_error.isEmpty(); }
+
+    /** @brief realTime wall time of all the iterations, in nanoseconds */
+    qint64 realTime() const { return _realTime; }
+    /** @brief cpuTime CPU time of all the iterations, in nanoseconds */
+    qint64 cpuTime() const { return _cpuTime; }
+
+protected:
+    qint64 _iterations;
+    qint64 _remaining;
+    bool _started;
+    bool _running;
+
+    QElapsedTimer _timer;
+    std::clock_t _cpuStart;
+
+    qint64 _realTime;
+    qint64 _cpuTime;
+
+    qint64 _itemsProcessed;
+    qint64 _bytesProcessed;
+    QMap<QString, double> _counters;
+
+    QString _error;
+};
+
+typedef std::function<void(BenchmarkState&)> BenchmarkFunction;
+
+/**
+ * @brief registerBenchmark adds a benchmark to the suite
+ * @param name name of the benchmark. Sub-cases are separated with "/", like "loadCTM/file.ctm"
+ * @param function the function to measure
+ */
+void registerBenchmark(const QString& name, const BenchmarkFunction& function);
+
+/**
+ * @brief The BenchmarkOptions struct how to run the suite
+ */
+struct BenchmarkOptions {
+    /** @brief only the benchmarks whose name matches this regular expression are run */
+    QString filter;
+    /** @brief minimum time, in seconds, that each benchmark runs */
+    double minTime;
+    /** @brief JSON file where the results are written. Empty for none */
+    QString outFilename;
+};
+
+/**
+ * @brief runBenchmarks runs the registered benchmarks, prints the results
+ * and writes them in Google Benchmark's JSON format
+ * @param options how to run them
+ * @return 0 if all the benchmarks could be run
+ */
+int runBenchmarks(const BenchmarkOptions& options);
@@ -0,0 +1,44 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#pragma once
+
+#include <QtGlobal>
+
+QT_BEGIN_NAMESPACE
+class QDir;
+QT_END_NAMESPACE
+
+/**
+ * @brief registerImportBenchmarks StateImport readers, once per file in dataDir
+ */
+void registerImportBenchmarks(const QDir& dataDir);
+
+/**
+ * @brief registerRenderBenchmarks char decoding, map rendering and flood fill
+ */
+void registerRenderBenchmarks();
+
+/**
+ * @brief registerKoalaBenchmarks Koala to charset conversion, once per file in dataDir
+ */
+void registerKoalaBenchmarks(const QDir& dataDir);
+
+/**
+ * @brief registerPreviewBenchmarks ServerPreview replaying edit sessions
+ * against a local vchar64d emulator
+ */
+void registerPreviewBenchmarks();
@@ -0,0 +1,108 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "benchmarks.h"
+
+#include <vector>
+
+#include <QDir>
+#include <QFile>
+
+#include "benchmark.h"
+#include "state.h"
+#include "stateimport.h"
+
+typedef std::function<qint64(State*, QFile&)> Loader;
+
+// files that can't be loaded, like the unsupported CTM, are not benchmarked
+static bool canLoad(const QString& filepath, const Loader& loader)
+{
+    QFile file(filepath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    State state;
+    return loader(&state, file) > 0;
+}
+
+static void registerLoader(const QDir& dataDir, const QString& pattern, const QString& name, const Loader& loader)
+{
+    for (const auto& filename: dataDir.entryList({pattern}, QDir::Files, QDir::Name))
+    {
+        const auto filepath = dataDir.absoluteFilePath(filename);
+        if (!canLoad(filepath, loader))
+            continue;
+
+        registerBenchmark(name + "/" + filename, [filepath, loader](BenchmarkState& state) {
+            QFile file(filepath);
+            if (!file.open(QIODevice::ReadOnly))
+            {
+                state.skipWithError("Could not open " + filepath);
+                return;
+            }
+
+            State vstate;
+            while (state.keepRunning())
+            {
+                file.seek(0);
+                loader(&vstate, file);
+            }
+            state.setBytesProcessed(file.size() * state.iterations());
+            state.setItemsProcessed(state.iterations());
+        });
+    }
+}
+
+void registerImportBenchmarks(const QDir& dataDir)
+{
+    registerLoader(dataDir, "*.ctm", "StateImport::loadCTM", StateImport::loadCTM);
+    registerLoader(dataDir, "*.vchar64proj", "StateImport::loadVChar64", StateImport::loadVChar64);
+    registerLoader(dataDir, "*.prg", "StateImport::loadPRG", [](State* state, QFile& file) {
+        quint16 address;
+        return StateImport::loadPRG(state, file, &address);
+    });
+
+    // parseVICESnapshot only decodes the snapshot: no State involved
+    const auto vsfFiles = dataDir.entryList({"*.vsf"}, QDir::Files, QDir::Name);
+    for (const auto& filename: vsfFiles)
+    {
+        const auto filepath = dataDir.absoluteFilePath(filename);
+        registerBenchmark("StateImport::parseVICESnapshot/" + filename, [filepath](BenchmarkState& state) {
+            QFile file(filepath);
+            if (!file.open(QIODevice::ReadOnly))
+            {
+                state.skipWithError("Could not open " + filepath);
+                return;
+            }
+
+            std::vector<quint8> memory(64 * 1024);
+            quint8 colorRAM[1024];
+            quint8 VICRegisters[64];
+            quint16 charsetAddress, screenRAMAddress;
+
+            while (state.keepRunning())
+            {
+                file.seek(0);
+                if (StateImport::parseVICESnapshot(file, memory.data(), &charsetAddress, &screenRAMAddress, colorRAM, VICRegisters) < 0)
+                {
+                    state.skipWithError("Invalid VICE snapshot " + filepath);
+                    break;
+                }
+            }
+            state.setBytesProcessed(file.size() * state.iterations());
+            state.setItemsProcessed(state.iterations());
+        });
+    }
+}
@@ -0,0 +1,67 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "benchmarks.h"
+
+#include <QDir>
+
+#include "benchmark.h"
+#include "importkoalabitmapwidget.h"
+#include "importkoaladialog.h"
+
+// gives access to the conversion steps, which are protected
+class BenchKoalaDialog : public ImportKoalaDialog
+{
+public:
+    using ImportKoalaDialog::validateKoalaFile;
+    using ImportKoalaDialog::convert;
+};
+
+void registerKoalaBenchmarks(const QDir& dataDir)
+{
+    for (const auto& filename: dataDir.entryList({"*.koa", "*.kla"}, QDir::Files, QDir::Name))
+    {
+        const auto filepath = dataDir.absoluteFilePath(filename);
+
+        registerBenchmark("ImportKoalaBitmapWidget::findUniqueCells/" + filename, [filepath](BenchmarkState& state) {
+            ImportKoalaBitmapWidget widget;
+            widget.loadKoala(filepath);
+
+            // parseKoala: resetColors + findUniqueCells
+            while (state.keepRunning())
+                widget.parseKoala();
+            state.setItemsProcessed(40 * 25 * state.iterations());
+        });
+
+        registerBenchmark("ImportKoalaDialog::convert/" + filename, [filepath](BenchmarkState& state) {
+            BenchKoalaDialog dialog;
+            dialog.validateKoalaFile(filepath);
+
+            while (state.keepRunning())
+                dialog.convert();
+            state.setItemsProcessed(40 * 25 * state.iterations());
+        });
+
+        // the whole pipeline, as run when a file is selected in the dialog
+        registerBenchmark("ImportKoalaDialog::validateKoalaFile/" + filename, [filepath](BenchmarkState& state) {
+            BenchKoalaDialog dialog;
+
+            while (state.keepRunning())
+                dialog.validateKoalaFile(filepath);
+            state.setItemsProcessed(state.iterations());
+        });
+    }
+}
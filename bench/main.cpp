@@ -0,0 +1,89 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+
+#include "benchmark.h"
+#include "benchmarks.h"
+#include "messagesink.h"
+
+// the benchmarks load invalid files on purpose: don't flood the output
+class QuietMessageSink : public MessageSink
+{
+public:
+    void showMessage(const QString&) Q_DECL_OVERRIDE {}
+    void showError(const QString&) Q_DECL_OVERRIDE {}
+};
+
+int main(int argc, char *argv[])
+{
+    // the Koala benchmarks create widgets, but nothing is shown
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    Q_INIT_RESOURCE(resources);
+
+    QApplication app(argc, argv);
+    app.setOrganizationDomain(QLatin1String("retro.moe"));
+    app.setApplicationName(QLatin1String("vchar64-bench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("VChar64 micro-benchmarks");
+    parser.addHelpOption();
+
+    QCommandLineOption filterOption("benchmark_filter",
+                                    "Run only the benchmarks that match the regular expression",
+                                    "regex", ".*");
+    QCommandLineOption minTimeOption("benchmark_min_time",
+                                     "Minimum time, in seconds, that each benchmark runs. Default: 0.5",
+                                     "seconds", "0.5");
+    QCommandLineOption outOption("benchmark_out",
+                                 "Write the results to this file, in Google Benchmark's JSON format",
+                                 "filename");
+    QCommandLineOption dataDirOption("data_dir",
+                                     "Directory with the files to load. Default: the tests directory",
+                                     "dir", QLatin1String(BENCH_DATA_DIR));
+    parser.addOption(filterOption);
+    parser.addOption(minTimeOption);
+    parser.addOption(outOption);
+    parser.addOption(dataDirOption);
+    parser.process(app);
+
+    BenchmarkOptions options;
+    options.filter = parser.value(filterOption);
+    options.outFilename = parser.value(outOption);
+
+    bool ok;
+    options.minTime = parser.value(minTimeOption).toDouble(&ok);
+    if (!ok || options.minTime <= 0)
+        parser.showHelp(1);
+
+    QuietMessageSink sink;
+    MessageSink::setInstance(&sink);
+
+    const QDir dataDir(parser.value(dataDirOption));
+    registerImportBenchmarks(dataDir);
+    registerRenderBenchmarks();
+    registerKoalaBenchmarks(dataDir);
+    registerPreviewBenchmarks();
+
+    auto ret = runBenchmarks(options);
+
+    MessageSink::setInstance(nullptr);
+    return ret;
+}
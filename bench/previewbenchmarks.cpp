@@ -0,0 +1,286 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#include "benchmarks.h"
+
+#include <cstring>
+#include <functional>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QPoint>
+#include <QTimer>
+
+#include "benchmark.h"
+#include "serveremulator.h"
+#include "serverpreview.h"
+#include "state.h"
+#include "vicemonitoremulator.h"
+#include "vicepreview.h"
+
+// an edit session: the same steps the user does in the editor.
+// other is a second document, similar to the first one
+struct EditSession {
+    const char* name;
+    int steps;
+    std::function<void(PreviewTarget* preview, State* state, State* other, int step, int iteration)> replay;
+};
+
+static const EditSession sessions[] = {
+    // File -> Open, alternating the two ROM charsets so that every iteration
+    // uploads the charset again: only the chars both share are skipped
+    {"load", 1, [](PreviewTarget*, State* state, State*, int, int iteration) {
+        state->openFile((iteration % 2) ? ":/res/c64-chargen-uppercase.bin" : ":/res/c64-chargen-lowercase.bin");
+    }},
+    // a mouse drag in the BigCharWidget: every pixel of the char, one by one
+    {"draw", 64, [](PreviewTarget*, State* state, State*, int step, int iteration) {
+        state->tilePaint(1, QPoint(step % 8, step / 8), (iteration % 2) ? State::PEN_BACKGROUND : State::PEN_FOREGROUND, true);
+    }},
+    // Tile -> Invert on every tile, like a fast typist
+    {"invert", 256, [](PreviewTarget*, State* state, State*, int step, int) {
+        state->tileInvert(step);
+    }},
+    // browsing the foreground colors
+    {"colors", 16, [](PreviewTarget*, State* state, State*, int step, int) {
+        state->setColorForPen(State::PEN_FOREGROUND, step);
+    }},
+    // activating another MDI subwindow, back and forth
+    {"switch_document", 1, [](PreviewTarget* preview, State* state, State* other, int, int iteration) {
+        auto document = (iteration % 2) ? state : other;
+        preview->setState(document);
+        document->emitNewState();
+    }},
+};
+
+/**
+ * @brief The PreviewHarness struct a preview target connected to its emulator:
+ * what is different for each transport
+ */
+struct PreviewHarness {
+    PreviewTarget* preview;
+    std::function<bool()> connect;
+    std::function<void()> disconnect;
+    // true once the emulator applied everything, and its charset is the same as the previewed state's
+    std::function<bool()> isSynced;
+    // transport counters, like the bytes sent. Reported per iteration
+    std::function<QMap<QString, qint64>()> getCounters;
+    // empty unless the emulator found protocol errors
+    std::function<QString()> getError;
+};
+
+static bool waitUntilSynced(const PreviewHarness& harness)
+{
+    // WaitForMoreEvents must not block forever if something goes wrong
+    QTimer heartbeat;
+    heartbeat.start(10);
+
+    QElapsedTimer timeout;
+    timeout.start();
+    while (timeout.elapsed() < 5000)
+    {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        if (harness.isSynced())
+            return true;
+    }
+    return false;
+}
+
+static bool isCharsetSynced(PreviewTarget* preview, const quint8* charset)
+{
+    return memcmp(charset, preview->getState()->getCharsetBuffer(), State::CHAR_BUFFER_SIZE) == 0;
+}
+
+static void runSession(BenchmarkState& state, const EditSession& session, const PreviewHarness& harness)
+{
+    State vstate;
+    vstate.openFile(":/res/c64-chargen-uppercase.bin");
+    vstate.clearUndoStack();
+
+    // the same charset, with a few tiles changed
+    State other;
+    other.openFile(":/res/c64-chargen-uppercase.bin");
+    for (int tile: {1, 2, 3, 48, 49})
+        other.tileInvert(tile);
+    other.clearUndoStack();
+
+    auto preview = harness.preview;
+    preview->setState(&vstate);
+    // same as MainWindow::createDocument()
+    preview->connectToState(&vstate);
+    preview->connectToState(&other);
+
+    if (!harness.connect())
+        state.skipWithError("Could not connect to the emulator");
+    // the initial upload is not measured
+    else if (!waitUntilSynced(harness))
+        state.skipWithError("Timeout syncing the initial state");
+
+    const auto counters = harness.getCounters();
+    const auto writes = preview->getMemoryWrites();
+    qint64 latency = 0;
+    int iteration = 0;
+
+    while (state.keepRunning())
+    {
+        // events are processed between steps, like the mouse events in the editor
+        for (int step=0; step<session.steps; ++step)
+        {
+            session.replay(preview, &vstate, &other, step, iteration);
+            QCoreApplication::processEvents();
+        }
+
+        // end-to-end: from the last edit until the emulator has it
+        QElapsedTimer timer;
+        timer.start();
+        if (!waitUntilSynced(harness))
+        {
+            state.skipWithError("Timeout: the emulator is out of sync");
+            break;
+        }
+        latency += timer.nsecsElapsed();
+
+        if (++iteration % 64 == 0)
+        {
+            state.pauseTiming();
+            vstate.clearUndoStack();
+            state.resumeTiming();
+        }
+    }
+
+    const auto error = harness.getError();
+    if (!error.isEmpty())
+        state.skipWithError(error);
+
+    const double iterations = qMax(iteration, 1);
+    const auto current = harness.getCounters();
+    for (auto it = current.constBegin(); it != current.constEnd(); ++it)
+        state.setCounter(it.key(), (it.value() - counters.value(it.key())) / iterations);
+    state.setBytesProcessed(current.value("bytes") - counters.value("bytes"));
+    state.setCounter("writes", (preview->getMemoryWrites() - writes) / iterations);
+    state.setCounter("latency_ms", latency / iterations / 1e6);
+
+    QObject::disconnect(&vstate, nullptr, preview, nullptr);
+    QObject::disconnect(&other, nullptr, preview, nullptr);
+    harness.disconnect();
+    QCoreApplication::processEvents();
+    preview->setState(nullptr);
+}
+
+static void runServerSession(BenchmarkState& state, const EditSession& session, int pongDelay)
+{
+    ServerEmulator emulator;
+    emulator.setPongDelay(pongDelay);
+    if (!emulator.listen())
+    {
+        state.skipWithError("Could not listen in the vchar64d port");
+        return;
+    }
+
+    auto preview = ServerPreview::getInstance();
+
+    PreviewHarness harness;
+    harness.preview = preview;
+    harness.connect = [preview]() {
+        return preview->connect("127.0.0.1");
+    };
+    harness.disconnect = [preview]() {
+        preview->disconnect();
+    };
+    harness.isSynced = [preview, &emulator]() {
+        return preview->isIdle()
+                && emulator.getBytesReceived() == preview->getBytesSent()
+                && isCharsetSynced(preview, emulator.getMemory() + ServerEmulator::CHARSET_ADDRESS);
+    };
+    harness.getCounters = [preview]() {
+        return QMap<QString, qint64>{
+            {"packets", preview->getPacketsSent()},
+            {"bytes", preview->getBytesSent()},
+            {"stalls", preview->getSyncStalls()},
+        };
+    };
+    harness.getError = [&emulator]() {
+        if (emulator.getWindowOverflows() > 0 || emulator.getProtocolErrors() > 0)
+            return QString("Protocol violation: server buffer overflow, invalid or truncated command");
+        return QString();
+    };
+
+    runSession(state, session, harness);
+    emulator.close();
+}
+
+static void runViceSession(BenchmarkState& state, const EditSession& session)
+{
+    ViceMonitorEmulator emulator;
+    if (!emulator.listen())
+    {
+        state.skipWithError("Could not listen in the VICE binary monitor port");
+        return;
+    }
+
+    auto preview = VicePreview::getInstance();
+
+    PreviewHarness harness;
+    harness.preview = preview;
+    harness.connect = [preview]() {
+        return preview->connect("127.0.0.1");
+    };
+    harness.disconnect = [preview]() {
+        preview->disconnect();
+    };
+    harness.isSynced = [preview, &emulator]() {
+        return preview->isIdle()
+                && emulator.isRunning()
+                && emulator.getBytesReceived() == preview->getBytesSent()
+                && isCharsetSynced(preview, emulator.getMemory() + ViceMonitorEmulator::CHARSET_ADDRESS);
+    };
+    harness.getCounters = [preview, &emulator]() {
+        return QMap<QString, qint64>{
+            {"commands", preview->getCommandsSent()},
+            {"bytes", preview->getBytesSent()},
+            // each one freezes the emulation until the EXIT
+            {"stops", emulator.getStops()},
+        };
+    };
+    harness.getError = [preview, &emulator]() {
+        if (preview->getErrors() > 0 || emulator.getProtocolErrors() > 0)
+            return QString("Protocol violation: invalid command or response");
+        return QString();
+    };
+
+    runSession(state, session, harness);
+    emulator.close();
+}
+
+void registerPreviewBenchmarks()
+{
+    for (const auto& session: sessions)
+    {
+        // 0ms: the protocol overhead alone. 10ms: a C64 busy processing each window
+        for (int pongDelay: {0, 10})
+        {
+            const QString name = QString("ServerPreview/%1/pong_delay:%2ms").arg(session.name).arg(pongDelay);
+            registerBenchmark(name, [&session, pongDelay](BenchmarkState& state) {
+                runServerSession(state, session, pongDelay);
+            });
+        }
+
+        registerBenchmark(QString("VicePreview/%1").arg(session.name), [&session](BenchmarkState& state) {
+            runViceSession(state, session);
+        });
+    }
+}
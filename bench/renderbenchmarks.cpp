@@ -0,0 +1,353 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "benchmarks.h"
+
+#include <cstring>
+#include <vector>
+
+#include <QImage>
+#include <QPoint>
+#include <QQueue>
+#include <QUndoStack>
+#include <QVector>
+
+#include "benchmark.h"
+#include "chardecoder.h"
+#include "state.h"
+#include "utils.h"
+
+static void loadDefaultCharset(State* state, bool multicolor)
+{
+    state->openFile(":/res/c64-chargen-uppercase.bin");
+    state->setMulticolorMode(multicolor);
+    state->clearUndoStack();
+}
+
+static void registerDrawCharBenchmarks()
+{
+    for (bool multicolor: {false, true})
+    {
+        for (bool cached: {true, false})
+        {
+            const QString name = QString("utilsDrawCharInImage/%1/%2")
+                    .arg(multicolor ? "multicolor" : "hires")
+                    .arg(cached ? "cached" : "decoded");
+
+            registerBenchmark(name, [multicolor, cached](BenchmarkState& state) {
+                State vstate;
+                loadDefaultCharset(&vstate, multicolor);
+
+                // same layout as CharsetWidget: 32 x 8 chars
+                QImage image(32 * 8, 8 * 8, QImage::Format_RGB888);
+
+                while (state.keepRunning())
+                {
+                    if (!cached)
+                        vstate.invalidateCharImages();
+                    for (int i=0; i<256; ++i)
+                        utilsDrawCharInImage(&vstate, &image, QPoint((i % 32) * 8, (i / 32) * 8), i);
+                }
+                state.setItemsProcessed(256 * state.iterations());
+            });
+        }
+    }
+}
+
+static void registerCharDecoderBenchmarks()
+{
+    for (bool multicolor: {false, true})
+    {
+        const QString name = QString("CharDecoder::decodeRow/%1").arg(multicolor ? "multicolor" : "hires");
+
+        registerBenchmark(name, [multicolor](BenchmarkState& state) {
+            State vstate;
+            loadDefaultCharset(&vstate, false);
+
+            // the whole charset in one pass
+            std::vector<quint8> pens(State::CHAR_BUFFER_SIZE * 8);
+            while (state.keepRunning())
+                CharDecoder::decodeRow(vstate.getCharsetBuffer(), State::CHAR_BUFFER_SIZE, multicolor, pens.data());
+            state.setBytesProcessed(State::CHAR_BUFFER_SIZE * state.iterations());
+        });
+    }
+}
+
+// same work as MapWidget::updateTileImages + MapWidget::updateMapImage
+// when everything is dirty, without the widget
+static void registerMapRenderBenchmarks()
+{
+    for (int tileSize: {1, 2, 4})
+    {
+        const QString name = QString("MapWidget::updateMapImage/%1x%1").arg(tileSize);
+
+        registerBenchmark(name, [tileSize](BenchmarkState& state) {
+            State vstate;
+            loadDefaultCharset(&vstate, false);
+            vstate.setTileProperties({{tileSize, tileSize}, 1});
+            vstate.setMapSize({40, 25});
+            vstate.clearUndoStack();
+
+            const int tw = tileSize;
+            const int th = tileSize;
+            const int totalTiles = 256 / (tw * th);
+            QImage tileAtlas(tw * 8, totalTiles * th * 8, QImage::Format_ARGB32_Premultiplied);
+
+            const auto mapSize = vstate.getMapSize();
+            QImage mapImage(mapSize.width() * tw * 8, mapSize.height() * th * 8, QImage::Format_ARGB32_Premultiplied);
+
+            while (state.keepRunning())
+            {
+                vstate.invalidateCharImages();
+
+                for (int tileIdx=0; tileIdx<totalTiles; ++tileIdx)
+                {
+                    int charIdx = tileIdx * tw * th;
+                    for (int quadrant=0; quadrant < tw * th; ++quadrant)
+                    {
+                        utilsDrawCharInImage(&vstate, &tileAtlas,
+                                             QPoint((quadrant % tw) * 8, tileIdx * th * 8 + (quadrant / tw) * 8), charIdx);
+                        charIdx++;
+                    }
+                }
+
+                for (int y=0; y<mapSize.height(); ++y)
+                {
+                    for (int x=0; x<mapSize.width(); ++x)
+                    {
+                        const int srcY = (vstate.getTileIndexFromMap(QPoint(x,y)) % totalTiles) * th * 8;
+                        for (int i=0; i<th * 8; ++i)
+                            memcpy(mapImage.scanLine(y * th * 8 + i) + x * tw * 8 * 4,
+                                   tileAtlas.constScanLine(srcY + i), tw * 8 * 4);
+                    }
+                }
+            }
+            state.setItemsProcessed(mapSize.width() * mapSize.height() * state.iterations());
+        });
+    }
+}
+
+enum SyntheticMap {
+    MAP_EMPTY,          // a single region: the whole map
+    MAP_MAZE,           // one-cell wide corridors
+    MAP_RANDOM          // random walls, 30% of the cells
+};
+
+// seeds: cells that are never walls, so a fill can start there
+static void setupSyntheticMap(State* state, SyntheticMap type, const QSize& size,
+                              const QVector<QPoint>& seeds = {QPoint(0,0)})
+{
+    state->setMapSize(size);
+    state->mapClear(0);
+
+    // deterministic: same map in every run
+    quint32 seed = 0x1234;
+    auto random = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) & 0x7fff;
+    };
+
+    for (int y=0; y<size.height(); ++y)
+    {
+        for (int x=0; x<size.width(); ++x)
+        {
+            bool wall = false;
+            if (type == MAP_MAZE)
+                // vertical walls every other column, with a gap alternating between top and bottom
+                wall = (x % 2 == 1) && (y != ((x / 2) % 2 == 0 ? size.height() - 1 : 0));
+            else if (type == MAP_RANDOM)
+                wall = (random() % 100) < 30;
+
+            // keep the seeds free: the fill starts there
+            if (wall && !seeds.contains(QPoint(x,y)))
+                state->mapPaint(QPoint(x,y), 2, true);
+        }
+    }
+    state->clearUndoStack();
+}
+
+static void registerFloodFillBenchmarks()
+{
+    const struct {
+        SyntheticMap type;
+        const char* name;
+    } maps[] = {
+        {MAP_EMPTY, "empty"},
+        {MAP_MAZE, "maze"},
+        {MAP_RANDOM, "random"},
+    };
+
+    for (const auto& map: maps)
+    {
+        for (int size: {40, 128, 255})
+        {
+            const QString name = QString("State::mapFill/%1/%2x%2").arg(map.name).arg(size);
+            const auto type = map.type;
+
+            registerBenchmark(name, [type, size](BenchmarkState& state) {
+                State vstate;
+                setupSyntheticMap(&vstate, type, QSize(size, size));
+
+                // (0,0) is never a wall. Alternating between tile 0 and 1
+                // refills the same region in every iteration
+                int tile = 1;
+                qint64 count = 0;
+                while (state.keepRunning())
+                {
+                    vstate.mapFill(QPoint(0,0), tile);
+                    tile ^= 1;
+
+                    // the fill commands keep the filled runs: don't let them pile up
+                    if (++count % 256 == 0)
+                    {
+                        state.pauseTiming();
+                        vstate.clearUndoStack();
+                        state.resumeTiming();
+                    }
+                }
+                state.setItemsProcessed(state.iterations());
+            });
+        }
+    }
+}
+
+static std::vector<int> mapSnapshot(const State* state)
+{
+    const auto size = state->getMapSize();
+    std::vector<int> tiles(size.width() * size.height());
+    for (int y=0; y<size.height(); ++y)
+        for (int x=0; x<size.width(); ++x)
+            tiles[y * size.width() + x] = state->getTileIndexFromMap(QPoint(x,y));
+    return tiles;
+}
+
+// reference for the fill: a plain 4-way breadth-first search
+static std::vector<bool> reachableCells(const std::vector<int>& tiles, const QSize& size, const QPoint& seed)
+{
+    std::vector<bool> reachable(tiles.size(), false);
+    const int tile = tiles[seed.y() * size.width() + seed.x()];
+
+    QQueue<QPoint> queue;
+    queue.enqueue(seed);
+    reachable[seed.y() * size.width() + seed.x()] = true;
+    while (!queue.isEmpty())
+    {
+        const auto p = queue.dequeue();
+        for (const auto& d: {QPoint(1,0), QPoint(-1,0), QPoint(0,1), QPoint(0,-1)})
+        {
+            const auto n = p + d;
+            if (n.x() < 0 || n.y() < 0 || n.x() >= size.width() || n.y() >= size.height())
+                continue;
+            const int idx = n.y() * size.width() + n.x();
+            if (!reachable[idx] && tiles[idx] == tile)
+            {
+                reachable[idx] = true;
+                queue.enqueue(n);
+            }
+        }
+    }
+    return reachable;
+}
+
+// 65535 cells, filled from each corner. Before measuring, checks that every
+// reachable cell changed, nothing else did, and that undo restores the map
+static void registerFloodFillStressBenchmarks()
+{
+    const QSize size(255, 257);
+    const struct {
+        QPoint seed;
+        const char* name;
+    } corners[] = {
+        {QPoint(0, 0), "top_left"},
+        {QPoint(size.width() - 1, 0), "top_right"},
+        {QPoint(0, size.height() - 1), "bottom_left"},
+        {QPoint(size.width() - 1, size.height() - 1), "bottom_right"},
+    };
+    QVector<QPoint> seeds;
+    for (const auto& corner: corners)
+        seeds.append(corner.seed);
+
+    const struct {
+        SyntheticMap type;
+        const char* name;
+    } maps[] = {
+        {MAP_EMPTY, "empty"},
+        {MAP_RANDOM, "random"},
+    };
+
+    for (const auto& map: maps)
+    {
+        for (const auto& corner: corners)
+        {
+            const QString name = QString("State::mapFill/stress/%1/%2").arg(map.name).arg(corner.name);
+            const auto type = map.type;
+            const auto seed = corner.seed;
+
+            registerBenchmark(name, [type, seed, seeds, size](BenchmarkState& state) {
+                State vstate;
+                setupSyntheticMap(&vstate, type, size, seeds);
+
+                const auto before = mapSnapshot(&vstate);
+                const auto reachable = reachableCells(before, size, seed);
+
+                // the tile of the seed is 0: the fill uses 1
+                vstate.mapFill(seed, 1);
+                const auto filled = mapSnapshot(&vstate);
+                for (std::size_t i=0; i<filled.size(); ++i)
+                {
+                    if (filled[i] != (reachable[i] ? 1 : before[i]))
+                    {
+                        state.skipWithError(QString("Wrong fill at (%1,%2)").arg(i % size.width()).arg(i / size.width()));
+                        return;
+                    }
+                }
+
+                vstate.getUndoStack()->undo();
+                if (mapSnapshot(&vstate) != before)
+                {
+                    state.skipWithError("Undo didn't restore the map");
+                    return;
+                }
+                vstate.clearUndoStack();
+
+                int tile = 1;
+                qint64 count = 0;
+                while (state.keepRunning())
+                {
+                    vstate.mapFill(seed, tile);
+                    tile ^= 1;
+
+                    if (++count % 256 == 0)
+                    {
+                        state.pauseTiming();
+                        vstate.clearUndoStack();
+                        state.resumeTiming();
+                    }
+                }
+                state.setItemsProcessed(size.width() * size.height() * state.iterations());
+            });
+        }
+    }
+}
+
+void registerRenderBenchmarks()
+{
+    registerCharDecoderBenchmarks();
+    registerDrawCharBenchmarks();
+    registerMapRenderBenchmarks();
+    registerFloodFillBenchmarks();
+    registerFloodFillStressBenchmarks();
+}
@@ -0,0 +1,285 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#include "serveremulator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QtEndian>
+
+#include "serverprotocol.h"
+
+// 16-bit addresses: it wraps around, like in the 6502
+static void writeMemory(std::vector<quint8>& memory, quint16 addr, const quint8* src, int count)
+{
+    for (int i=0; i<count; i++)
+        memory[(quint16)(addr + i)] = src[i];
+}
+
+static void fillMemory(std::vector<quint8>& memory, quint16 addr, quint8 value, int count)
+{
+    for (int i=0; i<count; i++)
+        memory[(quint16)(addr + i)] = value;
+}
+
+ServerEmulator::ServerEmulator(QObject* parent)
+    : QObject(parent)
+    , _socket(nullptr)
+    , _memory(64 * 1024)
+    , _pongDelay(0)
+    , _windowBytes(0)
+    , _bytesReceived(0)
+    , _packetsReceived(0)
+    , _windowOverflows(0)
+    , _protocolErrors(0)
+{
+    _server = new QTcpServer(this);
+    connect(_server, &QTcpServer::newConnection, this, &ServerEmulator::onNewConnection);
+}
+
+ServerEmulator::~ServerEmulator()
+= default;
+
+bool ServerEmulator::listen(quint16 port)
+{
+    if (port == 0)
+        port = VCHAR64_SERVER_LISTEN_PORT;
+    return _server->listen(QHostAddress::LocalHost, port);
+}
+
+void ServerEmulator::close()
+{
+    if (_socket)
+        _socket->disconnectFromHost();
+    _server->close();
+}
+
+void ServerEmulator::setPongDelay(int msecs)
+{
+    _pongDelay = msecs;
+}
+
+void ServerEmulator::reset()
+{
+    std::fill(_memory.begin(), _memory.end(), 0);
+    _windowBytes = 0;
+    _bytesReceived = 0;
+    _packetsReceived = 0;
+    _windowOverflows = 0;
+    _protocolErrors = 0;
+}
+
+void ServerEmulator::onNewConnection()
+{
+    // vchar64d only supports one client
+    auto socket = _server->nextPendingConnection();
+    if (_socket)
+    {
+        socket->disconnectFromHost();
+        return;
+    }
+
+    _socket = socket;
+    _windowBytes = 0;
+    connect(_socket, &QTcpSocket::readyRead, this, &ServerEmulator::onReadyRead);
+    connect(_socket, &QTcpSocket::disconnected, this, [this]() {
+        _socket->deleteLater();
+        _socket = nullptr;
+    });
+}
+
+void ServerEmulator::onReadyRead()
+{
+    // each chunk is parsed on its own. vchar64d keeps a split command until
+    // the rest arrives, but the servers built before it don't: stay strict
+    const auto data = _socket->readAll();
+    _bytesReceived += data.size();
+
+    int offset = 0;
+    while (offset < data.size())
+    {
+        const int size = processPacket((const quint8*)data.constData() + offset, data.size() - offset);
+        if (size <= 0)
+        {
+            // invalid or truncated: the rest of the chunk is discarded
+            _protocolErrors++;
+            break;
+        }
+
+        _packetsReceived++;
+        offset += size;
+    }
+
+    emit packetsProcessed();
+}
+
+int ServerEmulator::processPacket(const quint8* data, int size)
+{
+    const int headerSize = sizeof(struct vchar64d_proto_header);
+    if (size < headerSize)
+        return 0;
+
+    const quint8* payload = data + headerSize;
+    const int payloadSize = size - headerSize;
+    int packetSize;
+
+    switch (data[0])
+    {
+    case TYPE_HELLO:
+        packetSize = sizeof(struct vchar64d_proto_hello);
+        if (payloadSize < packetSize)
+            return 0;
+        sendHello();
+        break;
+
+    case TYPE_SET_BYTE_FOR_CHAR:
+        packetSize = sizeof(struct vchar64d_proto_set_byte);
+        if (payloadSize < packetSize)
+            return 0;
+        _memory[(quint16)(CHARSET_ADDRESS + qFromLittleEndian<quint16>(payload))] = payload[2];
+        break;
+
+    case TYPE_SET_CHAR:
+        packetSize = sizeof(struct vchar64d_proto_set_char);
+        if (payloadSize < packetSize)
+            return 0;
+        writeMemory(_memory, CHARSET_ADDRESS + payload[0] * 8, &payload[1], 8);
+        break;
+
+    case TYPE_SET_CHARS:
+        // idx + count
+        if (payloadSize < 2)
+            return 0;
+        packetSize = 2 + payload[1] * 8;
+        if (payloadSize < packetSize)
+            return 0;
+        writeMemory(_memory, CHARSET_ADDRESS + payload[0] * 8, &payload[2], payload[1] * 8);
+        break;
+
+    case TYPE_SET_MEM:
+    case TYPE_SET_MEM_RLE:
+    {
+        // addr + count
+        if (payloadSize < 4)
+            return 0;
+        const quint16 addr = qFromLittleEndian<quint16>(payload);
+        const quint16 count = qFromLittleEndian<quint16>(payload + 2);
+        packetSize = 4 + count;
+        if (payloadSize < packetSize)
+            return 0;
+
+        if (data[0] == TYPE_SET_MEM)
+        {
+            writeMemory(_memory, addr, &payload[4], count);
+            break;
+        }
+
+        // same decoder as vchar64d
+        const quint8* src = &payload[4];
+        const quint8* end = src + count;
+        quint16 dst = addr;
+        while (src < end)
+        {
+            int n = *src++;
+            if (n & 0x80)
+            {
+                n = (n & 0x7f) + 2;
+                if (src >= end)
+                    return -1;
+                fillMemory(_memory, dst, *src++, n);
+            }
+            else
+            {
+                n++;
+                if (src + n > end)
+                    return -1;
+                writeMemory(_memory, dst, src, n);
+                src += n;
+            }
+            dst += n;
+        }
+        break;
+    }
+
+    case TYPE_POKE:
+        packetSize = sizeof(struct vchar64d_proto_poke);
+        if (payloadSize < packetSize)
+            return 0;
+        _memory[qFromLittleEndian<quint16>(payload)] = payload[2];
+        break;
+
+    case TYPE_FILL:
+        packetSize = sizeof(struct vchar64d_proto_fill);
+        if (payloadSize < packetSize)
+            return 0;
+        fillMemory(_memory, qFromLittleEndian<quint16>(payload), payload[2], qFromLittleEndian<quint16>(payload + 3));
+        break;
+
+    case TYPE_PING:
+        packetSize = sizeof(struct vchar64d_proto_ping);
+        if (payloadSize < packetSize)
+            return 0;
+        sendPong(payload[0]);
+        break;
+
+    case TYPE_BYEBYE:
+        packetSize = 0;
+        _socket->disconnectFromHost();
+        break;
+
+    default:
+        return -1;
+    }
+
+    _windowBytes += headerSize + packetSize;
+
+    // the ping closes the window: everything, including the ping, must fit in the server buffer
+    if (data[0] == TYPE_PING)
+    {
+        if (_windowBytes > VCHAR64_SERVER_BUFFER_SIZE)
+            _windowOverflows++;
+        _windowBytes = 0;
+    }
+
+    return headerSize + packetSize;
+}
+
+void ServerEmulator::sendPong(quint8 sequence)
+{
+    auto send = [this, sequence]() {
+        if (!_socket)
+            return;
+        const char pong[] = { TYPE_PONG, (char)sequence };
+        _socket->write(pong, sizeof(pong));
+    };
+
+    if (_pongDelay > 0)
+        QTimer::singleShot(_pongDelay, this, send);
+    else
+        send();
+}
+
+void ServerEmulator::sendHello()
+{
+    const char hello[] = { TYPE_HELLO, PROTO_VERSION };
+    _socket->write(hello, sizeof(hello));
+}
@@ -0,0 +1,102 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#pragma once
+
+#include <vector>
+
+#include <QObject>
+
+QT_BEGIN_NAMESPACE
+class QTcpServer;
+class QTcpSocket;
+QT_END_NAMESPACE
+
+/**
+ * @brief The ServerEmulator class a host-side stand-in for vchar64d.
+ * It listens in the same port and understands the same protocol,
+ * but the commands are applied to a 64K memory image.
+ * Used to measure ServerPreview without a C64.
+ */
+class ServerEmulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    // same as vchar64d
+    static const quint16 CHARSET_ADDRESS = 0xa800;
+    static const quint16 SCREEN_ADDRESS = 0xa400;
+    static const quint16 COLOR_RAM_ADDRESS = 0xd800;
+
+    explicit ServerEmulator(QObject* parent = nullptr);
+    virtual ~ServerEmulator();
+
+    /**
+     * @brief listen starts accepting connections
+     * @param port port to listen to. VCHAR64_SERVER_LISTEN_PORT by default
+     * @return false if the port is in use
+     */
+    bool listen(quint16 port = 0);
+    void close();
+
+    /**
+     * @brief setPongDelay delays the pongs, like a C64 that is still
+     * processing the window. 0 by default
+     * @param msecs delay in milliseconds
+     */
+    void setPongDelay(int msecs);
+
+    /** @brief reset clears the memory and the statistics */
+    void reset();
+
+    const quint8* getMemory() const { return _memory.data(); }
+
+    qint64 getBytesReceived() const { return _bytesReceived; }
+    qint64 getPacketsReceived() const { return _packetsReceived; }
+    /** @brief getWindowOverflows times the client sent more than VCHAR64_SERVER_BUFFER_SIZE bytes without a ping */
+    qint64 getWindowOverflows() const { return _windowOverflows; }
+    /** @brief getProtocolErrors unknown commands, or commands truncated at the end of a chunk */
+    qint64 getProtocolErrors() const { return _protocolErrors; }
+
+signals:
+    /** @brief packetsProcessed emitted after the received commands were applied */
+    void packetsProcessed();
+
+protected slots:
+    void onNewConnection();
+    void onReadyRead();
+
+protected:
+    /**
+     * @brief processPacket applies the command at the beginning of the buffer
+     * @return the size of the command, 0 if it is incomplete, or -1 if it is invalid
+     */
+    int processPacket(const quint8* data, int size);
+    void sendPong(quint8 sequence);
+    void sendHello();
+
+    QTcpServer* _server;
+    QTcpSocket* _socket;
+    std::vector<quint8> _memory;
+    int _pongDelay;
+
+    int _windowBytes;
+    qint64 _bytesReceived;
+    qint64 _packetsReceived;
+    qint64 _windowOverflows;
+    qint64 _protocolErrors;
+};
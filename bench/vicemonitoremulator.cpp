@@ -0,0 +1,216 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#include "vicemonitoremulator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtEndian>
+
+#include "vicemonitorprotocol.h"
+
+ViceMonitorEmulator::ViceMonitorEmulator(QObject* parent)
+    : QObject(parent)
+    , _socket(nullptr)
+    , _memory(64 * 1024)
+    , _running(true)
+    , _bytesReceived(0)
+    , _commandsReceived(0)
+    , _stops(0)
+    , _protocolErrors(0)
+{
+    _server = new QTcpServer(this);
+    connect(_server, &QTcpServer::newConnection, this, &ViceMonitorEmulator::onNewConnection);
+}
+
+ViceMonitorEmulator::~ViceMonitorEmulator()
+= default;
+
+bool ViceMonitorEmulator::listen(quint16 port)
+{
+    if (port == 0)
+        port = VICE_MONITOR_LISTEN_PORT;
+    return _server->listen(QHostAddress::LocalHost, port);
+}
+
+void ViceMonitorEmulator::close()
+{
+    if (_socket)
+        _socket->disconnectFromHost();
+    _server->close();
+}
+
+void ViceMonitorEmulator::reset()
+{
+    std::fill(_memory.begin(), _memory.end(), 0);
+    _received.clear();
+    _running = true;
+    _bytesReceived = 0;
+    _commandsReceived = 0;
+    _stops = 0;
+    _protocolErrors = 0;
+}
+
+void ViceMonitorEmulator::onNewConnection()
+{
+    // one client at a time
+    auto socket = _server->nextPendingConnection();
+    if (_socket)
+    {
+        socket->disconnectFromHost();
+        return;
+    }
+
+    _socket = socket;
+    _received.clear();
+    connect(_socket, &QTcpSocket::readyRead, this, &ViceMonitorEmulator::onReadyRead);
+    connect(_socket, &QTcpSocket::disconnected, this, [this]() {
+        // same as VICE: the emulation resumes when the client goes away
+        _running = true;
+        _socket->deleteLater();
+        _socket = nullptr;
+    });
+}
+
+void ViceMonitorEmulator::onReadyRead()
+{
+    const auto data = _socket->readAll();
+    _bytesReceived += data.size();
+    _received.append(data);
+
+    int offset = 0;
+    while (offset < _received.size())
+    {
+        const int size = processCommand((const quint8*)_received.constData() + offset, _received.size() - offset);
+        if (size == 0)
+            break;
+
+        if (size < 0)
+        {
+            // without a valid header the stream can't be parsed anymore
+            _protocolErrors++;
+            offset = _received.size();
+            break;
+        }
+
+        _commandsReceived++;
+        offset += size;
+    }
+    _received.remove(0, offset);
+}
+
+int ViceMonitorEmulator::processCommand(const quint8* data, int size)
+{
+    struct vice_monitor_command_header header;
+    const int headerSize = sizeof(header);
+    if (size < headerSize)
+        return 0;
+
+    memcpy(&header, data, headerSize);
+    if (header.stx != VICE_MONITOR_STX)
+        return -1;
+
+    const quint32 requestId = qFromLittleEndian(header.request_id);
+    const int bodySize = qFromLittleEndian(header.body_length);
+    if (bodySize < 0)
+        return -1;
+    if (size < headerSize + bodySize)
+        return 0;
+
+    const quint8* body = data + headerSize;
+
+    // like VICE: any command stops the emulation
+    if (_running)
+    {
+        _running = false;
+        _stops++;
+        // the PC where it stopped
+        sendResponse(VICE_MONITOR_RESPONSE_STOPPED, VICE_MONITOR_ERROR_OK, VICE_MONITOR_EVENT_REQUEST_ID, QByteArray(2, 0));
+    }
+
+    if (header.api_version != VICE_MONITOR_API_VERSION)
+    {
+        _protocolErrors++;
+        sendResponse(header.command_type, VICE_MONITOR_ERROR_INVALID_API_VERSION, requestId);
+        return headerSize + bodySize;
+    }
+
+    switch (header.command_type)
+    {
+    case VICE_MONITOR_CMD_MEMORY_SET:
+    {
+        struct vice_monitor_memory_set payload;
+        if (bodySize < (int)sizeof(payload))
+        {
+            _protocolErrors++;
+            sendResponse(header.command_type, VICE_MONITOR_ERROR_INVALID_LENGTH, requestId);
+            break;
+        }
+
+        memcpy(&payload, body, sizeof(payload));
+        const int start = qFromLittleEndian(payload.start_address);
+        const int end = qFromLittleEndian(payload.end_address);
+        const int count = end - start + 1;
+        if (count <= 0 || bodySize != (int)sizeof(payload) + count || payload.memspace != VICE_MONITOR_MEMSPACE_MAIN)
+        {
+            _protocolErrors++;
+            sendResponse(header.command_type, VICE_MONITOR_ERROR_INVALID_PARAMETER, requestId);
+            break;
+        }
+
+        memcpy(&_memory[start], body + sizeof(payload), count);
+        sendResponse(header.command_type, VICE_MONITOR_ERROR_OK, requestId);
+        break;
+    }
+
+    case VICE_MONITOR_CMD_PING:
+        sendResponse(header.command_type, VICE_MONITOR_ERROR_OK, requestId);
+        break;
+
+    case VICE_MONITOR_CMD_EXIT:
+        sendResponse(header.command_type, VICE_MONITOR_ERROR_OK, requestId);
+        _running = true;
+        // the PC where it resumed
+        sendResponse(VICE_MONITOR_RESPONSE_RESUMED, VICE_MONITOR_ERROR_OK, VICE_MONITOR_EVENT_REQUEST_ID, QByteArray(2, 0));
+        break;
+
+    default:
+        _protocolErrors++;
+        sendResponse(header.command_type, VICE_MONITOR_ERROR_INVALID_COMMAND, requestId);
+        break;
+    }
+
+    return headerSize + bodySize;
+}
+
+void ViceMonitorEmulator::sendResponse(quint8 responseType, quint8 errorCode, quint32 requestId, const QByteArray& body)
+{
+    struct vice_monitor_response_header header;
+    header.stx = VICE_MONITOR_STX;
+    header.api_version = VICE_MONITOR_API_VERSION;
+    header.body_length = qToLittleEndian((quint32)body.size());
+    header.response_type = responseType;
+    header.error_code = errorCode;
+    header.request_id = qToLittleEndian(requestId);
+
+    QByteArray response((const char*)&header, sizeof(header));
+    response.append(body);
+    _socket->write(response);
+}
@@ -0,0 +1,96 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+
+#pragma once
+
+#include <vector>
+
+#include <QByteArray>
+#include <QObject>
+
+QT_BEGIN_NAMESPACE
+class QTcpServer;
+class QTcpSocket;
+QT_END_NAMESPACE
+
+/**
+ * @brief The ViceMonitorEmulator class a host-side stand-in for VICE's binary monitor.
+ * It listens in the same port and answers the commands VicePreview sends,
+ * applying them to a 64K memory image.
+ * Like VICE, the emulation stops with the first command and resumes with an EXIT.
+ * Used to measure VicePreview without VICE.
+ */
+class ViceMonitorEmulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    // same as VicePreview
+    static const quint16 CHARSET_ADDRESS = 0x3000;
+    static const quint16 SCREEN_ADDRESS = 0x0400;
+    static const quint16 COLOR_RAM_ADDRESS = 0xd800;
+
+    explicit ViceMonitorEmulator(QObject* parent = nullptr);
+    virtual ~ViceMonitorEmulator();
+
+    /**
+     * @brief listen starts accepting connections
+     * @param port port to listen to. VICE_MONITOR_LISTEN_PORT by default
+     * @return false if the port is in use
+     */
+    bool listen(quint16 port = 0);
+    void close();
+
+    /** @brief reset clears the memory and the statistics */
+    void reset();
+
+    const quint8* getMemory() const { return _memory.data(); }
+    /** @brief isRunning false between the first command and the EXIT */
+    bool isRunning() const { return _running; }
+
+    qint64 getBytesReceived() const { return _bytesReceived; }
+    qint64 getCommandsReceived() const { return _commandsReceived; }
+    /** @brief getStops times the emulation was stopped by a command */
+    qint64 getStops() const { return _stops; }
+    /** @brief getProtocolErrors commands answered with an error */
+    qint64 getProtocolErrors() const { return _protocolErrors; }
+
+protected slots:
+    void onNewConnection();
+    void onReadyRead();
+
+protected:
+    /**
+     * @brief processCommand answers the command at the beginning of the buffer
+     * @return the size of the command, 0 if it is incomplete, or -1 if it is invalid
+     */
+    int processCommand(const quint8* data, int size);
+    void sendResponse(quint8 responseType, quint8 errorCode, quint32 requestId, const QByteArray& body = QByteArray());
+
+    QTcpServer* _server;
+    QTcpSocket* _socket;
+    std::vector<quint8> _memory;
+    // unprocessed bytes: a command can be split in two reads
+    QByteArray _received;
+    bool _running;
+
+    qint64 _bytesReceived;
+    qint64 _commandsReceived;
+    qint64 _stops;
+    qint64 _protocolErrors;
+};
@@ -0,0 +1,33 @@
+#
+# vchar64-cli: headless batch converter.
+# Links only the GUI-free core (see core/core.pro)
+#
+
+QT += core concurrent
+
+TARGET = vchar64-cli
+target.path = $${PREFIX}/bin
+INSTALLS += target
+win32 {
+    DESTDIR = ..
+} else {
+    DESTDIR = ../bin
+}
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+VERSION = 0.2.4
+GIT_VERSION = $$system(git describe --abbrev=4 --dirty --always --tags)
+DEFINES += GIT_VERSION=\\\"$$GIT_VERSION\\\" VERSION=\\\"$$VERSION\\\"
+
+CONFIG += c++11
+CONFIG += debug_and_release
+
+include(../core/core.pri)
+
+SOURCES += \
+    main.cpp
+
+!win32 {
+    QMAKE_CXXFLAGS += -Werror
+}
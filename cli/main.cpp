@@ -0,0 +1,270 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include <atomic>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTextStream>
+#include <QtConcurrent>
+
+#include "messagesink.h"
+#include "state.h"
+#include "stateimport.h"
+
+/**
+ * @brief The ConvertJob struct one file to convert, and the result of converting it
+ */
+struct ConvertJob {
+    QString inputFilename;
+    QString outputFilename;
+    bool ok;
+};
+
+static State::ExportProperties _exportProperties;
+
+static bool parseFeatures(const QString& value, quint8* outFeatures)
+{
+    quint8 features = State::EXPORT_FEATURE_NONE;
+    for (const auto& feature: value.split(',', QString::SkipEmptyParts))
+    {
+        if (feature == "charset")
+            features |= State::EXPORT_FEATURE_CHARSET;
+        else if (feature == "map")
+            features |= State::EXPORT_FEATURE_MAP;
+        else if (feature == "colors")
+            features |= State::EXPORT_FEATURE_COLORS;
+        else if (feature == "all")
+            features |= State::EXPORT_FEATURE_ALL;
+        else
+            return false;
+    }
+    *outFeatures = features;
+    return (features != State::EXPORT_FEATURE_NONE);
+}
+
+static bool parseFormat(const QString& value, quint8* outFormat, QString* outSuffix)
+{
+    if (value == "raw")
+    {
+        *outFormat = State::EXPORT_FORMAT_RAW;
+        *outSuffix = "bin";
+    }
+    else if (value == "prg")
+    {
+        *outFormat = State::EXPORT_FORMAT_PRG;
+        *outSuffix = "prg";
+    }
+    else if (value == "asm")
+    {
+        *outFormat = State::EXPORT_FORMAT_ASM;
+        *outSuffix = "s";
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static bool parseAddress(const QString& value, quint16* outAddress)
+{
+    bool ok;
+    // accepts "0x3800", "$3800" and "14336"
+    auto address = value.startsWith('$') ? value.mid(1).toUInt(&ok, 16) : value.toUInt(&ok, 0);
+    if (!ok || address > 0xffff)
+        return false;
+    *outAddress = address;
+    return true;
+}
+
+// runs in a worker thread: each job has its own State
+static void convert(ConvertJob& job)
+{
+    State state(job.inputFilename);
+
+    bool loaded = false;
+    if (QFileInfo(job.inputFilename).suffix().toLower() == "vsf")
+    {
+        QFile file(job.inputFilename);
+        if (file.open(QIODevice::ReadOnly))
+            loaded = (StateImport::loadVICESnapshot(&state, file) > 0);
+    }
+    else
+    {
+        loaded = state.openFile(job.inputFilename);
+    }
+
+    if (!loaded)
+    {
+        MessageSink::getInstance()->showError(QObject::tr("%1: could not be loaded").arg(job.inputFilename));
+        job.ok = false;
+        return;
+    }
+
+    if (_exportProperties.format == State::EXPORT_FORMAT_RAW)
+        job.ok = state.exportRaw(job.outputFilename, _exportProperties);
+    else if (_exportProperties.format == State::EXPORT_FORMAT_PRG)
+        job.ok = state.exportPRG(job.outputFilename, _exportProperties);
+    else
+        job.ok = state.exportAsm(job.outputFilename, _exportProperties);
+
+    if (!job.ok)
+        MessageSink::getInstance()->showError(QObject::tr("%1: could not be exported").arg(job.outputFilename));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    app.setOrganizationDomain(QLatin1String("retro.moe"));
+    app.setApplicationName(QLatin1String("vchar64-cli"));
+
+    // if compiled from .tar.gz, GIT_VERSION will be empty
+    if (GIT_VERSION && strlen(GIT_VERSION) != 0)
+        app.setApplicationVersion(QLatin1String(GIT_VERSION));
+    else
+        app.setApplicationVersion(QLatin1String(VERSION));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QObject::tr("Converts CTM, VChar64, PRG, raw and VICE snapshot files to raw, PRG or assembly"));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addPositionalArgument("files", QObject::tr("Files to convert"), "files...");
+
+    QCommandLineOption formatOption(QStringList() << "f" << "format",
+                                    QObject::tr("Export format: raw, prg or asm. Default: raw"),
+                                    "format", "raw");
+    QCommandLineOption featuresOption(QStringList() << "e" << "export",
+                                      QObject::tr("What to export, comma separated: charset, map, colors or all. Default: charset"),
+                                      "features", "charset");
+    QCommandLineOption outputOption(QStringList() << "o" << "output-dir",
+                                    QObject::tr("Directory where the exported files are written. Default: the directory of each file"),
+                                    "dir");
+    QCommandLineOption charsetAddressOption("charset-address",
+                                            QObject::tr("PRG load address of the charset. Default: 0x3800"),
+                                            "address", "0x3800");
+    QCommandLineOption mapAddressOption("map-address",
+                                        QObject::tr("PRG load address of the map. Default: 0x4000"),
+                                        "address", "0x4000");
+    QCommandLineOption colorsAddressOption("colors-address",
+                                           QObject::tr("PRG load address of the colors. Default: 0x4400"),
+                                           "address", "0x4400");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+                                  QObject::tr("Number of worker threads. Default: one per core"),
+                                  "jobs");
+    parser.addOption(formatOption);
+    parser.addOption(featuresOption);
+    parser.addOption(outputOption);
+    parser.addOption(charsetAddressOption);
+    parser.addOption(mapAddressOption);
+    parser.addOption(colorsAddressOption);
+    parser.addOption(jobsOption);
+
+    parser.process(app);
+
+    QTextStream err(stderr);
+    QTextStream out(stdout);
+
+    const auto files = parser.positionalArguments();
+    if (files.isEmpty())
+        parser.showHelp(1);
+
+    QString suffix;
+    if (!parseFormat(parser.value(formatOption), &_exportProperties.format, &suffix))
+    {
+        err << QObject::tr("Invalid format: %1").arg(parser.value(formatOption)) << "\n";
+        return 1;
+    }
+
+    if (!parseFeatures(parser.value(featuresOption), &_exportProperties.features))
+    {
+        err << QObject::tr("Invalid export features: %1").arg(parser.value(featuresOption)) << "\n";
+        return 1;
+    }
+
+    const QCommandLineOption* addressOptions[] = { &charsetAddressOption, &mapAddressOption, &colorsAddressOption };
+    for (int i=0; i<3; ++i)
+    {
+        if (!parseAddress(parser.value(*addressOptions[i]), &_exportProperties.addresses[i]))
+        {
+            err << QObject::tr("Invalid address: %1").arg(parser.value(*addressOptions[i])) << "\n";
+            return 1;
+        }
+    }
+
+    if (parser.isSet(jobsOption))
+    {
+        bool ok;
+        auto jobs = parser.value(jobsOption).toInt(&ok);
+        if (!ok || jobs <= 0)
+        {
+            err << QObject::tr("Invalid number of jobs: %1").arg(parser.value(jobsOption)) << "\n";
+            return 1;
+        }
+        QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    }
+
+    QString outputDir;
+    if (parser.isSet(outputOption))
+    {
+        outputDir = parser.value(outputOption);
+        if (!QDir().mkpath(outputDir))
+        {
+            err << QObject::tr("Could not create output directory: %1").arg(outputDir) << "\n";
+            return 1;
+        }
+    }
+
+    QVector<ConvertJob> jobs;
+    jobs.reserve(files.size());
+    for (const auto& filename: files)
+    {
+        QFileInfo info(filename);
+        auto dir = outputDir.isEmpty() ? info.path() : outputDir;
+        // State::exportXXX() appends "-charset", "-map" and "-colors" to the name
+        jobs.append({filename, dir + "/" + info.completeBaseName() + "." + suffix, false});
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QtConcurrent::blockingMap(jobs, convert);
+
+    auto elapsed = timer.nsecsElapsed() / 1e9;
+
+    int failed = 0;
+    for (const auto& job: jobs)
+    {
+        if (!job.ok)
+            failed++;
+    }
+
+    out << QObject::tr("%1 files converted, %2 failed in %3s (%4 files/s, %5 threads)")
+           .arg(jobs.size() - failed)
+           .arg(failed)
+           .arg(elapsed, 0, 'f', 3)
+           .arg(elapsed > 0 ? jobs.size() / elapsed : 0, 0, 'f', 1)
+           .arg(QThreadPool::globalInstance()->maxThreadCount())
+        << "\n";
+
+    return (failed == 0) ? 0 : 2;
+}
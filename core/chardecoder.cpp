@@ -0,0 +1,76 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "chardecoder.h"
+
+#include <cstring>
+
+#include "state.h"
+
+// byte -> pens. The 8 pens of a byte are stored contiguously
+// so that a whole row can be copied with a single 64-bit load / store
+struct CharDecoderTables {
+    alignas(8) quint8 hires[256][8];
+    alignas(8) quint8 multicolor[256][8];
+    alignas(4) quint8 multicolorWide[256][4];
+
+    CharDecoderTables()
+    {
+        for (int byte=0; byte<256; ++byte)
+        {
+            for (int j=0; j<8; ++j)
+            {
+                // hires: 1 bit per pixel. bit set == foreground
+                hires[byte][j] = (byte & (0x80 >> j)) ? State::PEN_FOREGROUND : State::PEN_BACKGROUND;
+                // multicolor: 2 bits per pixel, each one twice as wide
+                multicolor[byte][j] = (byte >> (6 - (j / 2) * 2)) & 0x3;
+            }
+            for (int j=0; j<4; ++j)
+                multicolorWide[byte][j] = (byte >> (6 - j * 2)) & 0x3;
+        }
+    }
+};
+
+static const CharDecoderTables& tables()
+{
+    static const CharDecoderTables decoderTables;
+    return decoderTables;
+}
+
+const quint8* CharDecoder::decodeByte(quint8 byte, bool multicolor)
+{
+    return multicolor ? tables().multicolor[byte] : tables().hires[byte];
+}
+
+const quint8* CharDecoder::decodeMulticolorByte(quint8 byte)
+{
+    return tables().multicolorWide[byte];
+}
+
+void CharDecoder::decodeChar(const quint8* chardef, bool multicolor, quint8* outPens)
+{
+    decodeRow(chardef, 8, multicolor, outPens);
+}
+
+void CharDecoder::decodeRow(const quint8* bytes, int count, bool multicolor, quint8* outPens)
+{
+    const auto& lut = multicolor ? tables().multicolor : tables().hires;
+
+    // branch-free: one 8-byte copy per byte. Compilers turn it into
+    // a single 64-bit move, and vectorize it when possible
+    for (int i=0; i<count; ++i)
+        memcpy(&outPens[i * 8], lut[bytes[i]], 8);
+}
@@ -0,0 +1,64 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#pragma once
+
+#include <QtGlobal>
+
+/**
+ * @brief The CharDecoder class converts charset bytes into pens, using precomputed tables.
+ * Pens are the same as State::Pen:
+ * 0=background ($d021), 1=multicolor #1 ($d022), 2=multicolor #2 ($d023), 3=foreground (color RAM).
+ * In hires, a bit set is the foreground pen and a bit clear is the background pen.
+ * In multicolor, the pen is the value of each pair of bits.
+ */
+class CharDecoder
+{
+public:
+    /**
+     * @brief decodeByte returns the 8 pens of a byte, one per pixel.
+     * In multicolor each pen is repeated twice since its pixels are twice as wide.
+     * @param byte charset byte
+     * @param multicolor whether the byte is multicolor
+     * @return 8 pens
+     */
+    static const quint8* decodeByte(quint8 byte, bool multicolor);
+
+    /**
+     * @brief decodeMulticolorByte returns the 4 pens of a multicolor byte, one per wide pixel
+     * @param byte charset byte
+     * @return 4 pens
+     */
+    static const quint8* decodeMulticolorByte(quint8 byte);
+
+    /**
+     * @brief decodeChar decodes a whole char: 8 rows of 8 pens
+     * @param chardef the 8 bytes of the char
+     * @param multicolor whether the char is multicolor
+     * @param outPens 64 pens. Row y, pixel x goes to outPens[y * 8 + x]
+     */
+    static void decodeChar(const quint8* chardef, bool multicolor, quint8* outPens);
+
+    /**
+     * @brief decodeRow decodes consecutive bytes, 8 pens each.
+     * Useful to decode the same scanline of several chars in one pass
+     * @param bytes bytes to decode
+     * @param count number of bytes
+     * @param multicolor whether the bytes are multicolor
+     * @param outPens count * 8 pens
+     */
+    static void decodeRow(const quint8* bytes, int count, bool multicolor, quint8* outPens);
+};
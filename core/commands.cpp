@@ -14,11 +14,42 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ****************************************************************************/
 
+#include <functional>
+
 #include <QDebug>
 #include <QObject>
 
 #include "commands.h"
 
+// runs "modify", and keeps in the deltas only the bytes that it changed.
+// The "before" copy is temporary: undo commands only keep the deltas.
+// The map is not copied: its untouched chunks are shared with the "before" snapshot
+static void encodeModification(State* state, State::CopyRange::BufferType type, UndoDelta* delta, UndoDelta* colorsDelta, MapStorage::Changes* mapChanges, const std::function<void()>& modify)
+{
+    if (type == State::CopyRange::CHARS || type == State::CopyRange::TILES)
+    {
+        quint8 charset[State::CHAR_BUFFER_SIZE];
+        quint8 tileColors[State::TILE_COLORS_BUFFER_SIZE];
+        memcpy(charset, state->getCharsetBuffer(), sizeof(charset));
+        memcpy(tileColors, state->getTileColors(), sizeof(tileColors));
+
+        modify();
+
+        delta->encode(charset, state->getCharsetBuffer(), sizeof(charset));
+        if (colorsDelta)
+            colorsDelta->encode(tileColors, state->getTileColors(), sizeof(tileColors));
+    }
+    else /* MAP */
+    {
+        const MapStorage before = state->getMap();
+
+        modify();
+
+        Q_ASSERT(before.getSize() == state->getMapSize() && "Map size changed");
+        *mapChanges = MapStorage::diff(before, state->getMap());
+    }
+}
+
 // Paint Tile
 PaintTileCommand::PaintTileCommand(State *state, int tileIndex, const QPoint& position, int pen, bool mergeable, QUndoCommand *parent)
     : QUndoCommand(parent)
@@ -93,26 +124,14 @@ PasteCommand::PasteCommand(State* state, int charIndex, const State::CopyRange&
     , _state(state)
     , _charIndex(charIndex)
     , _copyBuffer(nullptr)
-    , _origBuffer(nullptr)
     , _copyRange(copyRange)
 {
-
-    int sizeToCopy = -1;
     if (copyRange.type == State::CopyRange::CHARS || copyRange.type == State::CopyRange::TILES)
     {
-        sizeToCopy = State::CHAR_BUFFER_SIZE + State::TILE_COLORS_BUFFER_SIZE;
-        Q_ASSERT(copyRange.bufferSize == sizeToCopy && "Invalid bufferSize");
-
-        _copyBuffer = (quint8*)malloc(sizeToCopy);
-        _origBuffer = (quint8*)malloc(sizeToCopy);
-    }
-    else /* MAP */
-    {
-        sizeToCopy = state->getMapSize().width() * state->getMapSize().height();
-        _origBuffer = (quint8*)malloc(sizeToCopy);
-        _copyBuffer = (quint8*)malloc(copyRange.bufferSize);
+        Q_ASSERT(copyRange.bufferSize == State::CHAR_BUFFER_SIZE + State::TILE_COLORS_BUFFER_SIZE && "Invalid bufferSize");
     }
 
+    _copyBuffer = (quint8*)malloc(copyRange.bufferSize);
     memcpy(_copyBuffer, buffer, copyRange.bufferSize);
 
     static const QString types[] = {
@@ -128,34 +147,43 @@ PasteCommand::PasteCommand(State* state, int charIndex, const State::CopyRange&
 PasteCommand::~PasteCommand()
 {
     free(_copyBuffer);
-    free(_origBuffer);
 }
 
 void PasteCommand::undo()
 {
-    State::CopyRange reversedCopyRange = _copyRange;
-
-    // FIXME: doesn't work when tiles are copied/paste to/from different tile properties
-    if (_copyRange.type == State::CopyRange::TILES && reversedCopyRange.tileProperties.interleaved == 1)
-        reversedCopyRange.offset = _charIndex / (reversedCopyRange.tileProperties.size.width() * reversedCopyRange.tileProperties.size.height());
-    else
-        reversedCopyRange.offset = _charIndex;
-
-    _state->_paste(_charIndex, reversedCopyRange, _origBuffer);
+    if (_copyRange.type == State::CopyRange::CHARS || _copyRange.type == State::CopyRange::TILES)
+        _state->_applyCharsetDelta(_delta, _colorsDelta);
+    else /* MAP */
+        _state->_applyMapChanges(_mapChanges, true);
 }
 
 void PasteCommand::redo()
 {
-    if (_copyRange.type == State::CopyRange::CHARS || _copyRange.type == State::CopyRange::TILES)
+    if (_copyBuffer)
     {
-        memcpy(_origBuffer, _state->getCharsetBuffer(), State::CHAR_BUFFER_SIZE);
-        memcpy(_origBuffer + State::CHAR_BUFFER_SIZE, _state->getTileColors(), State::TILE_COLORS_BUFFER_SIZE);
+        encodeModification(_state, _copyRange.type, &_delta, &_colorsDelta, &_mapChanges, [&](){
+            _state->_paste(_charIndex, _copyRange, _copyBuffer);
+        });
+
+        // from now on, redo/undo just apply the deltas
+        free(_copyBuffer);
+        _copyBuffer = nullptr;
     }
-    else /* MAP */
+    else if (_copyRange.type == State::CopyRange::MAP)
+    {
+        _state->_applyMapChanges(_mapChanges, false);
+    }
+    else
     {
-        memcpy(_origBuffer, _state->getMapBuffer(), _state->getMapSize().width() * _state->getMapSize().height());
+        // the delta is a XOR: applying it again redoes the paste
+        undo();
     }
-    _state->_paste(_charIndex, _copyRange, _copyBuffer);
+}
+
+int PasteCommand::getByteFootprint() const
+{
+    return sizeof(*this) + _delta.getByteFootprint() + _colorsDelta.getByteFootprint()
+            + _mapChanges.getByteFootprint() + (_copyBuffer ? _copyRange.bufferSize : 0);
 }
 
 // CutCommand
@@ -163,28 +191,9 @@ void PasteCommand::redo()
 CutCommand::CutCommand(State *state, const State::CopyRange& copyRange, QUndoCommand *parent)
     : QUndoCommand(parent)
     , _state(state)
-    , _zeroBuffer(nullptr)
-    , _origBuffer(nullptr)
+    , _done(false)
     , _copyRange(copyRange)
 {
-    int sizeToCopy = -1;
-    if (copyRange.type == State::CopyRange::CHARS || copyRange.type == State::CopyRange::TILES)
-    {
-        sizeToCopy = State::CHAR_BUFFER_SIZE + State::TILE_COLORS_BUFFER_SIZE;
-        _zeroBuffer = (quint8*)malloc(sizeToCopy);
-        _origBuffer = (quint8*)malloc(sizeToCopy);
-
-        memset(_zeroBuffer, 0, sizeToCopy);
-    }
-    else /* MAP */
-    {
-        sizeToCopy = state->getMapSize().width() * state->getMapSize().height();
-        _zeroBuffer = (quint8*)malloc(sizeToCopy);
-        _origBuffer = (quint8*)malloc(sizeToCopy);
-
-        memset(_zeroBuffer, 0 /*state->getTileIndex()*/, sizeToCopy);
-    }
-
     // _charIndex: offset to be used for cut
     if (_copyRange.type == State::CopyRange::TILES && _copyRange.tileProperties.interleaved == 1)
         _charIndex = _copyRange.offset * (_copyRange.tileProperties.size.width() * _copyRange.tileProperties.size.height());
@@ -204,36 +213,53 @@ CutCommand::CutCommand(State *state, const State::CopyRange& copyRange, QUndoCom
 
 CutCommand::~CutCommand()
 {
-    free(_zeroBuffer);
-    free(_origBuffer);
 }
 
 void CutCommand::undo()
 {
-    State::CopyRange reversedCopyRange = _copyRange;
-
-    // FIXME: doesn't work when tiles are copied/paste to/from different tile properties
-    if (_copyRange.type == State::CopyRange::TILES && reversedCopyRange.tileProperties.interleaved == 1)
-        reversedCopyRange.offset = _charIndex / (reversedCopyRange.tileProperties.size.width() * reversedCopyRange.tileProperties.size.height());
-    else
-        reversedCopyRange.offset = _charIndex;
-
-    _state->_paste(_charIndex, reversedCopyRange, _origBuffer);
+    if (_copyRange.type == State::CopyRange::CHARS || _copyRange.type == State::CopyRange::TILES)
+        _state->_applyCharsetDelta(_delta, _colorsDelta);
+    else /* MAP */
+        _state->_applyMapChanges(_mapChanges, true);
 }
 
 void CutCommand::redo()
 {
-    if (_copyRange.type == State::CopyRange::CHARS || _copyRange.type == State::CopyRange::TILES)
+    if (!_done)
     {
-        memcpy(_origBuffer, _state->getCharsetBuffer(), State::CHAR_BUFFER_SIZE);
-        memcpy(_origBuffer + State::CHAR_BUFFER_SIZE, _state->getTileColors(), State::TILE_COLORS_BUFFER_SIZE);
+        int sizeToCopy = -1;
+        if (_copyRange.type == State::CopyRange::CHARS || _copyRange.type == State::CopyRange::TILES)
+            sizeToCopy = State::CHAR_BUFFER_SIZE + State::TILE_COLORS_BUFFER_SIZE;
+        else /* MAP */
+            sizeToCopy = _state->getMap().getCellCount() * sizeof(quint16);
+
+        quint8* zeroBuffer = (quint8*)malloc(sizeToCopy);
+        memset(zeroBuffer, 0 /*state->getTileIndex()*/, sizeToCopy);
+
+        encodeModification(_state, _copyRange.type, &_delta, &_colorsDelta, &_mapChanges, [&](){
+            _state->_paste(_charIndex, _copyRange, zeroBuffer);
+        });
+
+        free(zeroBuffer);
+        _done = true;
     }
-    else /* MAP */
+    else if (_copyRange.type == State::CopyRange::MAP)
+    {
+        _state->_applyMapChanges(_mapChanges, false);
+    }
+    else
     {
-        memcpy(_origBuffer, _state->getMapBuffer(), _state->getMapSize().width() * _state->getMapSize().height());
+        // the delta is a XOR: applying it again redoes the cut
+        undo();
     }
-    _state->_paste(_charIndex, _copyRange, _zeroBuffer);
 }
+
+int CutCommand::getByteFootprint() const
+{
+    return sizeof(*this) + _delta.getByteFootprint() + _colorsDelta.getByteFootprint()
+            + _mapChanges.getByteFootprint();
+}
+
 // FlipTileHCommand
 
 FlipTileHCommand::FlipTileHCommand(State *state, int tileIndex, QUndoCommand *parent)
@@ -522,27 +548,22 @@ SetMapSizeCommand::SetMapSizeCommand(State *state, const QSize& mapSize, QUndoCo
     : QUndoCommand(parent)
     , _state(state)
     , _new(mapSize)
+    , _oldMap(state->getMap())
 {
-    _old = _state->getMapSize();
-    _oldMap = (quint8*) malloc(_old.width() * _old.height());
-    Q_ASSERT(_oldMap && "No more memory");
-
-    memcpy(_oldMap, _state->_map, _old.width() * _old.height());
-
     setText(QObject::tr("Map Size %1x%2")
             .arg(mapSize.width())
             .arg(mapSize.height())
             );
 }
+
 SetMapSizeCommand::~SetMapSizeCommand()
 {
-    free(_oldMap);
 }
 
 void SetMapSizeCommand::undo()
 {
-    _state->_setMapSize(_old);
-    _state->_setMap(_oldMap, _old);
+    // chunks kept by the new map are still shared with the old one
+    _state->_setMap(_oldMap);
 }
 
 void SetMapSizeCommand::redo()
@@ -550,36 +571,53 @@ void SetMapSizeCommand::redo()
     _state->_setMapSize(_new);
 }
 
+int SetMapSizeCommand::getByteFootprint() const
+{
+    return sizeof(*this) + _oldMap.getByteFootprint();
+}
+
 // FillMapCommand
 FillMapCommand::FillMapCommand(State *state, const QPoint& coord, int tileIdx, QUndoCommand *parent)
     : QUndoCommand(parent)
     , _state(state)
     , _coord(coord)
     , _tileIdx(tileIdx)
-    , _oldMap(nullptr)
+    , _targetTile(tileIdx)
+    , _filled(false)
 {
     setText(QObject::tr("Map Fill"));
 }
 
 FillMapCommand::~FillMapCommand()
 {
-    free(_oldMap);
 }
 
 void FillMapCommand::undo()
 {
-    _state->_setMap(_oldMap, _mapSize);
+    _state->_mapFillRuns(_runs, _targetTile);
+}
+
+int FillMapCommand::getByteFootprint() const
+{
+    return sizeof(*this) + _runs.capacity() * sizeof(State::MapRun);
 }
 
 void FillMapCommand::redo()
 {
-    if (!_oldMap)
+    if (!_filled)
+    {
+        const auto mapSize = _state->getMapSize();
+        if (_coord.x() < mapSize.width() && _coord.y() < mapSize.height())
+            _targetTile = _state->getMap().getCell(_coord.x(), _coord.y());
+
+        _state->_mapFill(_coord, _tileIdx, &_runs);
+        _runs.squeeze();
+        _filled = true;
+    }
+    else
     {
-        _mapSize = _state->getMapSize();
-        _oldMap = (quint8*)malloc(_mapSize.width() * _mapSize.height());
-        memcpy(_oldMap, _state->getMapBuffer(), _mapSize.width() * _mapSize.height());
+        _state->_mapFillRuns(_runs, _tileIdx);
     }
-    _state->_mapFill(_coord, _tileIdx);
 }
 
 // ClearMapCommand
@@ -587,30 +625,38 @@ ClearMapCommand::ClearMapCommand(State *state, int tileIdx, QUndoCommand *parent
     : QUndoCommand(parent)
     , _state(state)
     , _tileIdx(tileIdx)
-    , _oldMap(nullptr)
+    , _done(false)
 {
     setText(QObject::tr("Map Clear"));
 }
 
 ClearMapCommand::~ClearMapCommand()
 {
-    free(_oldMap);
 }
 
 void ClearMapCommand::undo()
 {
-    _state->_setMap(_oldMap, _mapSize);
+    _state->_applyMapChanges(_changes, true);
 }
 
 void ClearMapCommand::redo()
 {
-    if (!_oldMap)
+    if (!_done)
     {
-        _mapSize = _state->getMapSize();
-        _oldMap = (quint8*)malloc(_mapSize.width() * _mapSize.height());
-        memcpy(_oldMap, _state->getMapBuffer(), _mapSize.width() * _mapSize.height());
+        encodeModification(_state, State::CopyRange::MAP, nullptr, nullptr, &_changes, [&](){
+            _state->_mapClear(_tileIdx);
+        });
+        _done = true;
+    }
+    else
+    {
+        _state->_applyMapChanges(_changes, false);
     }
-    _state->_mapClear(_tileIdx);
+}
+
+int ClearMapCommand::getByteFootprint() const
+{
+    return sizeof(*this) + _changes.getByteFootprint();
 }
 
 // PaintMapCommand
@@ -619,7 +665,6 @@ PaintMapCommand::PaintMapCommand(State *state, const QPoint& position, int tileI
     , _state(state)
     , _tileIdx(tileIdx)
     , _mergeable(mergeable)
-    , _oldMap(nullptr)
 {
     _points.append(position);
 
@@ -628,28 +673,34 @@ PaintMapCommand::PaintMapCommand(State *state, const QPoint& position, int tileI
 
 PaintMapCommand::~PaintMapCommand()
 {
-    free(_oldMap);
 }
 
 void PaintMapCommand::undo()
 {
-    _state->_setMap(_oldMap, _mapSize);
+    // in reverse order, in case the same cell was painted more than once
+    for (int i=_points.size()-1; i>=0; --i)
+        _state->_mapPaint(_points.at(i), _oldTiles.at(i));
 }
 
 void PaintMapCommand::redo()
 {
-    if (!_oldMap)
-    {
-        _mapSize = _state->getMapSize();
-        _oldMap = (quint8*)malloc(_mapSize.width() * _mapSize.height());
-    }
-    memcpy(_oldMap, _state->getMapBuffer(), _mapSize.width() * _mapSize.height());
+    const auto mapSize = _state->getMapSize();
+    const auto& map = _state->getMap();
 
+    _oldTiles.clear();
     for (auto _point : _points) {
+        // out-of-bounds points are ignored by _mapPaint()
+        bool valid = _point.x() >= 0 && _point.x() < mapSize.width() && _point.y() >= 0 && _point.y() < mapSize.height();
+        _oldTiles.append(valid ? map.getCell(_point.x(), _point.y()) : 0);
         _state->_mapPaint(_point, _tileIdx);
     }
 }
 
+int PaintMapCommand::getByteFootprint() const
+{
+    return sizeof(*this) + _points.size() * sizeof(QPoint) + _oldTiles.capacity() * sizeof(quint16);
+}
+
 bool PaintMapCommand::mergeWith(const QUndoCommand* other)
 {
     if (other->id() != id())
@@ -661,6 +712,124 @@ bool PaintMapCommand::mergeWith(const QUndoCommand* other)
         return false;
 
     _points.append(p->_points);
+    _oldTiles.append(p->_oldTiles);
 
     return true;
 }
+
+// SetCharsetBankCountCommand
+
+SetCharsetBankCountCommand::SetCharsetBankCountCommand(State *state, int count, QUndoCommand *parent)
+    : QUndoCommand(parent)
+    , _state(state)
+    , _oldCount(state->getCharsetBankCount())
+    , _new(count)
+{
+    setText(QObject::tr("Charset Banks %1").arg(count));
+
+    for (int i=_new; i<_oldCount; ++i)
+        _removedBanks.push_back(state->_charsetBanks[i]);
+}
+
+void SetCharsetBankCountCommand::undo()
+{
+    _state->_setCharsetBankCount(_oldCount, _removedBanks.empty() ? nullptr : &_removedBanks);
+}
+
+void SetCharsetBankCountCommand::redo()
+{
+    _state->_setCharsetBankCount(_new);
+}
+
+int SetCharsetBankCountCommand::getByteFootprint() const
+{
+    return sizeof(*this) + _removedBanks.size() * sizeof(State::CharsetBank);
+}
+
+// SharedUndoCommand
+
+SharedUndoCommand::SharedUndoCommand(State *state, int bank, const QSharedPointer<QUndoCommand>& command, bool applied, QUndoCommand *parent)
+    : QUndoCommand(parent)
+    , _state(state)
+    , _bank(bank)
+    , _command(command)
+    , _skipRedo(applied)
+    , _mergeable(!applied)
+    , _footprint(0)
+{
+    setText(_command->text());
+    updateFootprint();
+}
+
+SharedUndoCommand::~SharedUndoCommand()
+{
+    _state->_undoStackFootprint -= _footprint;
+}
+
+void SharedUndoCommand::updateFootprint()
+{
+    const int footprint = getByteFootprint();
+    _state->_undoStackFootprint += footprint - _footprint;
+    _footprint = footprint;
+}
+
+void SharedUndoCommand::undo()
+{
+    if (_bank < 0)
+        _command->undo();
+    else
+        _state->runInCharsetBank(_bank, [this]() { _command->undo(); });
+    updateFootprint();
+}
+
+void SharedUndoCommand::redo()
+{
+    if (_skipRedo)
+    {
+        _skipRedo = false;
+        return;
+    }
+
+    if (_bank < 0)
+        _command->redo();
+    else
+        _state->runInCharsetBank(_bank, [this]() { _command->redo(); });
+    updateFootprint();
+}
+
+int SharedUndoCommand::id() const
+{
+    return _mergeable ? _command->id() : -1;
+}
+
+bool SharedUndoCommand::mergeWith(const QUndoCommand* other)
+{
+    auto shared = dynamic_cast<const SharedUndoCommand*>(other);
+    if (!shared || shared->_bank != _bank || !_command->mergeWith(shared->_command.data()))
+        return false;
+
+    setText(_command->text());
+    updateFootprint();
+    return true;
+}
+
+int SharedUndoCommand::getByteFootprint() const
+{
+    auto footprint = dynamic_cast<const UndoFootprint*>(_command.data());
+    return sizeof(*this) + (footprint ? footprint->getByteFootprint() : 0);
+}
+
+QSharedPointer<QUndoCommand> SharedUndoCommand::getCommand() const
+{
+    return _command;
+}
+
+int SharedUndoCommand::getCharsetBank() const
+{
+    return _bank;
+}
+
+void SharedUndoCommand::setMergeable(bool mergeable)
+{
+    _mergeable = mergeable;
+}
@@ -19,8 +19,13 @@ limitations under the License.
 #include <QUndoCommand>
 #include <QPoint>
 #include <QList>
+#include <QVector>
+#include <QSharedPointer>
+
+#include <vector>
 
 #include "state.h"
+#include "undodelta.h"
 
 // id
 enum UndoCommands {
@@ -60,38 +65,45 @@ private:
 //    quint8 _buffer[State::MAX_TILE_HEIGHT * State::MAX_TILE_WIDTH * 8];
 //};
 
-class PasteCommand : public QUndoCommand
+class PasteCommand : public QUndoCommand, public UndoFootprint
 {
 public:
     PasteCommand(State *state, int charIndex, const State::CopyRange &copyRange, const quint8* buffer, QUndoCommand *parent = nullptr);
     virtual ~PasteCommand();
     void undo() Q_DECL_OVERRIDE;
     void redo() Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
 
 private:
     State* _state;
     int _charIndex;
 
+    // only needed until the first redo. Afterwards the deltas are used
     quint8* _copyBuffer;
-    quint8* _origBuffer;
     State::CopyRange _copyRange;
+    UndoDelta _delta;           // charset
+    UndoDelta _colorsDelta;     // tile colors
+    MapStorage::Changes _mapChanges;
 };
 
-class CutCommand : public QUndoCommand
+class CutCommand : public QUndoCommand, public UndoFootprint
 {
 public:
     CutCommand(State *state, const State::CopyRange &copyRange, QUndoCommand *parent = nullptr);
     virtual ~CutCommand();
     void undo() Q_DECL_OVERRIDE;
     void redo() Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
 
 private:
     State* _state;
     int _charIndex;
 
-    quint8* _zeroBuffer;
-    quint8* _origBuffer;
+    bool _done;
     State::CopyRange _copyRange;
+    UndoDelta _delta;           // charset
+    UndoDelta _colorsDelta;     // tile colors
+    MapStorage::Changes _mapChanges;
 };
 
 class FlipTileHCommand : public QUndoCommand
@@ -276,7 +288,7 @@ private:
     State::ForegroundColorMode _oldMode;
 };
 
-class SetMapSizeCommand : public QUndoCommand
+class SetMapSizeCommand : public QUndoCommand, public UndoFootprint
 {
 public:
     SetMapSizeCommand(State *state, const QSize& mapSize, QUndoCommand *parent = nullptr);
@@ -284,33 +296,37 @@ public:
 
     void undo() Q_DECL_OVERRIDE;
     void redo() Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
 
 private:
     State* _state;
     QSize _new;
-    QSize _old;
-    quint8* _oldMap;
+    // the map before resizing. Shares its chunks with the current map
+    MapStorage _oldMap;
 };
 
 // FillMapCommand
-class FillMapCommand : public QUndoCommand
+class FillMapCommand : public QUndoCommand, public UndoFootprint
 {
 public:
     FillMapCommand(State *state, const QPoint& coord, int tileIdx, QUndoCommand *parent = nullptr);
     virtual ~FillMapCommand();
     void undo() Q_DECL_OVERRIDE;
     void redo() Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
 
 private:
     State* _state;
     QPoint _coord;
     int _tileIdx;
-    quint8* _oldMap;
-    QSize _mapSize;
+    int _targetTile;
+    // only the filled cells are recorded. All of them had _targetTile
+    QVector<State::MapRun> _runs;
+    bool _filled;
 };
 
 // PaintMapCommand
-class PaintMapCommand : public QUndoCommand
+class PaintMapCommand : public QUndoCommand, public UndoFootprint
 {
 public:
     PaintMapCommand(State *state, const QPoint& position, int tileIdx, bool mergeable, QUndoCommand *parent = nullptr);
@@ -319,29 +335,83 @@ public:
     void redo() Q_DECL_OVERRIDE;
     int id() const Q_DECL_OVERRIDE { return Cmd_PaintMap; }
     bool mergeWith(const QUndoCommand* other) Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
 
 private:
     State* _state;
     int _tileIdx;
     bool _mergeable;
     QList<QPoint> _points;
-    quint8* _oldMap;
-    QSize _mapSize;
+    // tile that was in each one of _points before painting it
+    QVector<quint16> _oldTiles;
 };
 
 // ClearMapCommand
-class ClearMapCommand : public QUndoCommand
+class ClearMapCommand : public QUndoCommand, public UndoFootprint
 {
 public:
     ClearMapCommand(State *state, int tileIdx, QUndoCommand *parent = nullptr);
     virtual ~ClearMapCommand();
     void undo() Q_DECL_OVERRIDE;
     void redo() Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
 
 private:
     State* _state;
     int _tileIdx;
-    quint8* _oldMap;
-    QSize _mapSize;
+    bool _done;
+    MapStorage::Changes _changes;
+
+};
+
+// SetCharsetBankCountCommand
+class SetCharsetBankCountCommand : public QUndoCommand, public UndoFootprint
+{
+public:
+    SetCharsetBankCountCommand(State *state, int count, QUndoCommand *parent = nullptr);
+    void undo() Q_DECL_OVERRIDE;
+    void redo() Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
+
+private:
+    State* _state;
+    int _oldCount;
+    int _new;
+    // banks removed by redo(). Empty when banks are added
+    std::vector<State::CharsetBank> _removedBanks;
+};
+
+// SharedUndoCommand
+// State pushes this wrapper instead of the command itself. The command is shared so that,
+// when the undo memory limit is reached, the newest commands can be moved to a new history.
+// The selected charset bank is view state: the commands that edit a bank are undone
+// and redone in the bank they were recorded in, without selecting it
+class SharedUndoCommand : public QUndoCommand, public UndoFootprint
+{
+public:
+    // bank: the bank the command edits, or -1. applied: the command was already executed,
+    // so the first redo() is skipped
+    SharedUndoCommand(State *state, int bank, const QSharedPointer<QUndoCommand>& command, bool applied=false, QUndoCommand *parent = nullptr);
+    virtual ~SharedUndoCommand();
+    void undo() Q_DECL_OVERRIDE;
+    void redo() Q_DECL_OVERRIDE;
+    int id() const Q_DECL_OVERRIDE;
+    bool mergeWith(const QUndoCommand* other) Q_DECL_OVERRIDE;
+    int getByteFootprint() const Q_DECL_OVERRIDE;
+
+    QSharedPointer<QUndoCommand> getCommand() const;
+    int getCharsetBank() const;
+    void setMergeable(bool mergeable);
+
+private:
+    // the footprint of a command changes in redo() and mergeWith()
+    void updateFootprint();
 
+    State* _state;
+    int _bank;
+    QSharedPointer<QUndoCommand> _command;
+    bool _skipRedo;
+    bool _mergeable;
+    // what this command added to the State's undo stack footprint
+    int _footprint;
 };
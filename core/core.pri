@@ -0,0 +1,27 @@
+#
+# Links libvchar64core (see core.pro).
+# Include it from any project that needs the model or the file readers / writers.
+#
+
+QT += core gui widgets
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+win32:CONFIG(release, debug|release) {
+    CORE_LIB_DIR = $$OUT_PWD/../core/release
+} else:win32:CONFIG(debug, debug|release) {
+    CORE_LIB_DIR = $$OUT_PWD/../core/debug
+} else {
+    CORE_LIB_DIR = $$OUT_PWD/../core
+}
+
+LIBS += -L$$CORE_LIB_DIR -lvchar64core
+
+win32-g++ {
+    PRE_TARGETDEPS += $$CORE_LIB_DIR/libvchar64core.a
+} else:win32 {
+    PRE_TARGETDEPS += $$CORE_LIB_DIR/vchar64core.lib
+} else {
+    PRE_TARGETDEPS += $$CORE_LIB_DIR/libvchar64core.a
+}
@@ -0,0 +1,44 @@
+#
+# libvchar64core: the charset/tileset/map model, the undo commands,
+# and the file readers / writers.
+# Shared by vchar64 and vchar64-cli. It must not depend on any widget:
+# messages and errors are reported through MessageSink.
+#
+# QUndoStack / QUndoCommand are part of QtWidgets in Qt5, so the
+# widgets module is still needed even if no widget is created.
+#
+
+QT += core gui widgets
+
+TARGET = vchar64core
+TEMPLATE = lib
+CONFIG += staticlib
+
+CONFIG += c++11
+CONFIG += debug_and_release
+
+SOURCES += \
+    chardecoder.cpp \
+    commands.cpp \
+    mapstorage.cpp \
+    messagesink.cpp \
+    palette.cpp \
+    state.cpp \
+    stateexport.cpp \
+    stateimport.cpp \
+    undodelta.cpp
+
+HEADERS += \
+    chardecoder.h \
+    commands.h \
+    mapstorage.h \
+    messagesink.h \
+    palette.h \
+    state.h \
+    stateexport.h \
+    stateimport.h \
+    undodelta.h
+
+!win32 {
+    QMAKE_CXXFLAGS += -Werror
+}
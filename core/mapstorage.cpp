@@ -0,0 +1,310 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "mapstorage.h"
+
+#include <algorithm>
+#include <cstring>
+
+static int chunksFor(int cells)
+{
+    return (cells + MapStorage::CHUNK_MASK) >> MapStorage::CHUNK_SHIFT;
+}
+
+MapStorage::MapStorage(const QSize& size, quint16 value)
+    : _size(size)
+    , _chunkColumns(chunksFor(size.width()))
+    , _chunkRows(chunksFor(size.height()))
+    , _slots(_chunkColumns * _chunkRows)
+{
+    Q_ASSERT(size.width() > 0 && size.height() > 0 && "Invalid size");
+
+    for (auto& slot : _slots)
+        slot.value = value;
+}
+
+const QSize& MapStorage::getSize() const
+{
+    return _size;
+}
+
+int MapStorage::getCellCount() const
+{
+    return _size.width() * _size.height();
+}
+
+void MapStorage::resize(const QSize& size, quint16 value)
+{
+    Q_ASSERT(size.width() > 0 && size.height() > 0 && "Invalid size");
+
+    if (size == _size)
+        return;
+
+    const int columns = chunksFor(size.width());
+    const int rows = chunksFor(size.height());
+
+    // chunks are moved, not copied. The ones outside the new size are released
+    std::vector<ChunkSlot> slots(columns * rows);
+    for (int cy=0; cy<rows; ++cy)
+    {
+        for (int cx=0; cx<columns; ++cx)
+        {
+            auto& slot = slots[cy * columns + cx];
+            if (cx < _chunkColumns && cy < _chunkRows)
+                slot = std::move(_slots[cy * _chunkColumns + cx]);
+            else
+                slot.value = value;
+        }
+    }
+
+    const QSize oldSize = _size;
+    _slots.swap(slots);
+    _size = size;
+    _chunkColumns = columns;
+    _chunkRows = rows;
+
+    // the kept chunks might have cells that were outside the old size.
+    // New chunks already have value, so they are not allocated
+    if (size.width() > oldSize.width())
+        fillRect(oldSize.width(), 0, size.width() - oldSize.width(), qMin(oldSize.height(), size.height()), value);
+    if (size.height() > oldSize.height())
+        fillRect(0, oldSize.height(), size.width(), size.height() - oldSize.height(), value);
+}
+
+MapStorage::Chunk* MapStorage::getChunkForWrite(ChunkSlot& slot)
+{
+    if (!slot.chunk)
+    {
+        slot.chunk = std::make_shared<Chunk>();
+        std::fill(std::begin(slot.chunk->cells), std::end(slot.chunk->cells), slot.value);
+    }
+    else if (slot.chunk.use_count() > 1)
+    {
+        // shared with a copy of the map, like the ones kept by the undo commands
+        slot.chunk = std::make_shared<Chunk>(*slot.chunk);
+    }
+    return slot.chunk.get();
+}
+
+void MapStorage::setCell(int x, int y, quint16 value)
+{
+    Q_ASSERT(x >= 0 && x < _size.width() && y >= 0 && y < _size.height() && "Invalid cell");
+
+    auto& slot = getSlot(x, y);
+    if (!slot.chunk && slot.value == value)
+        return;
+    getChunkForWrite(slot)->cells[((y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK)] = value;
+}
+
+void MapStorage::fillRow(int x, int y, int length, quint16 value)
+{
+    Q_ASSERT(x >= 0 && x + length <= _size.width() && y >= 0 && y < _size.height() && "Invalid row");
+
+    // one segment per chunk
+    while (length > 0)
+    {
+        const int segment = qMin(length, CHUNK_SIZE - (x & CHUNK_MASK));
+        auto& slot = getSlot(x, y);
+        if (slot.chunk || slot.value != value)
+        {
+            quint16* cells = &getChunkForWrite(slot)->cells[((y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK)];
+            std::fill(cells, cells + segment, value);
+        }
+        x += segment;
+        length -= segment;
+    }
+}
+
+void MapStorage::fillRect(int x, int y, int width, int height, quint16 value)
+{
+    for (int row=y; row<y+height; ++row)
+        fillRow(x, row, width, value);
+}
+
+void MapStorage::fill(quint16 value)
+{
+    for (auto& slot : _slots)
+    {
+        slot.chunk.reset();
+        slot.value = value;
+    }
+}
+
+void MapStorage::readRow(int x, int y, int length, quint16* dst) const
+{
+    Q_ASSERT(x >= 0 && x + length <= _size.width() && y >= 0 && y < _size.height() && "Invalid row");
+
+    while (length > 0)
+    {
+        const int segment = qMin(length, CHUNK_SIZE - (x & CHUNK_MASK));
+        const auto& slot = getSlot(x, y);
+        if (slot.chunk)
+            memcpy(dst, &slot.chunk->cells[((y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK)], segment * sizeof(quint16));
+        else
+            std::fill(dst, dst + segment, slot.value);
+        dst += segment;
+        x += segment;
+        length -= segment;
+    }
+}
+
+void MapStorage::writeRow(int x, int y, int length, const quint16* src)
+{
+    Q_ASSERT(x >= 0 && x + length <= _size.width() && y >= 0 && y < _size.height() && "Invalid row");
+
+    while (length > 0)
+    {
+        const int segment = qMin(length, CHUNK_SIZE - (x & CHUNK_MASK));
+        auto& slot = getSlot(x, y);
+
+        // don't allocate the chunk if the segment has its value
+        bool modified = (slot.chunk != nullptr);
+        for (int i=0; i<segment && !modified; ++i)
+            modified = (src[i] != slot.value);
+
+        if (modified)
+            memcpy(&getChunkForWrite(slot)->cells[((y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK)], src, segment * sizeof(quint16));
+        src += segment;
+        x += segment;
+        length -= segment;
+    }
+}
+
+void MapStorage::copyTo(quint16* dst) const
+{
+    const int width = _size.width();
+    for (int y=0; y<_size.height(); ++y)
+        readRow(0, y, width, &dst[y * width]);
+}
+
+void MapStorage::copyFrom(const quint16* src)
+{
+    const int width = _size.width();
+    for (int y=0; y<_size.height(); ++y)
+        writeRow(0, y, width, &src[y * width]);
+}
+
+void MapStorage::copyTo(quint8* dst) const
+{
+    const int width = _size.width();
+    std::vector<quint16> row(width);
+    for (int y=0; y<_size.height(); ++y)
+    {
+        readRow(0, y, width, row.data());
+        for (int x=0; x<width; ++x)
+            *dst++ = row[x] & 0xff;
+    }
+}
+
+void MapStorage::copyFrom(const quint8* src)
+{
+    const int width = _size.width();
+    std::vector<quint16> row(width);
+    for (int y=0; y<_size.height(); ++y)
+    {
+        for (int x=0; x<width; ++x)
+            row[x] = *src++;
+        writeRow(0, y, width, row.data());
+    }
+}
+
+quint16 MapStorage::getMaxCell() const
+{
+    const int width = _size.width();
+    std::vector<quint16> row(width);
+    quint16 max = 0;
+    for (int y=0; y<_size.height(); ++y)
+    {
+        readRow(0, y, width, row.data());
+        max = qMax(max, *std::max_element(row.begin(), row.end()));
+    }
+    return max;
+}
+
+int MapStorage::getAllocatedChunks() const
+{
+    int allocated = 0;
+    for (const auto& slot : _slots)
+        if (slot.chunk)
+            allocated++;
+    return allocated;
+}
+
+int MapStorage::getByteFootprint() const
+{
+    int total = sizeof(*this) + _slots.capacity() * sizeof(ChunkSlot);
+    for (const auto& slot : _slots)
+        total += slot.getByteFootprint();
+    return total;
+}
+
+//
+// Changes
+//
+
+bool MapStorage::Changes::isEmpty() const
+{
+    return _changes.empty();
+}
+
+const QRect& MapStorage::Changes::getBounds() const
+{
+    return _bounds;
+}
+
+int MapStorage::Changes::getByteFootprint() const
+{
+    int total = _changes.capacity() * sizeof(Change);
+    for (const auto& change : _changes)
+        total += change.before.getByteFootprint() + change.after.getByteFootprint();
+    return total;
+}
+
+void MapStorage::Changes::clear()
+{
+    _changes.clear();
+    _bounds = QRect();
+}
+
+MapStorage::Changes MapStorage::diff(const MapStorage& before, const MapStorage& after)
+{
+    Q_ASSERT(before._size == after._size && "Invalid size");
+
+    Changes changes;
+    const QRect mapRect(QPoint(0,0), after._size);
+    for (std::size_t i=0; i<after._slots.size(); ++i)
+    {
+        if (before._slots[i] == after._slots[i])
+            continue;
+
+        changes._changes.push_back({(int)i, before._slots[i], after._slots[i]});
+
+        const int cx = i % after._chunkColumns;
+        const int cy = i / after._chunkColumns;
+        changes._bounds |= QRect(cx * CHUNK_SIZE, cy * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE).intersected(mapRect);
+    }
+    changes._changes.shrink_to_fit();
+    return changes;
+}
+
+void MapStorage::apply(const Changes& changes, bool undo)
+{
+    for (const auto& change : changes._changes)
+    {
+        Q_ASSERT(change.index < (int)_slots.size() && "Invalid change");
+        _slots[change.index] = undo ? change.before : change.after;
+    }
+}
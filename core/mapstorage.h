@@ -0,0 +1,201 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QRect>
+#include <QSize>
+#include <QtGlobal>
+
+/**
+ * @brief The MapStorage class stores the cells of the map.
+ * Each cell is a 16-bit tile index. The cells are stored in chunks of
+ * CHUNK_SIZE x CHUNK_SIZE cells, allocated the first time that one of their
+ * cells gets a different value from the rest: big maps that are mostly empty
+ * only use memory for the chunks that were painted.
+ * Resizing keeps the chunks: only the table of chunks is rebuilt.
+ *
+ * Chunks are reference counted and copied on write: copying a MapStorage
+ * only copies the table of chunks, and a chunk is duplicated the first time
+ * it is modified while shared. Undo commands keep references to the old
+ * chunks instead of copies of the map.
+ */
+class MapStorage
+{
+public:
+    // cells per chunk side. Must be a power of 2
+    static const int CHUNK_SHIFT = 5;
+    static const int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+    static const int CHUNK_MASK = CHUNK_SIZE - 1;
+
+    /**
+     * @brief MapStorage creates a map with all its cells set to value
+     */
+    explicit MapStorage(const QSize& size = QSize(40,25), quint16 value = 0);
+
+    const QSize& getSize() const;
+    int getCellCount() const;
+
+    /**
+     * @brief resize changes the size of the map. The cells that are inside both
+     * the old and the new size are kept. The new cells are set to value
+     */
+    void resize(const QSize& size, quint16 value);
+
+    /**
+     * @brief getCell returns the value of the cell at (x,y)
+     */
+    quint16 getCell(int x, int y) const;
+    void setCell(int x, int y, quint16 value);
+
+    /**
+     * @brief fillRow sets length cells of row y, starting at x, to value
+     */
+    void fillRow(int x, int y, int length, quint16 value);
+    /**
+     * @brief fill sets all the cells to value. Releases all the chunks
+     */
+    void fill(quint16 value);
+
+    /**
+     * @brief readRow copies length cells of row y, starting at x, to dst
+     */
+    void readRow(int x, int y, int length, quint16* dst) const;
+    /**
+     * @brief writeRow copies length cells from src to row y, starting at x
+     */
+    void writeRow(int x, int y, int length, const quint16* src);
+
+    /**
+     * @brief copyTo copies all the cells to dst, row by row: y * width + x.
+     * dst must have room for getCellCount() cells
+     */
+    void copyTo(quint16* dst) const;
+    void copyFrom(const quint16* src);
+    /**
+     * @brief copyTo copies the low 8 bits of all the cells to dst, row by row.
+     * The format of the C64 screen RAM
+     */
+    void copyTo(quint8* dst) const;
+    void copyFrom(const quint8* src);
+
+    /**
+     * @brief getMaxCell returns the biggest value of the cells
+     */
+    quint16 getMaxCell() const;
+
+    /**
+     * @brief getAllocatedChunks returns how many chunks are allocated
+     */
+    int getAllocatedChunks() const;
+
+    /**
+     * @brief getByteFootprint memory used by the map, in bytes.
+     * Shared chunks are split between the maps that share them
+     */
+    int getByteFootprint() const;
+
+protected:
+    struct Chunk {
+        quint16 cells[CHUNK_SIZE * CHUNK_SIZE];
+    };
+
+    // when chunk is not allocated, all its cells have the same value
+    struct ChunkSlot {
+        std::shared_ptr<Chunk> chunk;
+        quint16 value;
+
+        bool operator==(const ChunkSlot& other) const
+        {
+            return chunk == other.chunk && (chunk || value == other.value);
+        }
+        int getByteFootprint() const
+        {
+            return chunk ? (int)(sizeof(Chunk) / chunk.use_count()) : 0;
+        }
+    };
+
+public:
+    /**
+     * @brief The Changes class the chunks that differ between two versions
+     * of a map of the same size. Only references to the chunks are kept
+     */
+    class Changes
+    {
+    public:
+        bool isEmpty() const;
+        /** @brief getBounds the cells of the changed chunks, in map coordinates */
+        const QRect& getBounds() const;
+        int getByteFootprint() const;
+        void clear();
+
+    protected:
+        friend class MapStorage;
+        struct Change {
+            int index;
+            ChunkSlot before;
+            ChunkSlot after;
+        };
+        std::vector<Change> _changes;
+        QRect _bounds;
+    };
+
+    /**
+     * @brief diff returns the chunks that changed from before to after.
+     * Both must be of the same size. Cheap when after is a modified copy of
+     * before, since the untouched chunks are still shared
+     */
+    static Changes diff(const MapStorage& before, const MapStorage& after);
+
+    /**
+     * @brief apply goes from "before" to "after", or back when undo is true
+     */
+    void apply(const Changes& changes, bool undo);
+
+protected:
+
+    ChunkSlot& getSlot(int x, int y);
+    const ChunkSlot& getSlot(int x, int y) const;
+    Chunk* getChunkForWrite(ChunkSlot& slot);
+    void fillRect(int x, int y, int width, int height, quint16 value);
+
+    QSize _size;
+    int _chunkColumns;
+    int _chunkRows;
+    std::vector<ChunkSlot> _slots;
+};
+
+inline const MapStorage::ChunkSlot& MapStorage::getSlot(int x, int y) const
+{
+    return _slots[(y >> CHUNK_SHIFT) * _chunkColumns + (x >> CHUNK_SHIFT)];
+}
+
+inline MapStorage::ChunkSlot& MapStorage::getSlot(int x, int y)
+{
+    return _slots[(y >> CHUNK_SHIFT) * _chunkColumns + (x >> CHUNK_SHIFT)];
+}
+
+inline quint16 MapStorage::getCell(int x, int y) const
+{
+    Q_ASSERT(x >= 0 && x < _size.width() && y >= 0 && y < _size.height() && "Invalid cell");
+    const auto& slot = getSlot(x, y);
+    if (!slot.chunk)
+        return slot.value;
+    return slot.chunk->cells[((y & CHUNK_MASK) << CHUNK_SHIFT) | (x & CHUNK_MASK)];
+}
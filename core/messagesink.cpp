@@ -0,0 +1,44 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "messagesink.h"
+
+#include <QDebug>
+
+static MessageSink* _instance = nullptr;
+
+void MessageSink::showMessage(const QString& message)
+{
+    qWarning().noquote() << message;
+}
+
+void MessageSink::showError(const QString& message)
+{
+    qWarning().noquote() << "Error:" << message;
+}
+
+void MessageSink::setInstance(MessageSink* sink)
+{
+    _instance = sink;
+}
+
+MessageSink* MessageSink::getInstance()
+{
+    static MessageSink defaultSink;
+    if (!_instance)
+        return &defaultSink;
+    return _instance;
+}
@@ -0,0 +1,54 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#pragma once
+
+#include <QString>
+
+/**
+ * @brief The MessageSink class receives the messages and errors reported by
+ * State, StateImport and StateExport.
+ * The GUI shows them on the status bar. The default one prints them with qWarning().
+ */
+class MessageSink
+{
+public:
+    virtual ~MessageSink() {}
+
+    /**
+     * @brief showMessage reports an informative message
+     * @param message the message to report
+     */
+    virtual void showMessage(const QString& message);
+
+    /**
+     * @brief showError reports an error
+     * @param message the error to report
+     */
+    virtual void showError(const QString& message);
+
+    /**
+     * @brief setInstance sets the sink that will receive the messages
+     * @param sink the new sink. If nullptr, the default one will be used
+     */
+    static void setInstance(MessageSink* sink);
+
+    /**
+     * @brief getInstance returns the current sink
+     * @return the sink set by setInstance(), or the default one
+     */
+    static MessageSink* getInstance();
+};
@@ -22,27 +22,60 @@ limitations under the License.
 #include <utility>
 #include <vector>
 
-#include <QApplication>
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
 #include <QTime>
+#include <QtEndian>
 #include <QtGlobal>
 
+#include "chardecoder.h"
 #include "commands.h"
-#include "mainwindow.h"
+#include "messagesink.h"
 #include "palette.h"
 #include "stateexport.h"
 #include "stateimport.h"
+#include "undodelta.h"
 
 const int State::CHAR_BUFFER_SIZE;
+const int State::MAX_CHARSET_BANKS;
+
+static void paletteToRGB(quint8 rgb[16][3])
+{
+    for (int i=0; i<16; ++i)
+    {
+        const QColor& color = Palette::getColor(i);
+        rgb[i][0] = color.red();
+        rgb[i][1] = color.green();
+        rgb[i][2] = color.blue();
+    }
+}
+
+// decodes the char in CHAR_IMAGE_SIZE bytes: 8 scanlines of 8 RGB888 pixels
+static void decodeCharToRGB(const quint8* chardef, const State::ResolvedPens& resolved, quint8* image)
+{
+    quint8 pens[64];
+    CharDecoder::decodeChar(chardef, resolved.multicolor, pens);
+
+    quint8* dst = image;
+    for (int i=0; i<64; ++i)
+    {
+        const quint8* color = resolved.rgb[pens[i]];
+        *dst++ = color[0];
+        *dst++ = color[1];
+        *dst++ = color[2];
+    }
+}
 
 // target constructor
 State::State(const QString& filename, quint8 *charset, quint8 *tileColors, quint8 *map, const QSize& mapSize)
     : _totalChars(0)
-    , _charset{0}
-    , _tileColors{11}
-    , _mapSize(mapSize)
+    , _charsetBanks(1)
+    , _charsetBank(0)
+    , _lastCharsetBankVersion(0)
+    , _charset(nullptr)
+    , _tileColors(nullptr)
+    , _map(mapSize)
     , _multicolorMode(false)
     , _foregroundColorMode(FOREGROUND_COLOR_GLOBAL)
     , _selectedPen(PEN_FOREGROUND)
@@ -55,26 +88,56 @@ State::State(const QString& filename, quint8 *charset, quint8 *tileColors, quint
     , _exportedFilename("")
     , _exportProperties({{0x3800,0x4000,0x4400},EXPORT_FORMAT_RAW,EXPORT_FEATURE_CHARSET})
     , _undoStack(nullptr)
-    , _bigCharWidget(nullptr)
+    , _undoMemoryLimit(0)
+    , _undoStackFootprint(0)
+    , _undoHistoryDiscarded(false)
+    , _resolvedPensDirty(true)
 {
     _undoStack = new QUndoStack;
 
+    updateCharsetBankPointers();
+    memset(_tileColors, 11, TILE_COLORS_BUFFER_SIZE);
+
     if (charset)
-        memcpy(_charset, charset, sizeof(_charset));
+        memcpy(_charset, charset, CHAR_BUFFER_SIZE);
 
     if (tileColors)
-        memcpy(_tileColors, tileColors, sizeof(_tileColors));
+        memcpy(_tileColors, tileColors, TILE_COLORS_BUFFER_SIZE);
 
-    Q_ASSERT(_mapSize.width() > 0 && _mapSize.height() > 0 && "Invalid size");
-    _map = (quint8*)malloc(_mapSize.width() * _mapSize.height());
     if (map)
     {
-        memcpy(_map, map, _mapSize.width() * _mapSize.height());
+        _map.copyFrom(map);
     }
     else
     {
         setupDefaultMap();
     }
+
+    invalidateCharImages();
+
+    // keep the char image cache in sync with the charset and the colors
+    connect(this, &State::bytesUpdated, this, &State::invalidateCharImagesForBytes);
+    connect(this, &State::tileUpdated, this, &State::invalidateCharImagesForTile);
+    connect(this, &State::colorPropertiesUpdated, this, &State::invalidateCharImages);
+    connect(this, &State::multicolorModeToggled, this, &State::invalidateCharImages);
+    connect(this, &State::charsetUpdated, this, &State::invalidateCharImages);
+    connect(this, &State::tilePropertiesUpdated, this, &State::invalidateCharImages);
+    connect(this, &State::fileLoaded, this, &State::invalidateCharImages);
+
+    // ...and the resolved pens with the colors
+    connect(this, &State::colorPropertiesUpdated, this, &State::invalidateResolvedPens);
+    connect(this, &State::multicolorModeToggled, this, &State::invalidateResolvedPens);
+    connect(this, &State::fileLoaded, this, &State::invalidateResolvedPens);
+
+    // ...and the bank versions with the charset and the tile colors
+    connect(this, &State::bytesUpdated, this, &State::touchCharsetBank);
+    connect(this, &State::tileUpdated, this, &State::touchCharsetBank);
+    connect(this, &State::charsetUpdated, this, &State::touchCharsetBank);
+    connect(this, &State::colorPropertiesUpdated, this, [this](int pen) {
+        if (pen == PEN_FOREGROUND)
+            touchCharsetBank();
+    });
+    connect(this, &State::fileLoaded, this, &State::touchAllCharsetBanks);
 }
 
 // Delegating constructor
@@ -92,7 +155,7 @@ State::State()
 void State::copyState(const State &copyFromMe)
 {
     _totalChars = copyFromMe._totalChars;
-    _mapSize = copyFromMe._mapSize;
+    _map = copyFromMe._map;
     _multicolorMode = copyFromMe._multicolorMode;
     _foregroundColorMode = copyFromMe._foregroundColorMode;
     _selectedPen = copyFromMe._selectedPen;
@@ -102,20 +165,19 @@ void State::copyState(const State &copyFromMe)
     _exportProperties = copyFromMe._exportProperties;
 
     memcpy(_penColors, copyFromMe._penColors, sizeof(_penColors));
-    memcpy(_charset, copyFromMe._charset, sizeof(_charset));
-    memcpy(_tileColors, copyFromMe._tileColors, sizeof(_tileColors));
+    _charsetBanks = copyFromMe._charsetBanks;
+    _charsetBank = copyFromMe._charsetBank;
+    updateCharsetBankPointers();
+    // versions are only unique within the same state
+    touchAllCharsetBanks();
 
-    if (_map) {
-        free(_map);
-    }
-    _map = (quint8*)malloc(_mapSize.width() * _mapSize.height());
-    memcpy(_map, copyFromMe._map, _mapSize.width() * _mapSize.height());
+    invalidateCharImages();
+    invalidateResolvedPens();
 }
 
 State::~State()
 {
     delete _undoStack;
-    free(_map);
 }
 
 void State::reset()
@@ -139,9 +201,12 @@ void State::reset()
     _exportProperties.format = EXPORT_FORMAT_RAW;
     _exportProperties.features = EXPORT_FEATURE_CHARSET;
 
-    memset(_charset, 0, sizeof(_charset));
-    memset(_tileColors, 11, sizeof(_tileColors));
-    memset(_map, 0, _mapSize.width() * _mapSize.height());
+    resetCharsetBanks(1);
+    memset(_tileColors, 11, TILE_COLORS_BUFFER_SIZE);
+    _map.fill(0);
+
+    invalidateCharImages();
+    invalidateResolvedPens();
 }
 
 void State::emitNewState()
@@ -152,7 +217,7 @@ void State::emitNewState()
 
 bool State::isModified() const
 {
-    return (!getUndoStack()->isClean());
+    return (_undoHistoryDiscarded || !getUndoStack()->isClean());
 }
 
 bool State::openFile(const QString& filename)
@@ -204,6 +269,9 @@ bool State::openFile(const QString& filename)
     if(length<=0)
         return false;
 
+    invalidateCharImages();
+    invalidateResolvedPens();
+
     // built-in resources are not saved
     if (filename[0] != ':')
     {
@@ -280,11 +348,9 @@ bool State::export_()
         ret = exportAsm(_exportedFilename, _exportProperties);
 
     if (ret) {
-        MainWindow::getInstance()->showMessageOnStatusBar(tr("Export: Ok"));
+        MessageSink::getInstance()->showMessage(tr("Export: Ok"));
     } else {
-        // beep on error
-        MainWindow::getInstance()->showMessageOnStatusBar(tr("Export: Error"));
-        QApplication::beep();
+        MessageSink::getInstance()->showError(tr("Export: Error"));
     }
 
     return ret;
@@ -296,15 +362,16 @@ bool State::exportRaw(const QString& filename, const ExportProperties &propertie
 
     if (ret && (properties.features & EXPORT_FEATURE_CHARSET))
         ret &= (StateExport::saveRaw(filenameFixSuffix(filename, EXPORT_FEATURE_CHARSET),
-                                     _charset, sizeof(_charset)) > 0);
+                                     getCharsetBytes().constData(), getCharsetBankCount() * CHAR_BUFFER_SIZE) > 0);
 
+    const auto mapBytes = (properties.features & EXPORT_FEATURE_MAP) ? getMapExportBytes() : QByteArray();
     if (ret && (properties.features & EXPORT_FEATURE_MAP))
         ret &= (StateExport::saveRaw(filenameFixSuffix(filename, EXPORT_FEATURE_MAP),
-                                     _map, _mapSize.width() * _mapSize.height()) > 0);
+                                     mapBytes.constData(), mapBytes.size()) > 0);
 
     if (ret && (properties.features & EXPORT_FEATURE_COLORS))
         ret &= (StateExport::saveRaw(filenameFixSuffix(filename, EXPORT_FEATURE_COLORS),
-                                     _tileColors, sizeof(_tileColors)) > 0);
+                                     getTileColorsBytes().constData(), getCharsetBankCount() * TILE_COLORS_BUFFER_SIZE) > 0);
 
     if (ret)
     {
@@ -322,15 +389,16 @@ bool State::exportPRG(const QString& filename, const ExportProperties& propertie
 
     if (ret && (properties.features & EXPORT_FEATURE_CHARSET))
         ret &= (StateExport::savePRG(filenameFixSuffix(filename, EXPORT_FEATURE_CHARSET),
-                                     _charset, sizeof(_charset), properties.addresses[0]) > 0);
+                                     getCharsetBytes().constData(), getCharsetBankCount() * CHAR_BUFFER_SIZE, properties.addresses[0]) > 0);
 
+    const auto mapBytes = (properties.features & EXPORT_FEATURE_MAP) ? getMapExportBytes() : QByteArray();
     if (ret && (properties.features & EXPORT_FEATURE_MAP))
         ret &= (StateExport::savePRG(filenameFixSuffix(filename, EXPORT_FEATURE_MAP),
-                                     _map, _mapSize.width() * _mapSize.height(), properties.addresses[1]) > 0);
+                                     mapBytes.constData(), mapBytes.size(), properties.addresses[1]) > 0);
 
     if (ret && (properties.features & EXPORT_FEATURE_COLORS))
         ret &= (StateExport::savePRG(filenameFixSuffix(filename, EXPORT_FEATURE_COLORS),
-                                     _tileColors, sizeof(_tileColors), properties.addresses[2]) > 0);
+                                     getTileColorsBytes().constData(), getCharsetBankCount() * TILE_COLORS_BUFFER_SIZE, properties.addresses[2]) > 0);
 
     if (ret)
     {
@@ -348,15 +416,16 @@ bool State::exportAsm(const QString& filename, const ExportProperties &propertie
     bool ret = true;
     if (ret && (properties.features & EXPORT_FEATURE_CHARSET))
         ret &= (StateExport::saveAsm(filenameFixSuffix(filename, EXPORT_FEATURE_CHARSET),
-                                     _charset, sizeof(_charset), "charset") > 0);
+                                     getCharsetBytes().constData(), getCharsetBankCount() * CHAR_BUFFER_SIZE, "charset") > 0);
 
+    const auto mapBytes = (properties.features & EXPORT_FEATURE_MAP) ? getMapExportBytes() : QByteArray();
     if (ret && (properties.features & EXPORT_FEATURE_MAP))
         ret &= (StateExport::saveAsm(filenameFixSuffix(filename, EXPORT_FEATURE_MAP ),
-                                     _map, _mapSize.width() * _mapSize.height(), "map") > 0);
+                                     mapBytes.constData(), mapBytes.size(), "map") > 0);
 
     if (ret && (properties.features & EXPORT_FEATURE_COLORS))
         ret &= (StateExport::saveAsm(filenameFixSuffix(filename, EXPORT_FEATURE_COLORS),
-                                     _tileColors, sizeof(_tileColors), "colors") > 0);
+                                     getTileColorsBytes().constData(), getCharsetBankCount() * TILE_COLORS_BUFFER_SIZE, "colors") > 0);
 
     if (ret)
     {
@@ -373,10 +442,10 @@ bool State::saveProject(const QString& filename)
     bool ret = false;
 
     // don't save it nothing has changed. Same behavior as Qt Creator
-    if (getUndoStack()->isClean() && _savedFilename == filename)
+    if (!isModified() && _savedFilename == filename)
     {
         // clean, nothing to save
-        QApplication::beep();
+        MessageSink::getInstance()->showError(tr("Save: Nothing to save"));
         // hack: return true so that mainWindow doesn't treat it as an error
         return true;
     }
@@ -394,17 +463,16 @@ bool State::saveProject(const QString& filename)
         {
             _loadedFilename = _savedFilename = filename;
             getUndoStack()->setClean();
+            _undoHistoryDiscarded = false;
             emit contentsChanged();
         }
     }
 
     if (ret)
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(tr("Save: Ok"));
+        MessageSink::getInstance()->showMessage(tr("Save: Ok"));
     } else {
-        MainWindow::getInstance()->showMessageOnStatusBar(tr("Save: Error"));
-        // beep on error
-        QApplication::beep();
+        MessageSink::getInstance()->showError(tr("Save: Error"));
     }
 
     return ret;
@@ -438,7 +506,7 @@ bool State::isMulticolorMode() const
 
 void State::setMulticolorMode(bool enabled)
 {
-    getUndoStack()->push(new SetMulticolorModeCommand(this, enabled));
+    pushUndoCommand(new SetMulticolorModeCommand(this, enabled));
 }
 
 void State::_setMulticolorMode(bool enabled)
@@ -454,7 +522,7 @@ void State::_setMulticolorMode(bool enabled)
 
 void State::setForegroundColorMode(State::ForegroundColorMode mode)
 {
-    getUndoStack()->push(new SetForegroundColorMode(this, mode));
+    pushUndoCommand(new SetForegroundColorMode(this, mode));
 }
 
 void State::_setForegroundColorMode(ForegroundColorMode mode)
@@ -498,7 +566,9 @@ void State::setColorForPen(int pen, int color)
 
 void State::setColorForPen(int pen, int color, int tileIdx)
 {
-    getUndoStack()->push(new SetColorCommand(this, color, pen, tileIdx));
+    // the per tile foreground colors belong to the bank
+    const bool foregroundAndPerTile = (pen == PEN_FOREGROUND && _foregroundColorMode == FOREGROUND_COLOR_PER_TILE);
+    pushUndoCommand(new SetColorCommand(this, color, pen, tileIdx), foregroundAndPerTile ? _charsetBank : -1);
 }
 
 void State::_setColorForPen(int pen, int color, int tileIdx)
@@ -636,7 +706,7 @@ void State::_tileSetPen(int tileIndex, const QPoint& position, int pen)
 // tile properties
 void State::setTileProperties(const TileProperties& properties)
 {
-    getUndoStack()->push(new SetTilePropertiesCommand(this, properties));
+    pushUndoCommand(new SetTilePropertiesCommand(this, properties));
 }
 
 void State::_setTileProperties(const TileProperties& properties)
@@ -660,7 +730,7 @@ void State::setExportProperties(const ExportProperties& properties)
     // Only submit command to the Undo Stack if it is different that the current properties
     // This is in order to avoid generating a "dirty" signal, when in fact it is not
     if (memcmp(&_exportProperties, &properties, sizeof(_exportProperties)) != 0) {
-        getUndoStack()->push(new SetExportPropertiesCommand(this, properties));
+        pushUndoCommand(new SetExportPropertiesCommand(this, properties));
     }
 }
 
@@ -680,35 +750,43 @@ State::ExportProperties State::getExportProperties() const
 
 void State::setMapSize(const QSize& mapSize)
 {
-    getUndoStack()->push(new SetMapSizeCommand(this, mapSize));
+    pushUndoCommand(new SetMapSizeCommand(this, mapSize));
 }
 
-void State::_setMapSize(const QSize& mapSize)
+void State::_applyCharsetDelta(const UndoDelta& charsetDelta, const UndoDelta& colorsDelta)
 {
-    if (_mapSize != mapSize)
+    charsetDelta.apply(_charset, CHAR_BUFFER_SIZE);
+    colorsDelta.apply(_tileColors, TILE_COLORS_BUFFER_SIZE);
+
+    if (!charsetDelta.isEmpty())
     {
-        const int newSizeInBytes = mapSize.width() * mapSize.height();
-        quint8* newMap = (quint8*) malloc(newSizeInBytes);
-        Q_ASSERT(newMap && "No memory");
+        const int first = charsetDelta.getFirstModified();
+        emit bytesUpdated(first, charsetDelta.getLastModified() - first + 1);
+        emit charsetUpdated();
+    }
 
-        for (int i=0; i<newSizeInBytes; ++i)
-            newMap[i] = _tileIndex;
+    if (!colorsDelta.isEmpty())
+        emit colorPropertiesUpdated(PEN_FOREGROUND);
 
+    emit contentsChanged();
+}
 
-        for (int row=0; row<mapSize.height(); ++row)
-        {
-            // no more rows to copy
-            if (row >= _mapSize.height())
-                break;
+void State::_applyMapChanges(const MapStorage::Changes& changes, bool undo)
+{
+    _map.apply(changes, undo);
 
-            // bytes to copy per row
-            int toCopy = qMin(mapSize.width(), _mapSize.width());
-            memcpy(&newMap[mapSize.width() * row], &_map[_mapSize.width() * row], toCopy);
-        }
+    if (!changes.isEmpty())
+        emit mapContentUpdated(changes.getBounds());
 
-        free(_map);
-        _map = newMap;
-        _mapSize = mapSize;
+    emit contentsChanged();
+}
+
+void State::_setMapSize(const QSize& mapSize)
+{
+    if (_map.getSize() != mapSize)
+    {
+        // new cells use the selected tile
+        _map.resize(mapSize, makeMapCell(_charsetBank, _tileIndex));
 
         emit mapSizeUpdated();
         emit contentsChanged();
@@ -717,91 +795,188 @@ void State::_setMapSize(const QSize& mapSize)
 
 const QSize& State::getMapSize() const
 {
-    return _mapSize;
+    return _map.getSize();
 }
 
 int State::getTileIndexFromMap(const QPoint& mapCoord) const
 {
-    Q_ASSERT(mapCoord.x() < _mapSize.width() && mapCoord.y() < _mapSize.height() && "Invalid map size");
-    int tileIndex = _map[_mapSize.width() * mapCoord.y() + mapCoord.x()];
+    int tileIndex = getTileFromMapCell(_map.getCell(mapCoord.x(), mapCoord.y()));
 
     // safety check: map could have tiles bigger than the maximum supported if the tiles were resized.
     tileIndex = qBound(0, tileIndex, 256 / (_tileProperties.size.width() * _tileProperties.size.height()) - 1);
     return tileIndex;
 }
 
-void State::floodFillImpl(const QPoint& coord, int targetTile, int newTile)
+int State::getCharsetBankFromMap(const QPoint& mapCoord) const
 {
-    if (coord.x() < 0 || coord.x() >= _mapSize.width())
-        return;
-    if (coord.y() < 0 || coord.y() >= _mapSize.height())
-        return;
-    if (_map[coord.y() * _mapSize.width() + coord.x()] != targetTile)
+    return getBankFromMapCell(_map.getCell(mapCoord.x(), mapCoord.y()));
+}
+
+const MapStorage& State::getMap() const
+{
+    return _map;
+}
+
+QByteArray State::getMapBytes() const
+{
+    QByteArray bytes(_map.getCellCount(), 0);
+    _map.copyTo((quint8*)bytes.data());
+    return bytes;
+}
+
+QByteArray State::getMapCellBytes() const
+{
+    std::vector<quint16> cells(_map.getCellCount());
+    _map.copyTo(cells.data());
+    for (auto& cell : cells)
+        cell = qToLittleEndian(cell);
+    return QByteArray((const char*)cells.data(), (int)(cells.size() * sizeof(quint16)));
+}
+
+QByteArray State::getMapExportBytes() const
+{
+    // the tile index alone would point to the first bank
+    return (getCharsetBankCount() > 1) ? getMapCellBytes() : getMapBytes();
+}
+
+// iterative span fill: each popped seed fills its whole row span,
+// and pushes one seed per contiguous segment in the rows above and below
+void State::floodFillImpl(const QPoint& coord, int targetTile, int newTile, QRect* updatedRect, QVector<MapRun>* runs)
+{
+    Q_ASSERT(targetTile != newTile && "Invalid tiles");
+
+    const int width = _map.getSize().width();
+    const int height = _map.getSize().height();
+
+    if (coord.x() < 0 || coord.x() >= width || coord.y() < 0 || coord.y() >= height)
         return;
 
-    _map[coord.y() * _mapSize.width() + coord.x()] = newTile;
+    _floodFillStack.clear();
+    _floodFillStack.push_back(coord);
+
+    while (!_floodFillStack.empty())
+    {
+        const QPoint seed = _floodFillStack.back();
+        _floodFillStack.pop_back();
+
+        const int y = seed.y();
+        if (_map.getCell(seed.x(), y) != targetTile)
+            continue;
+
+        int left = seed.x();
+        while (left > 0 && _map.getCell(left - 1, y) == targetTile)
+            --left;
+        int right = seed.x();
+        while (right < width - 1 && _map.getCell(right + 1, y) == targetTile)
+            ++right;
+
+        const int length = right - left + 1;
+        _map.fillRow(left, y, length, newTile);
+
+        *updatedRect |= QRect(left, seed.y(), length, 1);
+        if (runs)
+            runs->append({seed.y() * width + left, length});
+
+        for (int adjacentY : {y - 1, y + 1})
+        {
+            if (adjacentY < 0 || adjacentY >= height)
+                continue;
 
-    floodFillImpl(QPoint(coord.x()-1, coord.y()), targetTile, newTile);
-    floodFillImpl(QPoint(coord.x()+1, coord.y()), targetTile, newTile);
-    floodFillImpl(QPoint(coord.x(), coord.y()-1), targetTile, newTile);
-    floodFillImpl(QPoint(coord.x(), coord.y()+1), targetTile, newTile);
+            bool inSegment = false;
+            for (int x=left; x<=right; ++x)
+            {
+                if (_map.getCell(x, adjacentY) == targetTile)
+                {
+                    if (!inSegment)
+                        _floodFillStack.push_back(QPoint(x, adjacentY));
+                    inSegment = true;
+                }
+                else
+                {
+                    inSegment = false;
+                }
+            }
+        }
+    }
 }
 
 void State::mapFill(const QPoint& coord, int tileIdx)
 {
-    getUndoStack()->push(new FillMapCommand(this, coord, tileIdx));
+    pushUndoCommand(new FillMapCommand(this, coord, makeMapCell(_charsetBank, tileIdx)));
 }
 
-void State::_mapFill(const QPoint &coord, int tileIdx)
+void State::_mapFill(const QPoint &coord, int tileIdx, QVector<MapRun>* runs)
 {
-    if (coord.x() < _mapSize.width() && coord.y() < _mapSize.height())
+    if (coord.x() < _map.getSize().width() && coord.y() < _map.getSize().height())
     {
-        int targetTile = _map[coord.y() * _mapSize.width() + coord.x()];
+        int targetTile = _map.getCell(coord.x(), coord.y());
 
         if (targetTile != tileIdx)
         {
-            floodFillImpl(coord, targetTile, tileIdx);
-            emit mapContentUpdated();
+            QRect updatedRect;
+            floodFillImpl(coord, targetTile, tileIdx, &updatedRect, runs);
+            emit mapContentUpdated(updatedRect);
             emit contentsChanged();
         }
     }
 }
 
+void State::_mapFillRuns(const QVector<MapRun>& runs, int tileIdx)
+{
+    if (runs.isEmpty())
+        return;
+
+    const int width = _map.getSize().width();
+    QRect updatedRect;
+
+    for (const auto& run : runs)
+    {
+        Q_ASSERT(run.offset >= 0 && run.offset + run.length <= _map.getCellCount() && "Invalid run");
+        _map.fillRow(run.offset % width, run.offset / width, run.length, tileIdx);
+        updatedRect |= QRect(run.offset % width, run.offset / width, run.length, 1);
+    }
+
+    emit mapContentUpdated(updatedRect);
+    emit contentsChanged();
+}
+
 void State::mapPaint(const QPoint& coord, int tileIdx, bool mergeable)
 {
-    getUndoStack()->push(new PaintMapCommand(this, coord, tileIdx, mergeable));
+    pushUndoCommand(new PaintMapCommand(this, coord, makeMapCell(_charsetBank, tileIdx), mergeable));
 }
 
 void State::_mapPaint(const QPoint& coord, int tileIdx)
 {
-    if (coord.x() < _mapSize.width() && coord.y() < _mapSize.height())
+    if (coord.x() < _map.getSize().width() && coord.y() < _map.getSize().height())
     {
-        _map[coord.y() * _mapSize.width() + coord.x()] = tileIdx;
-        emit mapContentUpdated();
+        _map.setCell(coord.x(), coord.y(), tileIdx);
+        emit mapContentUpdated(QRect(coord, QSize(1,1)));
         emit contentsChanged();
     }
 }
 
 void State::mapClear(int tileIdx)
 {
-    getUndoStack()->push(new ClearMapCommand(this, tileIdx));
+    pushUndoCommand(new ClearMapCommand(this, makeMapCell(_charsetBank, tileIdx)));
 }
 
 void State::_mapClear(int tileIdx)
 {
-    for (int i=0; i<_mapSize.width() * _mapSize.height(); ++i)
-        _map[i] = tileIdx;
+    _map.fill(tileIdx);
 
-    emit mapContentUpdated();
+    emit mapContentUpdated(QRect(QPoint(0,0), _map.getSize()));
     emit contentsChanged();
 }
 
-void State::_setMap(const quint8* buffer, const QSize& mapSize)
+void State::_setMap(const MapStorage& map)
 {
-    Q_ASSERT(_mapSize == mapSize && "Invalid map size");
-    memcpy(_map, buffer, mapSize.width() * mapSize.height());
+    // the chunks are shared with map until they are modified
+    const bool resized = (_map.getSize() != map.getSize());
+    _map = map;
 
-    emit mapContentUpdated();
+    if (resized)
+        emit mapSizeUpdated();
+    emit mapContentUpdated(QRect(QPoint(0,0), _map.getSize()));
     emit contentsChanged();
 }
 
@@ -811,11 +986,6 @@ const quint8* State::getCharsetBuffer() const
     return _charset;
 }
 
-const quint8* State::getMapBuffer() const
-{
-    return _map;
-}
-
 const quint8* State::getTileColors() const
 {
     return _tileColors;
@@ -824,7 +994,157 @@ const quint8* State::getTileColors() const
 
 void State::resetCharsetBuffer()
 {
-    memset(_charset, 0, sizeof(_charset));
+    memset(_charset, 0, CHAR_BUFFER_SIZE);
+}
+
+QByteArray State::getCharsetBytes() const
+{
+    QByteArray bytes;
+    bytes.reserve(getCharsetBankCount() * CHAR_BUFFER_SIZE);
+    for (const auto& bank : _charsetBanks)
+        bytes.append((const char*)bank.charset, CHAR_BUFFER_SIZE);
+    return bytes;
+}
+
+QByteArray State::getTileColorsBytes() const
+{
+    QByteArray bytes;
+    bytes.reserve(getCharsetBankCount() * TILE_COLORS_BUFFER_SIZE);
+    for (const auto& bank : _charsetBanks)
+        bytes.append((const char*)bank.tileColors, TILE_COLORS_BUFFER_SIZE);
+    return bytes;
+}
+
+//
+// charset banks
+//
+
+void State::setCharsetBankCount(int count)
+{
+    if (count != getCharsetBankCount())
+        pushUndoCommand(new SetCharsetBankCountCommand(this, count));
+}
+
+int State::getCharsetBankCount() const
+{
+    return (int)_charsetBanks.size();
+}
+
+void State::setCharsetBank(int bank)
+{
+    _setCharsetBank(bank);
+}
+
+int State::getCharsetBank() const
+{
+    return _charsetBank;
+}
+
+const quint8* State::getCharsetBankBuffer(int bank) const
+{
+    Q_ASSERT(bank >= 0 && bank < getCharsetBankCount() && "Invalid bank");
+    return _charsetBanks[bank].charset;
+}
+
+const quint8* State::getCharsetBankTileColors(int bank) const
+{
+    Q_ASSERT(bank >= 0 && bank < getCharsetBankCount() && "Invalid bank");
+    return _charsetBanks[bank].tileColors;
+}
+
+quint32 State::getCharsetBankVersion(int bank) const
+{
+    Q_ASSERT(bank >= 0 && bank < getCharsetBankCount() && "Invalid bank");
+    return _charsetBanks[bank].version;
+}
+
+void State::_setCharsetBank(int bank)
+{
+    Q_ASSERT(bank >= 0 && bank < getCharsetBankCount() && "Invalid bank");
+
+    if (bank != _charsetBank)
+    {
+        _charsetBank = bank;
+        updateCharsetBankPointers();
+
+        emit charsetBankSelected(bank);
+        // the views only display the selected bank: its chars and its colors
+        emit charsetUpdated();
+        emit colorPropertiesUpdated(PEN_FOREGROUND);
+    }
+}
+
+void State::_setCharsetBankCount(int count, const std::vector<CharsetBank>* restoredBanks)
+{
+    Q_ASSERT(count >= 1 && count <= MAX_CHARSET_BANKS && "Invalid bank count");
+
+    const int oldCount = getCharsetBankCount();
+    if (count == oldCount)
+        return;
+
+    const int oldBank = _charsetBank;
+    resizeCharsetBanks(count);
+
+    if (restoredBanks)
+    {
+        Q_ASSERT((int)restoredBanks->size() == count - oldCount && "Invalid restored banks");
+        std::copy(restoredBanks->begin(), restoredBanks->end(), _charsetBanks.begin() + oldCount);
+    }
+
+    emit charsetBankCountUpdated(count);
+
+    if (_charsetBank != oldBank)
+    {
+        emit charsetBankSelected(_charsetBank);
+        emit charsetUpdated();
+        emit colorPropertiesUpdated(PEN_FOREGROUND);
+    }
+    emit contentsChanged();
+}
+
+void State::resizeCharsetBanks(int count)
+{
+    const int oldCount = getCharsetBankCount();
+    _charsetBanks.resize(count);
+
+    // the charset of the new banks is already zeroed
+    for (int i=oldCount; i<count; ++i)
+    {
+        memset(_charsetBanks[i].tileColors, 11, TILE_COLORS_BUFFER_SIZE);
+        _charsetBanks[i].version = ++_lastCharsetBankVersion;
+    }
+
+    _charsetBank = qMin(_charsetBank, count - 1);
+    updateCharsetBankPointers();
+}
+
+void State::resetCharsetBanks(int count)
+{
+    Q_ASSERT(count >= 1 && count <= MAX_CHARSET_BANKS && "Invalid bank count");
+
+    resizeCharsetBanks(count);
+    _charsetBank = 0;
+    updateCharsetBankPointers();
+
+    for (auto& bank : _charsetBanks)
+        memset(bank.charset, 0, CHAR_BUFFER_SIZE);
+}
+
+void State::updateCharsetBankPointers()
+{
+    _charset = _charsetBanks[_charsetBank].charset;
+    _tileColors = _charsetBanks[_charsetBank].tileColors;
+}
+
+void State::touchCharsetBank()
+{
+    _charsetBanks[_charsetBank].version = ++_lastCharsetBankVersion;
+}
+
+void State::touchAllCharsetBanks()
+{
+    for (auto& bank : _charsetBanks)
+        bank.version = ++_lastCharsetBankVersion;
 }
 
 // buffer must be at least 8x8*8 bytes big
@@ -900,6 +1220,129 @@ int State::getTileIndexFromCharIndex(int charIndex) const
     return tileIndex;
 }
 
+//
+// char image cache
+//
+
+const quint8* State::getCharImage(int charIndex)
+{
+    Q_ASSERT(charIndex>=0 && charIndex<256 && "Invalid index");
+
+    if (_charImagesDirty[charIndex])
+    {
+        decodeCharImage(charIndex);
+        _charImagesDirty[charIndex] = false;
+    }
+    return _charImages[charIndex];
+}
+
+void State::invalidateCharImages()
+{
+    for (auto& dirty : _charImagesDirty)
+        dirty = true;
+}
+
+void State::invalidateCharImagesForBytes(int pos, int count)
+{
+    if (count <= 0)
+        return;
+
+    const int first = qBound(0, pos / 8, 255);
+    const int last = qBound(0, (pos + count - 1) / 8, 255);
+    for (int i=first; i<=last; ++i)
+        _charImagesDirty[i] = true;
+}
+
+void State::invalidateCharImagesForTile(int tileIndex)
+{
+    const int charsPerTile = _tileProperties.size.width() * _tileProperties.size.height();
+    int charIndex = getCharIndexFromTileIndex(tileIndex);
+
+    for (int i=0; i<charsPerTile; ++i)
+    {
+        if (charIndex >= 0 && charIndex < 256)
+            _charImagesDirty[charIndex] = true;
+        charIndex += _tileProperties.interleaved;
+    }
+}
+
+const quint8* State::getCharImage(int bank, int charIndex)
+{
+    if (bank == _charsetBank)
+        return getCharImage(charIndex);
+
+    Q_ASSERT(bank >= 0 && bank < getCharsetBankCount() && "Invalid bank");
+    Q_ASSERT(charIndex>=0 && charIndex<256 && "Invalid index");
+
+    quint8 rgb[16][3];
+    paletteToRGB(rgb);
+
+    ResolvedPens resolved;
+    resolveTilePens(getTileIndexFromCharIndex(charIndex), _charsetBanks[bank].tileColors, rgb, &resolved);
+
+    decodeCharToRGB(&_charsetBanks[bank].charset[charIndex * 8], resolved, _otherBankCharImage);
+    return _otherBankCharImage;
+}
+
+void State::decodeCharImage(int charIndex)
+{
+    const auto& resolved = getResolvedPens(getTileIndexFromCharIndex(charIndex));
+    decodeCharToRGB(&_charset[charIndex * 8], resolved, _charImages[charIndex]);
+}
+
+//
+// resolved pens
+//
+
+const State::ResolvedPens& State::getResolvedPens(int tileIndex)
+{
+    Q_ASSERT(tileIndex>=0 && tileIndex<256 && "Invalid index");
+
+    if (_resolvedPensDirty)
+    {
+        resolvePens();
+        _resolvedPensDirty = false;
+    }
+    return _resolvedPens[tileIndex];
+}
+
+void State::invalidateResolvedPens()
+{
+    _resolvedPensDirty = true;
+}
+
+void State::resolvePens()
+{
+    quint8 rgb[16][3];
+    paletteToRGB(rgb);
+
+    for (int tileIdx=0; tileIdx<256; ++tileIdx)
+        resolveTilePens(tileIdx, _tileColors, rgb, &_resolvedPens[tileIdx]);
+}
+
+// tileColors: the colors of the bank of the tile, that might not be the selected one
+void State::resolveTilePens(int tileIdx, const quint8* tileColors, const quint8 rgb[16][3], ResolvedPens* resolved) const
+{
+    int foreground = (_foregroundColorMode == FOREGROUND_COLOR_GLOBAL) ?
+                _penColors[PEN_FOREGROUND] :
+                (tileColors[tileIdx] & 0xf);
+
+    // same as shouldBeDisplayedInMulticolor2(), with the colors of the bank
+    resolved->multicolor = _multicolorMode && foreground >= 8;
+
+    // in multicolor, only the 3 LSB bits of color RAM are used
+    if (resolved->multicolor)
+        foreground -= 8;
+
+    resolved->colorIndices[PEN_BACKGROUND] = _penColors[PEN_BACKGROUND] & 0xf;
+    resolved->colorIndices[PEN_MULTICOLOR1] = _penColors[PEN_MULTICOLOR1] & 0xf;
+    resolved->colorIndices[PEN_MULTICOLOR2] = _penColors[PEN_MULTICOLOR2] & 0xf;
+    resolved->colorIndices[PEN_FOREGROUND] = foreground & 0xf;
+
+    for (int pen=0; pen<PEN_MAX; ++pen)
+        memcpy(resolved->rgb[pen], rgb[resolved->colorIndices[pen]], 3);
+}
+
 quint8* State::getCharAtIndex(int charIndex)
 {
     Q_ASSERT(charIndex>=0 && charIndex<256 && "Invalid index");
@@ -908,12 +1351,12 @@ quint8* State::getCharAtIndex(int charIndex)
 
 void State::cut(const CopyRange &copyRange)
 {
-    getUndoStack()->push(new CutCommand(this, copyRange));
+    pushUndoCommand(new CutCommand(this, copyRange), copyRange.type != CopyRange::MAP ? _charsetBank : -1);
 }
 
 void State::paste(int offset, const CopyRange& copyRange, const quint8* origBuffer)
 {
-    getUndoStack()->push(new PasteCommand(this, offset, copyRange, origBuffer));
+    pushUndoCommand(new PasteCommand(this, offset, copyRange, origBuffer), copyRange.type != CopyRange::MAP ? _charsetBank : -1);
 }
 
 void State::_pasteChars(int charIndex, const CopyRange& copyRange, const quint8* origBuffer)
@@ -931,7 +1374,7 @@ void State::_pasteChars(int charIndex, const CopyRange& copyRange, const quint8*
 
     while (count>0)
     {
-        const auto lastByte = &_charset[sizeof(_charset)];
+        const auto lastByte = &_charset[CHAR_BUFFER_SIZE];
         int bytesToCopy = qMin((qint64)copyRange.blockSize * 8, (qint64)(lastByte - chrdst));
         if (bytesToCopy <0)
             break;
@@ -962,7 +1405,7 @@ void State::_pasteTiles(int charIndex, const CopyRange& copyRange, const quint8*
     if (copyRange.tileProperties.size != _tileProperties.size)
     {
         qDebug() << "Error. Src:" << copyRange.tileProperties.size << " Dst:" << _tileProperties.size;
-        MainWindow::getInstance()->showMessageOnStatusBar(tr("Error. Tile size different than src"));
+        MessageSink::getInstance()->showMessage(tr("Error. Tile size different than src"));
         return;
     }
 
@@ -1009,27 +1452,53 @@ void State::_pasteTiles(int charIndex, const CopyRange& copyRange, const quint8*
         count--;
     }
     emit charsetUpdated();
+
+    // the tile colors were copied as well
+    emit colorPropertiesUpdated(PEN_FOREGROUND);
 }
 
 void State::_pasteMap(int charIndex, const CopyRange& copyRange, const quint8* origBuffer)
 {
+    // origBuffer has one quint16 per cell, like the map
+    const int mapWidth = _map.getSize().width();
+    const int totalCells = _map.getCellCount();
     int count = copyRange.count;
-    quint8* dst = _map + charIndex;
-    const quint8* src = origBuffer + copyRange.offset;
+    int dst = charIndex;
+    int src = copyRange.offset;
 
     while (count>0)
     {
-        const auto lastByte = &_map[_mapSize.width()*_mapSize.height()];
-        int bytesToCopy = qMin((qint64)copyRange.blockSize, (qint64)(lastByte - dst));
-        if (bytesToCopy <0)
+        int cellsToCopy = qMin(copyRange.blockSize, totalCells - dst);
+        if (cellsToCopy <0)
             break;
-        memcpy(dst, src, bytesToCopy);
+        for (int i=0; i<cellsToCopy; ++i)
+        {
+            quint16 cell;
+            memcpy(&cell, &origBuffer[(src + i) * sizeof(cell)], sizeof(cell));
+            _map.setCell((dst + i) % mapWidth, (dst + i) / mapWidth, cell);
+        }
 
         dst += copyRange.blockSize + copyRange.skip;
         src += copyRange.blockSize + copyRange.skip;
         count--;
     }
-    emit mapContentUpdated();
+
+    // updated cells
+    QRect updatedRect;
+    if (copyRange.blockSize + copyRange.skip == mapWidth)
+    {
+        // same width: blocks are stacked in a rectangle
+        updatedRect = QRect(charIndex % mapWidth, charIndex / mapWidth,
+                            copyRange.blockSize, copyRange.count);
+    }
+    else
+    {
+        // different width: use the rows that contain the whole range
+        const int lastIndex = charIndex + (copyRange.count - 1) * (copyRange.blockSize + copyRange.skip) + copyRange.blockSize - 1;
+        updatedRect = QRect(0, charIndex / mapWidth,
+                            mapWidth, lastIndex / mapWidth - charIndex / mapWidth + 1);
+    }
+    emit mapContentUpdated(updatedRect.intersected(QRect(QPoint(0,0), _map.getSize())));
 }
 
 void State::_paste(int charIndex, const CopyRange& copyRange, const quint8* origBuffer)
@@ -1055,12 +1524,12 @@ void State::_paste(int charIndex, const CopyRange& copyRange, const quint8* orig
 
 void State::tilePaint(int tileIndex, const QPoint& point, int pen, bool mergeable)
 {
-    getUndoStack()->push(new PaintTileCommand(this, tileIndex, point, pen, mergeable));
+    pushUndoCommand(new PaintTileCommand(this, tileIndex, point, pen, mergeable), _charsetBank);
 }
 
 void State::tileInvert(int tileIndex)
 {
-    getUndoStack()->push(new InvertTileCommand(this, tileIndex));
+    pushUndoCommand(new InvertTileCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileInvert(int tileIndex)
@@ -1082,7 +1551,7 @@ void State::_tileInvert(int tileIndex)
 
 void State::tileClear(int tileIndex)
 {
-    getUndoStack()->push(new ClearTileCommand(this, tileIndex));
+    pushUndoCommand(new ClearTileCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileClear(int tileIndex)
@@ -1104,7 +1573,7 @@ void State::_tileClear(int tileIndex)
 
 void State::tileFlipHorizontally(int tileIndex)
 {
-    getUndoStack()->push(new FlipTileHCommand(this, tileIndex));
+    pushUndoCommand(new FlipTileHCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileFlipHorizontally(int tileIndex)
@@ -1143,7 +1612,7 @@ void State::_tileFlipHorizontally(int tileIndex)
 
 void State::tileFlipVertically(int tileIndex)
 {
-    getUndoStack()->push(new FlipTileVCommand(this, tileIndex));
+    pushUndoCommand(new FlipTileVCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileFlipVertically(int tileIndex)
@@ -1178,7 +1647,7 @@ void State::_tileFlipVertically(int tileIndex)
 
 void State::tileRotate(int tileIndex)
 {
-    getUndoStack()->push(new RotateTileCommand(this, tileIndex));
+    pushUndoCommand(new RotateTileCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileRotate(int tileIndex)
@@ -1233,7 +1702,7 @@ void State::_tileRotate(int tileIndex)
 
 void State::tileShiftLeft(int tileIndex)
 {
-    getUndoStack()->push(new ShiftLeftTileCommand(this, tileIndex));
+    pushUndoCommand(new ShiftLeftTileCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileShiftLeft(int tileIndex)
@@ -1277,7 +1746,7 @@ void State::_tileShiftLeft(int tileIndex)
 
 void State::tileShiftRight(int tileIndex)
 {
-    getUndoStack()->push(new ShiftRightTileCommand(this, tileIndex));
+    pushUndoCommand(new ShiftRightTileCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileShiftRight(int tileIndex)
@@ -1321,7 +1790,7 @@ void State::_tileShiftRight(int tileIndex)
 
 void State::tileShiftUp(int tileIndex)
 {
-    getUndoStack()->push(new ShiftUpTileCommand(this, tileIndex));
+    pushUndoCommand(new ShiftUpTileCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileShiftUp(int tileIndex)
@@ -1355,7 +1824,7 @@ void State::_tileShiftUp(int tileIndex)
 
 void State::tileShiftDown(int tileIndex)
 {
-    getUndoStack()->push(new ShiftDownTileCommand(this, tileIndex));
+    pushUndoCommand(new ShiftDownTileCommand(this, tileIndex), _charsetBank);
 }
 
 void State::_tileShiftDown(int tileIndex)
@@ -1472,6 +1941,110 @@ void State::clearUndoStack()
     getUndoStack()->clear();
 }
 
+qint64 State::getUndoStackFootprint() const
+{
+    // kept up to date by the commands: walking the stack would be O(n) per edit
+    return _undoStackFootprint;
+}
+
+void State::setUndoMemoryLimit(qint64 bytes)
+{
+    _undoMemoryLimit = qMax((qint64)0, bytes);
+    checkUndoMemoryLimit();
+}
+
+qint64 State::getUndoMemoryLimit() const
+{
+    return _undoMemoryLimit;
+}
+
+void State::pushUndoCommand(QUndoCommand* command, int bank)
+{
+    _undoStack->push(new SharedUndoCommand(this, bank, QSharedPointer<QUndoCommand>(command)));
+    // right away: without an event loop, like in the cli, a queued check would never run
+    checkUndoMemoryLimit();
+}
+
+void State::runInCharsetBank(int bank, const std::function<void()>& function)
+{
+    Q_ASSERT(bank >= 0 && bank < getCharsetBankCount() && "Invalid bank");
+
+    if (bank == _charsetBank)
+    {
+        function();
+        return;
+    }
+
+    // the views only show the selected bank: the signals that describe
+    // the edit would refer to it. They only learn that the other bank changed
+    const int selected = _charsetBank;
+    const bool blocked = blockSignals(true);
+    _charsetBank = bank;
+    updateCharsetBankPointers();
+
+    function();
+
+    _charsetBank = selected;
+    updateCharsetBankPointers();
+    blockSignals(blocked);
+
+    _charsetBanks[bank].version = ++_lastCharsetBankVersion;
+    emit charsetBankUpdated(bank);
+}
+
+void State::checkUndoMemoryLimit()
+{
+    // only when the last command was just pushed: there is nothing to redo
+    const int count = _undoStack->count();
+    if (_undoMemoryLimit <= 0 || count == 0 || _undoStack->index() != count
+            || getUndoStackFootprint() <= _undoMemoryLimit)
+        return;
+
+    // the newest commands that fit in 3/4 of the limit, so that the next edits
+    // don't rebuild the stack again. The newest one is always kept
+    const qint64 target = _undoMemoryLimit / 4 * 3;
+    auto footprintAt = [&](int i) {
+        auto footprint = dynamic_cast<const UndoFootprint*>(_undoStack->command(i));
+        return footprint ? footprint->getByteFootprint() : 0;
+    };
+    int first = count - 1;
+    qint64 total = footprintAt(first);
+    while (first > 0 && total + footprintAt(first - 1) <= target)
+        total += footprintAt(--first);
+
+    if (first == 0)
+        return;
+
+    QVector<QPair<int, QSharedPointer<QUndoCommand>>> kept;
+    for (int i=first; i<count; ++i)
+    {
+        auto shared = dynamic_cast<const SharedUndoCommand*>(_undoStack->command(i));
+        Q_ASSERT(shared);
+        kept.append(qMakePair(shared->getCharsetBank(), shared->getCommand()));
+    }
+
+    // QUndoStack can't drop its oldest commands: rebuild it with the newest ones.
+    // They were already applied, so pushing them must not redo them
+    const int cleanIndex = _undoStack->cleanIndex();
+    if (cleanIndex < first)
+        _undoHistoryDiscarded = true;
+
+    _undoStack->clear();
+    for (int i=0; i<kept.size(); ++i)
+    {
+        if (first + i == cleanIndex)
+            _undoStack->setClean();
+        auto shared = new SharedUndoCommand(this, kept[i].first, kept[i].second, true);
+        _undoStack->push(shared);
+        shared->setMergeable(true);
+    }
+    if (cleanIndex == count)
+        _undoStack->setClean();
+
+    MessageSink::getInstance()->showMessage(tr("Oldest undo steps discarded: memory limit reached"));
+    emit contentsChanged();
+}
+
 //
 // Helpers
 // They must not emit signals
@@ -1497,14 +2070,9 @@ void State::setCharForTile(int tileIndex, int x, int y, const Char& chr)
 }
 
 
-BigCharWidget* State::getBigCharWidget() const
-{
-    return _bigCharWidget;
-}
-
 void State::setupDefaultMap()
 {
-    memset(_map, 0x20, _mapSize.width() * _mapSize.height());
+    _map.fill(0x20);
                           //1234567890123456789012345678901234567890
     const char hello64[] = "                                        " \
                            "    **** COMMODORE 64 BASIC V2 ****     " \
@@ -1527,6 +2095,7 @@ void State::setupDefaultMap()
     qsrand(QTime::currentTime().msec());
     int helloidx = qrand() % 2;
     // ASCII to PETSCII screen codes
-    for (int i=0; i<hellos[helloidx].helloSize; ++i)
-        _map[i] = hellos[helloidx].hello[i] & ~0x40;
+    const int width = _map.getSize().width();
+    for (int i=0; i<hellos[helloidx].helloSize && i<_map.getCellCount(); ++i)
+        _map.setCell(i % width, i / width, hellos[helloidx].hello[i] & ~0x40);
 }
@@ -16,16 +16,22 @@ limitations under the License.
 
 #pragma once
 
+#include <QByteArray>
 #include <QObject>
 #include <QString>
 #include <QSize>
 #include <QUndoStack>
 #include <QPoint>
+#include <QRect>
+#include <QVector>
 
+#include <functional>
 #include <string>
+#include <vector>
+#include "mapstorage.h"
 #include "stateimport.h"
 
-class BigCharWidget;
+class UndoDelta;
 
 class State : public QObject
 {
@@ -34,8 +40,6 @@ class State : public QObject
     friend class StateImport;
     friend class StateExport;
 
-    friend class BigCharWidget;
-
     friend class ImportVICEDialog;
 
     // yep, all the Commands are friend of State
@@ -64,18 +68,27 @@ class State : public QObject
     friend class ClearMapCommand;
     friend class PaintMapCommand;
     friend class FillMapCommand;
+    friend class SharedUndoCommand;
+    friend class SetCharsetBankCountCommand;
 
 public:
-    // only 256 chars at the time
+    // one charset bank: 256 chars, what the VIC-II can see at the time
     const static int CHAR_BUFFER_SIZE = 8 * 256;
 
     // char attributes: color (4-bit LSB)
     const static int TILE_COLORS_BUFFER_SIZE = 256;
 
+    // every charset the VIC-II can address: 4 VIC banks x 8 charsets
+    const static int MAX_CHARSET_BANKS = 32;
+
     // Max Tile size: 8x8
     const static int MAX_TILE_WIDTH = 8;
     const static int MAX_TILE_HEIGHT = 8;
 
+    // pre-decoded char: 8 scanlines of 8 RGB888 pixels
+    const static int CHAR_IMAGE_SCANLINE_SIZE = 8 * 3;
+    const static int CHAR_IMAGE_SIZE = 8 * CHAR_IMAGE_SCANLINE_SIZE;
+
     enum Pen {
         PEN_BACKGROUND,     /* $d021 */
         PEN_MULTICOLOR1,    /* $d022 */
@@ -85,6 +98,18 @@ public:
         PEN_MAX
     };
 
+    /**
+     * @brief The ResolvedPens struct the colors of the 4 pens of a tile,
+     * ready to be used by the renderers.
+     */
+    struct ResolvedPens {
+        // palette index, indexed by pen
+        quint8 colorIndices[PEN_MAX];
+        // RGB888, indexed by pen
+        quint8 rgb[PEN_MAX][3];
+        bool multicolor;
+    };
+
     enum ForegroundColorMode {
         FOREGROUND_COLOR_GLOBAL,
         FOREGROUND_COLOR_PER_TILE
@@ -145,10 +170,28 @@ public:
         BufferType type;
         /** tileProperties, only needed when type==TILES. */
         TileProperties tileProperties;
-        /** size of the buffer appended */
+        /** size of the buffer appended, in bytes. For MAP, one quint16 per cell */
         int bufferSize;
     };
 
+    /**
+     * @brief makeMapCell the map cells reference a tile of a charset bank:
+     * the bank in the high byte, and the tile in the low byte
+     */
+    static quint16 makeMapCell(int bank, int tileIndex) { return (quint16)((bank << 8) | (tileIndex & 0xff)); }
+    static int getBankFromMapCell(int cell) { return cell >> 8; }
+    static int getTileFromMapCell(int cell) { return cell & 0xff; }
+
+    /**
+     * @brief The MapRun struct a run of consecutive cells in the same map row
+     */
+    struct MapRun {
+        /** @brief offset of the first cell in the map: y * mapWidth + x */
+        int offset;
+        /** @brief number of cells in the run */
+        int length;
+    };
+
     /**
      * @brief State the Target constructor
      * @param filename the loaded name. Used when save/export is called
@@ -332,28 +375,59 @@ public:
     /**
      * @brief getTileIndexFromMap returns the tiled index at mapPosition.
      * @param mapPosition position in the map
-     * @return a tile index
+     * @return a tile index, in the bank returned by getCharsetBankFromMap()
      */
     int getTileIndexFromMap(const QPoint& mapCoord) const;
 
+    /**
+     * @brief getCharsetBankFromMap returns the charset bank of the tile at mapPosition
+     * @param mapPosition position in the map
+     * @return a bank. Could be bigger than the available banks if the banks were removed
+     */
+    int getCharsetBankFromMap(const QPoint& mapCoord) const;
+
+    /**
+     * @brief getMap returns the cells of the map, without clamping them to the available tiles
+     */
+    const MapStorage& getMap() const;
+
+    /**
+     * @brief getMapBytes returns the low 8 bits of each cell of the map, row by row.
+     * The format of the C64 screen RAM, used by the exporters
+     */
+    QByteArray getMapBytes() const;
+
+    /**
+     * @brief getMapCellBytes returns the 16-bit cells of the map, little endian, row by row.
+     * Each cell is bank * 256 + tile
+     */
+    QByteArray getMapCellBytes() const;
+
+    /**
+     * @brief getMapExportBytes returns the map as the exporters write it: getMapBytes() with
+     * one bank, getMapCellBytes() with more. The exported charset has every bank one after
+     * the other, so the 16-bit cells are the global tile index
+     */
+    QByteArray getMapExportBytes() const;
+
     /**
      * @brief mapFill fills a certain region of the map
      * @param coord coordinates of the map
-     * @param tileIdx the tile to use as filler
+     * @param tileIdx the tile of the selected bank to use as filler
      */
     void mapFill(const QPoint& coord, int tileIdx);
 
     /**
      * @brief mapPaint paints coord with a certain tile
      * @param coords the position of the map to paint
-     * @param tileIdx the tile to use to paint
+     * @param tileIdx the tile of the selected bank to use to paint
      * @param mergeable whether or not this paint can be merged with other mapPaint calls
      */
     void mapPaint(const QPoint& coord, int tileIdx, bool mergeable);
 
     /**
      * @brief mapPaint clears the map with a given tile
-     * @param tileIdx the tile that will be used to clear the map
+     * @param tileIdx the tile of the selected bank that will be used to clear the map
      */
     void mapClear(int tileIdx);
 
@@ -382,6 +456,22 @@ public:
      */
     void clearUndoStack();
 
+    /**
+     * @brief getUndoStackFootprint returns the memory used by the undo commands
+     * @return memory in bytes
+     */
+    qint64 getUndoStackFootprint() const;
+
+    /**
+     * @brief setUndoMemoryLimit caps the memory used by the undo commands.
+     * When the limit is reached the oldest undo commands are discarded, until the rest
+     * use 3/4 of the limit.
+     * The newest one is always kept, even if it is bigger than the limit.
+     * @param bytes limit in bytes. 0 means no limit
+     */
+    void setUndoMemoryLimit(qint64 bytes);
+    qint64 getUndoMemoryLimit() const;
+
     //
     // chars buffer manipulation
     //
@@ -397,12 +487,68 @@ public:
     //
     // charset, map, and related
     //
+
+    // charset and tile colors of the selected bank
     const quint8* getCharsetBuffer() const;
-    const quint8* getMapBuffer() const;
     const quint8* getTileColors() const;
 
     void resetCharsetBuffer();
 
+    /**
+     * @brief getCharsetBytes returns the charsets of all the banks, one after the other
+     */
+    QByteArray getCharsetBytes() const;
+
+    /**
+     * @brief getTileColorsBytes returns the tile colors of all the banks, one after the other
+     */
+    QByteArray getTileColorsBytes() const;
+
+    //
+    // charset banks
+    //
+
+    /**
+     * @brief setCharsetBankCount adds or removes banks at the end.
+     * New banks are empty. If the selected bank is removed, the last one is selected
+     * @param count between 1 and MAX_CHARSET_BANKS
+     */
+    void setCharsetBankCount(int count);
+    int getCharsetBankCount() const;
+
+    /**
+     * @brief setCharsetBank selects the bank that is edited.
+     * Every charset and tile operation works on the selected bank.
+     * The selection is view state: it is not an undo command and doesn't modify the document.
+     * emits charsetBankSelected(int);
+     * @param bank between 0 and getCharsetBankCount()-1
+     */
+    void setCharsetBank(int bank);
+    int getCharsetBank() const;
+
+    /**
+     * @brief getCharsetBankBuffer returns the charset of any bank
+     * @param bank between 0 and getCharsetBankCount()-1
+     * @return CHAR_BUFFER_SIZE bytes
+     */
+    const quint8* getCharsetBankBuffer(int bank) const;
+
+    /**
+     * @brief getCharsetBankTileColors returns the tile colors of any bank
+     * @param bank between 0 and getCharsetBankCount()-1
+     * @return TILE_COLORS_BUFFER_SIZE bytes
+     */
+    const quint8* getCharsetBankTileColors(int bank) const;
+
+    /**
+     * @brief getCharsetBankVersion returns a number that changes each time
+     * the charset or the tile colors of the bank change.
+     * Unique among all the banks, so consumers can upload only the banks
+     * whose version differs from the one they uploaded
+     * @param bank between 0 and getCharsetBankCount()-1
+     */
+    quint32 getCharsetBankVersion(int bank) const;
+
     /**
      * @brief paste paste previously copied range starting from charIndex
      * @param offset offset in bytes
@@ -438,10 +584,41 @@ public:
     int tileGetPen(int tileIndex, const QPoint& position);
 
     /**
-     * @brief getBigCharWidget returns the parent, the widget that owns the state
-     * @return BigCharWidget
+     * @brief getCharImage returns the char decoded as 8 scanlines of 8 RGB888 pixels.
+     * The char is decoded only if it was modified since the last call.
+     * @param charIndex Value between 0 and 255
+     * @return CHAR_IMAGE_SIZE bytes, compatible with QImage::Format_RGB888 scanlines
+     */
+    const quint8* getCharImage(int charIndex);
+
+    /**
+     * @brief getCharImage same, for a char of any bank.
+     * Only the chars of the selected bank are cached: the chars of the other banks
+     * are decoded in each call, and are valid until the next call
+     * @param bank between 0 and getCharsetBankCount()-1
+     * @param charIndex Value between 0 and 255
+     */
+    const quint8* getCharImage(int bank, int charIndex);
+
+    /**
+     * @brief invalidateCharImages marks all the cached char images as dirty.
+     * Only needed when the charset or colors are modified without emitting signals
      */
-    BigCharWidget* getBigCharWidget() const;
+    void invalidateCharImages();
+
+    /**
+     * @brief getResolvedPens returns the colors of the pens for a tile.
+     * Takes into account the foreground color mode and the multicolor mode.
+     * The table is recomputed only after the colors or the palette change
+     * @param tileIndex Value between 0 and 255
+     */
+    const ResolvedPens& getResolvedPens(int tileIndex);
+
+    /**
+     * @brief invalidateResolvedPens marks the resolved pens as dirty.
+     * Only needed when the colors or the palette are modified without emitting signals
+     */
+    void invalidateResolvedPens();
 
     /**
      * @brief getTileIndex returns the current tile index
@@ -466,8 +643,8 @@ signals:
     // when the map sizes changes
     void mapSizeUpdated();
 
-    // when the map content is updated
-    void mapContentUpdated();
+    // when the map content is updated. rect: the updated cells, in map coordinates
+    void mapContentUpdated(const QRect& rect);
 
     // when a range of bytes in the charset changes (e.g. due to a paste)
     void bytesUpdated(int pos, int count);
@@ -478,6 +655,15 @@ signals:
     // when the charbuffer was updated. Probably due to a copy & paste operation
     void charsetUpdated();
 
+    // when banks are added or removed
+    void charsetBankCountUpdated(int count);
+
+    // when another bank is selected. charsetUpdated() is emitted as well
+    void charsetBankSelected(int bank);
+
+    // when undo or redo changes the charset or the tile colors of a bank that is not selected
+    void charsetBankUpdated(int bank);
+
     // a color new color for a pen was selected
     void colorPropertiesUpdated(int);
 
@@ -516,13 +702,37 @@ public slots:
     void setTileIndex(int tileIndex);
 
 
-protected:    
+protected:
+    struct CharsetBank {
+        quint8 charset[State::CHAR_BUFFER_SIZE];
+        quint8 tileColors[State::TILE_COLORS_BUFFER_SIZE];
+        // see getCharsetBankVersion()
+        quint32 version;
+    };
+
     Char getCharFromTile(int tileIndex, int x, int y) const;
     void setCharForTile(int tileIndex, int x, int y, const Char& chr);
 
     void setupDefaultMap();
 
-    void floodFillImpl(const QPoint& coord, int targetTile, int newTile);
+    void floodFillImpl(const QPoint& coord, int targetTile, int newTile, QRect* updatedRect, QVector<MapRun>* runs);
+
+    // char image cache invalidation. Connected to our own signals
+    void invalidateCharImagesForBytes(int pos, int count);
+    void invalidateCharImagesForTile(int tileIndex);
+    void decodeCharImage(int charIndex);
+    void resolvePens();
+    void resolveTilePens(int tileIdx, const quint8* tileColors, const quint8 rgb[16][3], ResolvedPens* resolved) const;
+
+    // the charset or the tile colors of the selected bank changed. Connected to our own signals
+    void touchCharsetBank();
+    void touchAllCharsetBanks();
+    // resizes the banks, selects the first one and clears the charsets. Used by the importers
+    void resetCharsetBanks(int count);
+    // new banks are empty. Doesn't emit signals
+    void resizeCharsetBanks(int count);
+    // _charset and _tileColors point to the selected bank
+    void updateCharsetBankPointers();
 
     void _setCharIndex(int charIndex);
     void _setTileIndex(int tileIndex);
@@ -548,20 +758,40 @@ protected:
     void _setColorForPen(int pen, int color, int tileIdx);
     void _setTileProperties(const TileProperties& properties);
     void _setExportProperties(const ExportProperties &properties);
+    void _setCharsetBank(int bank);
+    // restoredBanks: contents of the added banks, instead of empty ones. Used by undo
+    void _setCharsetBankCount(int count, const std::vector<CharsetBank>* restoredBanks=nullptr);
+
+    void _applyCharsetDelta(const UndoDelta& charsetDelta, const UndoDelta& colorsDelta);
+    void _applyMapChanges(const MapStorage::Changes& changes, bool undo);
+
+    // pushes command to the undo stack, shared so that checkUndoMemoryLimit() can keep it.
+    // bank: the bank whose charset or tile colors the command edits. -1 if it edits none
+    void pushUndoCommand(QUndoCommand* command, int bank=-1);
+    // runs function editing bank, without selecting it
+    void runInCharsetBank(int bank, const std::function<void()>& function);
+    void checkUndoMemoryLimit();
 
     void _setMapSize(const QSize& mapSize);
-    void _setMap(const quint8* buffer, const QSize& mapSize);
+    void _setMap(const MapStorage& map);
     void _mapClear(int tileIdx);
     void _mapPaint(const QPoint& coord, int tileIdx);
-    void _mapFill(const QPoint& coord, int tileIdx);
+    void _mapFill(const QPoint& coord, int tileIdx, QVector<MapRun>* runs=nullptr);
+    void _mapFillRuns(const QVector<MapRun>& runs, int tileIdx);
 
 
     int _totalChars;
 
-    quint8 _charset[State::CHAR_BUFFER_SIZE];
-    quint8 _tileColors[State::TILE_COLORS_BUFFER_SIZE];
-    quint8* _map;
-    QSize _mapSize;
+    std::vector<CharsetBank> _charsetBanks;
+    int _charsetBank;
+    quint32 _lastCharsetBankVersion;
+
+    // charset and tile colors of the selected bank: they point to _charsetBanks[_charsetBank].
+    // Updated each time the banks are selected or resized
+    quint8* _charset;
+    quint8* _tileColors;
+
+    MapStorage _map;
 
     bool _multicolorMode;
     ForegroundColorMode _foregroundColorMode;
@@ -596,6 +826,24 @@ protected:
 
     QUndoStack* _undoStack;
 
-    BigCharWidget* _bigCharWidget;          // weak ref to parent
+    qint64 _undoMemoryLimit;
+    // sum of the footprints of the commands in the undo stack. Updated by SharedUndoCommand
+    qint64 _undoStackFootprint;
+    // undo history was discarded: the state is modified even if the undo stack is clean
+    bool _undoHistoryDiscarded;
+
+    // flood fill work stack. Reused between fills
+    std::vector<QPoint> _floodFillStack;
+
+    // For gain speed, each char of the selected bank is decoded once and kept
+    // in RGB888 format until the charset or the colors change
+    quint8 _charImages[256][CHAR_IMAGE_SIZE];
+    bool _charImagesDirty[256];
+    // chars of the other banks are decoded here
+    quint8 _otherBankCharImage[CHAR_IMAGE_SIZE];
+
+    // colors of the pens of each tile. All of them are resolved at once
+    ResolvedPens _resolvedPens[256];
+    bool _resolvedPensDirty;
 };
 
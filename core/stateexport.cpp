@@ -16,7 +16,7 @@ limitations under the License.
 
 #include "stateexport.h"
 
-#include <QApplication>
+#include <QCoreApplication>
 #include <QByteArray>
 #include <QDebug>
 #include <QTextStream>
@@ -32,15 +32,16 @@ qint64 StateExport::saveVChar64(State* state, QFile& file)
 
     memcpy(header.id, "VChar", 5);
 
-    header.version = 3;
+    // version 4 only when the map needs 16-bit cells or there are many banks,
+    // so older versions can still open the rest
+    const bool wideMap = state->getMap().getMaxCell() > 0xff;
+    const int banks = state->getCharsetBankCount();
+    header.version = (wideMap || banks > 1) ? 4 : 3;
 
     for (int i=0;i<4;i++)
         header.colors[i] = state->_penColors[i];
 
-    short chars = State::CHAR_BUFFER_SIZE / 8;
-
-    chars = qToLittleEndian(chars);
-    header.num_chars = chars;
+    header.num_chars = qToLittleEndian((quint16)(banks * State::CHAR_BUFFER_SIZE / 8));
 
     auto properties = state->getTileProperties();
     header.tile_width = properties.size.width();
@@ -64,20 +65,21 @@ qint64 StateExport::saveVChar64(State* state, QFile& file)
     QByteArray arrayHeader((const char*)&header, sizeof(header));
     auto total = file.write(arrayHeader);
 
-    // charset
-    auto buffer = state->getCharsetBuffer();
-    QByteArray arrayCharset((char*)buffer, State::CHAR_BUFFER_SIZE);
-    total += file.write(arrayCharset);
+    // charset: all the banks
+    total += file.write(state->getCharsetBytes());
 
     // colors
-    buffer = state->getTileColors();
-    QByteArray arrayColors((char*)buffer, State::TILE_COLORS_BUFFER_SIZE);
-    total += file.write(arrayColors);
+    total += file.write(state->getTileColorsBytes());
 
     // map
-    buffer = state->getMapBuffer();
-    QByteArray arrayMap((char*)buffer, state->getMapSize().width() * state->getMapSize().height());
-    total += file.write(arrayMap);
+    if (wideMap)
+    {
+        total += file.write(state->getMapCellBytes());
+    }
+    else
+    {
+        total += file.write(state->getMapBytes());
+    }
 
     file.flush();
 
@@ -134,7 +136,7 @@ qint64 StateExport::saveAsm(const QString& filename, const void* buffer, int buf
     const unsigned char* charBuffer = (const unsigned char*) buffer;
 
     QTextStream out(&file);
-    out << "; Exported using VChar64 v" << QApplication::applicationVersion() << "\n";
+    out << "; Exported using VChar64 v" << QCoreApplication::applicationVersion() << "\n";
     out << "; Total bytes: " << bufferSize << "\n";
     out << label << ":\n";
     for (int i=0; i<bufferSize;)
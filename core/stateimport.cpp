@@ -18,11 +18,13 @@ limitations under the License.
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <vector>
 
 #include <QDebug>
 #include <QtEndian>
 
-#include "mainwindow.h"
+#include "messagesink.h"
 #include "state.h"
 
 qint64 StateImport::loadRaw(State* state, QFile& file)
@@ -30,14 +32,15 @@ qint64 StateImport::loadRaw(State* state, QFile& file)
     auto size = file.size() - file.pos();
     if (size % 8 !=0)
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("Warning: file is not multiple of 8. Characters might be incomplete"));
+        MessageSink::getInstance()->showMessage(QObject::tr("Warning: file is not multiple of 8. Characters might be incomplete"));
         qDebug() << "File size not multiple of 8 (" << size << "). Characters might be incomplete";
     }
 
     int toRead = std::min((int)size, State::CHAR_BUFFER_SIZE);
 
-    // clean previous memory in case not all the chars are loaded
-    state->resetCharsetBuffer();
+    // clean previous memory in case not all the chars are loaded.
+    // Raw files have a single bank
+    state->resetCharsetBanks(1);
 
     auto total = file.read((char*)state->_charset, toRead);
 
@@ -50,7 +53,7 @@ qint64 StateImport::loadPRG(State *state, QFile& file, quint16* outAddress)
 {
     auto size = file.size();
     if (size < 10) { // 2 + 8 (at least one char)
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("Error: File size too small"));
+        MessageSink::getInstance()->showMessage(QObject::tr("Error: File size too small"));
         qDebug() << "Error: File Size too small.";
         return -1;
     }
@@ -71,7 +74,7 @@ qint64 StateImport::loadCTM4(State *state, QFile& file, struct CTMHeader4* v4hea
     // only expanded files are supported
     if (!v4header->expanded)
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("CTM is not expanded"));
+        MessageSink::getInstance()->showMessage(QObject::tr("CTM is not expanded"));
         qDebug() << "CTM is not expanded. Cannot load it";
         return -1;
     }
@@ -84,12 +87,8 @@ qint64 StateImport::loadCTM4(State *state, QFile& file, struct CTMHeader4* v4hea
     int num_chars = qFromLittleEndian(v4header->num_chars) + 1;
     int num_tiles = v4header->num_tiles + 1;
     QSize map_size = QSize(qFromLittleEndian(v4header->map_width), qFromLittleEndian(v4header->map_height));
-    int toRead = std::min(num_chars * 8, State::CHAR_BUFFER_SIZE);
-
-    // clean previous memory in case not all the chars are loaded
-    state->resetCharsetBuffer();
 
-    auto total = file.read((char*)state->_charset, toRead);
+    auto total = readCharsetBanks(state, file, num_chars);
 
     for (int i=0; i<4; i++)
         state->_setColorForPen(i, v4header->colors[i], -1);
@@ -131,14 +130,14 @@ qint64 StateImport::loadCTM4(State *state, QFile& file, struct CTMHeader4* v4hea
         file.seek(file.pos() + num_tiles * v4header->tile_width * v4header->tile_height);
 
         /* read tile attribs */
-        total += file.read((char*)state->_tileColors, num_tiles);
+        total += readTileColors(state, file, num_tiles, 256 / qMax(1, v4header->tile_width * v4header->tile_height));
     }
     else if (v4header->color_mode == 2)
     {
         /* char attribs */
 
         /* skip char attribs */
-        total += file.read((char*)state->_tileColors, num_chars);
+        total += readTileColors(state, file, num_chars, 256);
 
         /* skip cell attribs */
         file.seek(file.pos() + num_tiles * v4header->tile_width * v4header->tile_height);
@@ -148,7 +147,10 @@ qint64 StateImport::loadCTM4(State *state, QFile& file, struct CTMHeader4* v4hea
 
     int mapInBytes = map_size.width() * map_size.height();
     // read map
-    total += file.read((char*)state->_map, mapInBytes);
+    std::vector<quint8> map(mapInBytes);
+    total += file.read((char*)map.data(), mapInBytes);
+    std::vector<quint16> tiles(map.begin(), map.end());
+    setCTMMap(state, tiles);
 
     return total;
 }
@@ -159,7 +161,7 @@ qint64 StateImport::loadCTM5(State *state, QFile& file, struct CTMHeader5* v5hea
     // flags that we don't want: flags & 0b11 = 0b01
     if ((v5header->flags & 0b00000011) == 0b00000001)
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("CTM is not expanded"));
+        MessageSink::getInstance()->showMessage(QObject::tr("CTM is not expanded"));
         qDebug() << "CTM is not expanded. Cannot load it";
         return -1;
     }
@@ -167,12 +169,8 @@ qint64 StateImport::loadCTM5(State *state, QFile& file, struct CTMHeader5* v5hea
     int num_chars = qFromLittleEndian(v5header->num_chars) + 1;
     int num_tiles = qFromLittleEndian(v5header->num_tiles) + 1;
     QSize map_size = QSize(qFromLittleEndian(v5header->map_width), qFromLittleEndian(v5header->map_height));
-    int toRead = std::min(num_chars * 8, State::CHAR_BUFFER_SIZE);
 
-    // clean previous memory in case not all the chars are loaded
-    state->resetCharsetBuffer();
-
-    auto total = file.read((char*)state->_charset, toRead);
+    auto total = readCharsetBanks(state, file, num_chars);
 
     for (int i=0; i<4; i++)
         state->_setColorForPen(i, v5header->colors[i], -1);
@@ -195,33 +193,31 @@ qint64 StateImport::loadCTM5(State *state, QFile& file, struct CTMHeader5* v5hea
     if (v5header->color_mode == 2)
     {
         // place char attribs in tile colors
-        file.read((char*)state->_tileColors, num_chars);
+        readTileColors(state, file, num_chars, 256);
         // clean the upper nibble
-        for (int i=0; i<num_chars; ++i)
-            state->_tileColors[i] &= 0x0f;
+        for (int bank=0; bank<state->getCharsetBankCount(); ++bank)
+            for (auto& color : state->_charsetBanks[bank].tileColors)
+                color &= 0x0f;
     }
     else
     {
         file.seek(file.pos() + num_chars);
 
         if (v5header->color_mode == 1)
-            file.read((char*)state->_tileColors, num_tiles);
+            readTileColors(state, file, num_tiles, 256 / (tp.size.width() * tp.size.height()));
         /* else, don't read in global mode */
 
     }
 
     // since it is expanded, there are no tile_data
 
-    int mapInBytes = map_size.width() * map_size.height();
-    quint16* tmpBuffer = (quint16*) malloc(mapInBytes * 2);
-    // read map
-    file.read((char*)tmpBuffer, mapInBytes * 2);
-    for (int i=0; i<mapInBytes; i++)
-    {
-        // FIXME: what happens with tiles bigger than 255?
-        state->_map[i] = tmpBuffer[i] & 0xff;
-    }
-    free(tmpBuffer);
+    // 16-bit tile codes
+    int mapCells = map_size.width() * map_size.height();
+    std::vector<quint16> map(mapCells);
+    file.read((char*)map.data(), mapCells * 2);
+    for (auto& cell : map)
+        cell = qFromLittleEndian(cell);
+    setCTMMap(state, map);
 
     return total;
 }
@@ -232,7 +228,7 @@ qint64 StateImport::loadCTM(State *state, QFile& file)
     auto size = file.size();
     if ((std::size_t)size<sizeof(header))
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("CTM file too small"));
+        MessageSink::getInstance()->showMessage(QObject::tr("CTM file too small"));
         qDebug() << "Error. File size too small to be CTM (" << size << ").";
         return -1;
     }
@@ -244,7 +240,7 @@ qint64 StateImport::loadCTM(State *state, QFile& file)
     // check header
     if (header.id[0] != 'C' || header.id[1] != 'T' || header.id[2] != 'M')
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("Invalid CTM file"));
+        MessageSink::getInstance()->showMessage(QObject::tr("Invalid CTM file"));
         qDebug() << "Not a valid CTM file";
         return -1;
     }
@@ -256,7 +252,7 @@ qint64 StateImport::loadCTM(State *state, QFile& file)
         return loadCTM5(state, file, &header);
     }
 
-    MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("CTM version not supported"));
+    MessageSink::getInstance()->showMessage(QObject::tr("CTM version not supported"));
     qDebug() << "Invalid CTM version: " << header.version;
     return -1;
 }
@@ -267,7 +263,7 @@ qint64 StateImport::loadVChar64(State *state, QFile& file)
     auto size = file.size();
     if ((std::size_t)size<sizeof(header))
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("Invalid VChar file"));
+        MessageSink::getInstance()->showMessage(QObject::tr("Invalid VChar file"));
         qDebug() << "Error. File size too small to be VChar64 (" << size << ").";
         return -1;
     }
@@ -279,27 +275,22 @@ qint64 StateImport::loadVChar64(State *state, QFile& file)
     // check header
     if (memcmp(header.id, "VChar", 5) != 0)
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("Invalid VChar file"));
+        MessageSink::getInstance()->showMessage(QObject::tr("Invalid VChar file"));
         qDebug() << "Not a valid VChar64 file";
         return -1;
     }
 
-    if (header.version > 3)
+    if (header.version > 4)
     {
-        MainWindow::getInstance()->showMessageOnStatusBar(QObject::tr("VChar version not supported"));
+        MessageSink::getInstance()->showMessage(QObject::tr("VChar version not supported"));
         qDebug() << "VChar version not supported";
         return -1;
     }
 
-    // common for version 1, 2 and 3
-
-    int num_chars = qFromLittleEndian((int)header.num_chars);
-    int toRead = std::min(num_chars * 8, State::CHAR_BUFFER_SIZE);
+    // common for version 1, 2, 3 and 4
 
-    // clean previous memory in case not all the chars are loaded
-    state->resetCharsetBuffer();
-
-    auto total = file.read((char*)state->_charset, toRead);
+    int num_chars = qFromLittleEndian(header.num_chars);
+    auto total = readCharsetBanks(state, file, num_chars);
 
     for (int i=0; i<4; i++)
         state->_setColorForPen(i, header.colors[i], -1);
@@ -310,8 +301,8 @@ qint64 StateImport::loadVChar64(State *state, QFile& file)
     properties.interleaved = header.char_interleaved;
     state->_setTileProperties(properties);
 
-    // version 2 and 3 only
-    if (header.version == 2 || header.version == 3)
+    // version 2, 3 and 4 only
+    if (header.version >= 2)
     {
         int color_mode = header.color_mode;
         state->_setForegroundColorMode((State::ForegroundColorMode)color_mode);
@@ -320,12 +311,29 @@ qint64 StateImport::loadVChar64(State *state, QFile& file)
         int map_height = qFromLittleEndian((int)header.map_height);
         state->_setMapSize(QSize(map_width, map_height));
 
-        file.read((char*)state->_tileColors, State::TILE_COLORS_BUFFER_SIZE);
-        file.read((char*)state->_map, map_width * map_height);
+        // 256 per bank, even if the bank is not full
+        readTileColors(state, file, state->getCharsetBankCount() * State::TILE_COLORS_BUFFER_SIZE, State::TILE_COLORS_BUFFER_SIZE);
+
+        const int mapCells = map_width * map_height;
+        if (header.version == 4)
+        {
+            // 16-bit cells, little endian. Already in bank/tile format
+            std::vector<quint16> map(mapCells);
+            file.read((char*)map.data(), mapCells * 2);
+            for (auto& cell : map)
+                cell = qFromLittleEndian(cell);
+            state->_map.copyFrom(map.data());
+        }
+        else
+        {
+            std::vector<quint8> map(mapCells);
+            file.read((char*)map.data(), mapCells);
+            state->_map.copyFrom(map.data());
+        }
     }
 
-    // version 3 only
-    if (header.version == 3)
+    // version 3 and 4 only
+    if (header.version >= 3)
     {
         quint16 charset_addr = qFromLittleEndian(header.address_charset);
         quint16 map_addr = qFromLittleEndian(header.address_map);
@@ -341,6 +349,57 @@ qint64 StateImport::loadVChar64(State *state, QFile& file)
     return total;
 }
 
+qint64 StateImport::readCharsetBanks(State* state, QFile& file, int numChars)
+{
+    const int banks = qBound(1, (numChars + 255) / 256, State::MAX_CHARSET_BANKS);
+    if (numChars > banks * 256)
+    {
+        MessageSink::getInstance()->showMessage(QObject::tr("Warning: too many chars. Only %1 were loaded").arg(banks * 256));
+        qDebug() << "Too many chars:" << numChars << ". Only" << banks * 256 << "were loaded";
+    }
+
+    // clean previous memory in case not all the chars are loaded
+    state->resetCharsetBanks(banks);
+
+    qint64 total = 0;
+    for (int bank=0; bank<banks; ++bank)
+    {
+        const int toRead = qBound(0, (numChars - bank * 256) * 8, State::CHAR_BUFFER_SIZE);
+        total += file.read((char*)state->_charsetBanks[bank].charset, toRead);
+    }
+
+    // skip the chars that didn't fit, so the data that follows can be read
+    if (numChars > banks * 256)
+        file.seek(file.pos() + (numChars - banks * 256) * 8);
+
+    return total;
+}
+
+qint64 StateImport::readTileColors(State* state, QFile& file, int count, int perBank)
+{
+    std::vector<quint8> colors(count);
+    auto total = file.read((char*)colors.data(), count);
+
+    for (int i=0; i<total; ++i)
+    {
+        const int bank = i / perBank;
+        if (bank >= state->getCharsetBankCount())
+            break;
+        state->_charsetBanks[bank].tileColors[i % perBank] = colors[i];
+    }
+    return total;
+}
+
+void StateImport::setCTMMap(State* state, std::vector<quint16>& tiles)
+{
+    const auto tileSize = state->getTileProperties().size;
+    const int tilesPerBank = 256 / qMax(1, tileSize.width() * tileSize.height());
+
+    for (auto& tile : tiles)
+        tile = State::makeMapCell(tile / tilesPerBank, tile % tilesPerBank);
+    state->_map.copyFrom(tiles.data());
+}
+
 qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* outCharsetAddress,
                                       quint16* outScreenRAMAddress, quint8* outColorRAMBuf, quint8* outVICRegistersBuf)
 {
@@ -357,7 +416,7 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
     static const char VICE_VICII[] = "VIC-II";
     static const char VICE_CIA2[] = "CIA2";
 
-    auto mainwindow = MainWindow::getInstance();
+    auto sink = MessageSink::getInstance();
 
     if (!file.isOpen())
         file.open(QIODevice::ReadOnly);
@@ -365,7 +424,7 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
     auto size = file.size();
     if (size < (qint64)sizeof(VICESnapshotHeader))
     {
-        mainwindow->showMessageOnStatusBar(QObject::tr("Error: VICE file too small"));
+        sink->showMessage(QObject::tr("Error: VICE file too small"));
         return -1;
     }
 
@@ -377,13 +436,13 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
     size = file.read((char*)&header, sizeof(header));
     if (size != sizeof(header))
     {
-        mainwindow->showMessageOnStatusBar(QObject::tr("Error: VICE header too small"));
+        sink->showMessage(QObject::tr("Error: VICE header too small"));
         return -1;
     }
 
     if (memcmp(header.id, VICE_HEADER_MAGIC, sizeof(header.id)) != 0)
     {
-        mainwindow->showMessageOnStatusBar(QObject::tr("Error: Invalid VICE header Id"));
+        sink->showMessage(QObject::tr("Error: Invalid VICE header Id"));
         return -1;
     }
 
@@ -399,7 +458,7 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
     size = file.read((char*)&version, sizeof(version));
     if (size != sizeof(version))
     {
-        mainwindow->showMessageOnStatusBar(QObject::tr("Error: VICE header too small"));
+        sink->showMessage(QObject::tr("Error: VICE header too small"));
         return -1;
     }
 
@@ -472,7 +531,7 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
             size = file.read((char*)&c64mem, sizeof(c64mem));
             if (size != sizeof(c64mem))
             {
-                mainwindow->showMessageOnStatusBar(QObject::tr("Error: Invalid VICE C64MEM segment"));
+                sink->showMessage(QObject::tr("Error: Invalid VICE C64MEM segment"));
                 return -1;
             }
             memcpy(buffer64k, c64mem.ram, sizeof(c64mem.ram));
@@ -484,7 +543,7 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
             size = file.read((char*)&c128mem, sizeof(c128mem));
             if (size != sizeof(c128mem))
             {
-                mainwindow->showMessageOnStatusBar(QObject::tr("Error: Invalid VICE C128MEM segment"));
+                sink->showMessage(QObject::tr("Error: Invalid VICE C128MEM segment"));
                 return -1;
             }
             // FIXME: copy only first 64k
@@ -498,7 +557,7 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
         size = file.read((char*)&cia2, sizeof(cia2));
         if (size != sizeof(cia2))
         {
-            mainwindow->showMessageOnStatusBar(QObject::tr("Error: Invalid VICE CIA2 segment"));
+            sink->showMessage(QObject::tr("Error: Invalid VICE CIA2 segment"));
             return -1;
         }
         int bank_addr = (3 - (cia2.ora & 0x03)) * 16384;    // $dd00
@@ -508,7 +567,7 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
         size = file.read((char*)&vic2, sizeof(vic2));
         if (size != sizeof(vic2))
         {
-            mainwindow->showMessageOnStatusBar(QObject::tr("Error: Invalid VICE VIC-II segment"));
+            sink->showMessage(QObject::tr("Error: Invalid VICE VIC-II segment"));
             return -1;
         }
 
@@ -535,9 +594,47 @@ qint64 StateImport::parseVICESnapshot(QFile& file, quint8* buffer64k, quint16* o
     }
     else
     {
-        mainwindow->showMessageOnStatusBar(QObject::tr("Error: VICE C64MEM/C128MEM segment not found"));
+        sink->showMessage(QObject::tr("Error: VICE C64MEM/C128MEM segment not found"));
         return -1;
     }
 
     return 0;
 }
+
+qint64 StateImport::loadVICESnapshot(State* state, QFile& file)
+{
+    auto memoryRAM = (quint8*)malloc(64*1024);
+    quint8 colorRAM[1024];
+    quint8 VICRegisters[64];
+    quint16 charsetAddress, screenRAMAddress;
+
+    auto ret = parseVICESnapshot(file, memoryRAM, &charsetAddress, &screenRAMAddress, colorRAM, VICRegisters);
+    if (ret < 0)
+    {
+        free(memoryRAM);
+        return -1;
+    }
+
+    state->resetCharsetBanks(1);
+    memcpy(state->_charset, &memoryRAM[charsetAddress], State::CHAR_BUFFER_SIZE);
+
+    state->_setMapSize(QSize(40, 25));
+    state->_map.copyFrom(&memoryRAM[screenRAMAddress]);
+
+    // colors d021, d022, d023
+    state->_penColors[0] = VICRegisters[0x21] & 0xf;
+    state->_penColors[1] = VICRegisters[0x22] & 0xf;
+    state->_penColors[2] = VICRegisters[0x23] & 0xf;
+
+    // guess the tile colors from the Color RAM
+    memset(state->_tileColors, 11, State::TILE_COLORS_BUFFER_SIZE);
+    for (int i=40*25-1; i>=0; --i)
+        state->_tileColors[memoryRAM[screenRAMAddress + i]] = colorRAM[i] & 0xf;
+    state->_setForegroundColorMode(State::FOREGROUND_COLOR_PER_TILE);
+
+    // d016 contains multicolor bit
+    state->_setMulticolorMode((VICRegisters[0x16] >> 4) & 0x1);
+
+    free(memoryRAM);
+    return State::CHAR_BUFFER_SIZE + 40*25;
+}
@@ -16,6 +16,8 @@ limitations under the License.
 
 #pragma once
 
+#include <vector>
+
 #include <QFile>
 
 class State;
@@ -72,6 +74,16 @@ public:
      */
     static qint64 parseVICESnapshot(QFile& file, quint8* buffer64k, quint16 *outCharsetAddress, quint16 *outScreenRAMAddress, quint8 *outColorRAMBuf, quint8 *outVICRegistersBuf);
 
+    /**
+     * @brief loadVICESnapshot loads a VICE snapshot file using the same defaults as the
+     * "Import VICE" dialog: the charset and Screen RAM that the VIC-II was using, the tile colors
+     * guessed from the Color RAM, and the background/multicolor colors from the VIC-II registers
+     * @param state State. Its map will be resized to 40x25
+     * @param file file to load
+     * @return number of bytes loaded, or -1 on error
+     */
+    static qint64 loadVICESnapshot(State* state, QFile& file);
+
     //
     // From CharPad documentation
     //
@@ -310,11 +322,11 @@ public:
     struct VChar64Header
     {
         char id[5];                 // must be VChar
-        char version;               // must be 3
+        char version;               // 3, or 4 when the map has cells bigger than 255 or there are many charset banks
         char colors[4];             // BGR, MC1, MC2, RAM.
         char vic_res;               // 0 = Hi Resolution, 1 = Multicolour.
 
-        quint16 num_chars;          // 16-bits, Number of chars - 1 (low, high).
+        quint16 num_chars;          // 16-bits, Number of chars: 256 per charset bank (low, high).
 
         quint8 tile_width;          // between 1-8
         quint8 tile_height;         // between 1-8
@@ -336,9 +348,10 @@ public:
         char reserved[3];           // Must be 32 bytes in total
 
         // after the header comes:
-        //  - charset[256 * 8]
-        //  - tile_colors[256]
-        //  - map_data[map_width * map_height bytes]
+        //  - charset[num_chars * 8]: the banks one after the other
+        //  - tile_colors[num_chars]: 256 per bank
+        //  - map_data[map_width * map_height bytes]. Version 4: 16-bit little endian cells,
+        //    with the bank in the high byte
     };
 #pragma pack(pop)
     static_assert (sizeof(VChar64Header) == 32, "Size is not correct");
@@ -449,6 +462,13 @@ protected:
     static qint64 loadCTM4(State *state, QFile& file, struct CTMHeader4* v5header);
     static qint64 loadCTM5(State *state, QFile& file, struct CTMHeader5* v5header);
 
+    // reads the chars in as many banks as needed. Chars beyond MAX_CHARSET_BANKS are skipped
+    static qint64 readCharsetBanks(State* state, QFile& file, int numChars);
+    // reads count colors: the first perBank go to the first bank, and so on
+    static qint64 readTileColors(State* state, QFile& file, int count, int perBank);
+    // CTM tiles are numbered across all the banks: converts them to bank/tile cells
+    static void setCTMMap(State* state, std::vector<quint16>& tiles);
+
 };
 
 
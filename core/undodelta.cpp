@@ -0,0 +1,145 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#include "undodelta.h"
+
+// unmodified bytes shorter than this are stored inside the range,
+// since a new range header costs about the same
+static const int MIN_GAP = 4;
+
+static void appendVarint(QByteArray* data, int value)
+{
+    Q_ASSERT(value >= 0 && "Invalid value");
+
+    // 7 bits per byte, MSB set when more bytes follow
+    while (value >= 0x80)
+    {
+        data->append((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    data->append((char)value);
+}
+
+static int readVarint(const quint8** ptr)
+{
+    int value = 0;
+    int shift = 0;
+    quint8 byte;
+    do {
+        byte = *(*ptr)++;
+        value |= (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+UndoDelta::UndoDelta()
+    : _size(0)
+    , _firstModified(-1)
+    , _lastModified(-1)
+{
+}
+
+void UndoDelta::encode(const quint8* before, const quint8* after, int size)
+{
+    clear();
+    _size = size;
+
+    int pos = 0;
+    int prevEnd = 0;
+    while (pos < size)
+    {
+        // skip unmodified bytes
+        while (pos < size && before[pos] == after[pos])
+            ++pos;
+        if (pos == size)
+            break;
+
+        // extend the range until a long enough unmodified gap is found
+        const int start = pos;
+        int end = ++pos;
+        while (pos < size && pos - end < MIN_GAP)
+        {
+            if (before[pos] != after[pos])
+                end = pos + 1;
+            ++pos;
+        }
+
+        appendVarint(&_data, start - prevEnd);
+        appendVarint(&_data, end - start);
+        for (int i=start; i<end; ++i)
+            _data.append((char)(before[i] ^ after[i]));
+
+        if (_firstModified == -1)
+            _firstModified = start;
+        _lastModified = end - 1;
+
+        prevEnd = end;
+        pos = end;
+    }
+
+    _data.squeeze();
+}
+
+void UndoDelta::apply(quint8* buffer, int size) const
+{
+    Q_ASSERT(size == _size && "Invalid buffer size");
+    Q_UNUSED(size);
+
+    auto ptr = (const quint8*)_data.constData();
+    const auto end = ptr + _data.size();
+    int offset = 0;
+
+    while (ptr < end)
+    {
+        offset += readVarint(&ptr);
+        const int length = readVarint(&ptr);
+
+        for (int i=0; i<length; ++i)
+            buffer[offset + i] ^= ptr[i];
+
+        ptr += length;
+        offset += length;
+    }
+}
+
+bool UndoDelta::isEmpty() const
+{
+    return _data.isEmpty();
+}
+
+int UndoDelta::getFirstModified() const
+{
+    return _firstModified;
+}
+
+int UndoDelta::getLastModified() const
+{
+    return _lastModified;
+}
+
+int UndoDelta::getByteFootprint() const
+{
+    return sizeof(*this) + _data.capacity();
+}
+
+void UndoDelta::clear()
+{
+    _data.clear();
+    _size = 0;
+    _firstModified = -1;
+    _lastModified = -1;
+}
@@ -0,0 +1,91 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+/**
+ * @brief The UndoDelta class stores the difference between two versions of a buffer.
+ * Only the modified ranges are stored, XOR-ed, without any further compression:
+ * each range is [skip][length][length XOR-ed bytes], with skip and length as varints.
+ * Unmodified gaps shorter than a range header are kept inside the range.
+ * Since it is a XOR, applying it once goes from "before" to "after", and
+ * applying it again goes back from "after" to "before".
+ */
+class UndoDelta
+{
+public:
+    UndoDelta();
+
+    /**
+     * @brief encode stores the difference between before and after
+     * @param before buffer before the modification
+     * @param after buffer after the modification
+     * @param size size of both buffers in bytes
+     */
+    void encode(const quint8* before, const quint8* after, int size);
+
+    /**
+     * @brief apply XORs the stored difference into buffer
+     * @param buffer buffer to modify. Must be of the same size as the encoded one
+     * @param size size of buffer in bytes
+     */
+    void apply(quint8* buffer, int size) const;
+
+    /**
+     * @brief isEmpty whether or not both buffers were equal
+     */
+    bool isEmpty() const;
+
+    /**
+     * @brief getFirstModified offset of the first modified byte, or -1
+     */
+    int getFirstModified() const;
+
+    /**
+     * @brief getLastModified offset of the last modified byte, or -1
+     */
+    int getLastModified() const;
+
+    /**
+     * @brief getByteFootprint memory used by the delta, in bytes
+     */
+    int getByteFootprint() const;
+
+    /**
+     * @brief clear releases the stored difference
+     */
+    void clear();
+
+protected:
+    QByteArray _data;
+    int _size;
+    int _firstModified;
+    int _lastModified;
+};
+
+/**
+ * @brief The UndoFootprint class is implemented by the undo commands
+ * that keep buffers, to report how much memory they use
+ */
+class UndoFootprint
+{
+public:
+    virtual ~UndoFootprint() {}
+    virtual int getByteFootprint() const = 0;
+};
@@ -200,7 +200,15 @@ static void senddata(void)
 
 uint16_t proto_hello(struct vchar64d_proto_hello* data)
 {
+    struct {
+        struct vchar64d_proto_header hdr;
+        struct vchar64d_proto_hello payload;
+    } response;
+
 //    printf("hello: %d\n", len);
+    response.hdr.type = TYPE_HELLO;
+    response.payload.version = PROTO_VERSION;
+    buf_append(&buf, (char*)&response, sizeof(response));
     return sizeof(*data);
 }
 
@@ -224,6 +232,38 @@ uint16_t proto_set_mem(struct vchar64d_proto_set_mem* data)
     return sizeof(*data) + data->count - sizeof(data->data);
 }
 
+uint16_t proto_set_mem_rle(struct vchar64d_proto_set_mem_rle* data)
+{
+    uint8_t* dst;
+    uint8_t* src;
+    uint8_t* end;
+    uint8_t n;
+
+    dst = (uint8_t*)data->addr;
+    src = (uint8_t*)&data->data;
+    end = src + data->count;
+    while (src < end)
+    {
+        n = *src++;
+        if (n & 0x80)
+        {
+            // run
+            n = (n & 0x7f) + 2;
+            memset(dst, *src++, n);
+        }
+        else
+        {
+            // literals
+            ++n;
+            memcpy(dst, src, n);
+            src += n;
+        }
+        dst += n;
+    }
+    // don't include the pointer
+    return sizeof(*data) + data->count - sizeof(data->data);
+}
+
 uint16_t proto_set_byte(struct vchar64d_proto_set_byte* data)
 {
     // data->idx: is already in little endian
@@ -254,7 +294,7 @@ uint16_t proto_ping(struct vchar64d_proto_ping* data)
     } response;
 
     response.hdr.type = TYPE_PONG;
-    response.payload.something = data->something;
+    response.payload.sequence = data->sequence;
     buf_append(&buf, (char*)&response, sizeof(response));
     return sizeof(*data);
 }
@@ -275,55 +315,159 @@ uint16_t proto_close(void)
     return 10000;
 }
 
+/*---------------------------------------------------------------------------*/
+// uIP delivers the stream in segments, and the host's TCP stack doesn't cut
+// them at command boundaries. A command split between two segments is kept
+// here until the rest arrives
+static uint8_t carry[VCHAR64_SERVER_BUFFER_SIZE];
+static uint16_t carrylen;
+
+// size of the command, header included. 0 if len is not enough for it
+static uint16_t command_size(const uint8_t* data, uint16_t len)
+{
+    uint16_t size;
+
+    switch (data[0]) {
+        case TYPE_SET_BYTE_FOR_CHAR:
+            size = 1 + sizeof(struct vchar64d_proto_set_byte);
+            break;
+        case TYPE_SET_CHAR:
+            size = 1 + sizeof(struct vchar64d_proto_set_char);
+            break;
+        case TYPE_SET_CHARS:
+            // idx + count
+            if (len < 3)
+                return 0;
+            size = 3 + data[2] * 8;
+            break;
+        case TYPE_HELLO:
+            size = 1 + sizeof(struct vchar64d_proto_hello);
+            break;
+        case TYPE_POKE:
+            size = 1 + sizeof(struct vchar64d_proto_poke);
+            break;
+        case TYPE_FILL:
+            size = 1 + sizeof(struct vchar64d_proto_fill);
+            break;
+        case TYPE_SET_MEM:
+        case TYPE_SET_MEM_RLE:
+            // addr + count, little endian
+            if (len < 5)
+                return 0;
+            size = 5 + (data[3] | (data[4] << 8));
+            break;
+        case TYPE_PING:
+            size = 1 + sizeof(struct vchar64d_proto_ping);
+            break;
+        default:
+            // TYPE_BYEBYE and the invalid ones: just the header
+            size = 1;
+            break;
+    }
+    return (size <= len) ? size : 0;
+}
+
+// returns 0 if the rest of the data must be discarded
+static uint8_t process_command(uint8_t* data)
+{
+    void* payload = &data[1];
+
+    switch (data[0]) {
+            // charset related
+        case TYPE_SET_BYTE_FOR_CHAR:
+            proto_set_byte(payload);
+            break;
+        case TYPE_SET_CHAR:
+            proto_set_char(payload);
+            break;
+        case TYPE_SET_CHARS:
+            proto_set_chars(payload);
+            break;
+            // generic
+        case TYPE_HELLO:
+            proto_hello(payload);
+            break;
+        case TYPE_POKE:
+            proto_poke(payload);
+            break;
+        case TYPE_FILL:
+            proto_fill(payload);
+            break;
+        case TYPE_SET_MEM:
+            proto_set_mem(payload);
+            break;
+        case TYPE_SET_MEM_RLE:
+            proto_set_mem_rle(payload);
+            break;
+        case TYPE_PING:
+            proto_ping(payload);
+            break;
+        case TYPE_BYEBYE:
+            proto_close();
+            return 0;
+        default:
+            __asm__("inc $d020");
+            return 0;
+    }
+    return 1;
+}
+
 static void newdata(void)
 {
-    uint16_t len, count;
-    struct vchar64d_proto_header* header;
-    void* payload;
+    uint16_t len, count, copylen, size;
+    uint8_t* data;
 
-    count = 0;
+    data = (uint8_t*)uip_appdata;
     len = uip_datalen();
+    count = 0;
+
+    // first, complete the command that the previous segment left
+    if (carrylen > 0)
+    {
+        copylen = MIN(len, sizeof(carry) - carrylen);
+        memcpy(&carry[carrylen], data, copylen);
+
+        size = command_size(carry, carrylen + copylen);
+        if (size == 0)
+        {
+            if (carrylen + copylen == sizeof(carry))
+            {
+                // can't happen with a valid client
+                __asm__("inc $d020");
+                carrylen = 0;
+            }
+            else
+            {
+                carrylen += copylen;
+            }
+            return;
+        }
+
+        count = size - carrylen;
+        carrylen = 0;
+        if (!process_command(carry))
+            return;
+    }
 
     while (count < len)
     {
-        header = &((struct vchar64d_proto_header*)uip_appdata)[count];
-        payload = &((uint8_t*)uip_appdata)[++count];
-
-        switch (header->type) {
-                // charset related
-            case TYPE_SET_BYTE_FOR_CHAR:
-                count += proto_set_byte(payload);
-                break;
-            case TYPE_SET_CHAR:
-                count += proto_set_char(payload);
-                break;
-            case TYPE_SET_CHARS:
-                count += proto_set_chars(payload);
-                break;
-                // generic
-            case TYPE_HELLO:
-                count += proto_hello(payload);
-                break;
-            case TYPE_POKE:
-                count += proto_poke(payload);
-                break;
-            case TYPE_FILL:
-                count += proto_fill(payload);
-                break;
-            case TYPE_SET_MEM:
-                count += proto_set_mem(payload);
-                break;
-            case TYPE_PING:
-                count += proto_ping(payload);
-                break;
-            case TYPE_BYEBYE:
-                count += proto_close();
-                break;
-            default:
+        size = command_size(&data[count], len - count);
+        if (size == 0)
+        {
+            // valid commands fit in the buffer
+            if (len - count > sizeof(carry))
+            {
                 __asm__("inc $d020");
-                count = len;
-                break;
+                return;
+            }
+            carrylen = len - count;
+            memcpy(carry, &data[count], carrylen);
+            return;
         }
+
+        if (!process_command(&data[count]))
+            return;
+        count += size;
     }
 }
 
@@ -332,6 +476,7 @@ void vchar64d_appcall(void *ts)
     if(uip_connected()) {
         if(s.state == STATE_CLOSED) {
             buf_init(&buf);
+            carrylen = 0;
             s.state = STATE_CONNECTED;
             ts = (char *)0;
         } else {
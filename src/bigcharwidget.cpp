@@ -40,7 +40,6 @@ BigCharWidget::BigCharWidget(State* state, QWidget *parent)
     , _commandMergeable(false)
 {
     Q_ASSERT(state && "Invalid State");
-    _state->_bigCharWidget = this;
 
     setFocusPolicy(Qt::StrongFocus);
 
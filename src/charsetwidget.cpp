@@ -44,12 +44,17 @@ CharsetWidget::CharsetWidget(QWidget *parent)
     , _sizeHint({0,0})
     , _zoomLevel(ZOOM_LEVEL)
     , _displayGrid(false)
+    , _charsetImage(COLUMNS * 8, ROWS * 8, QImage::Format_RGB888)
+    , _gridLayerZoomLevel(0)
 {
     _sizeHint = {(COLUMNS * 8 + OFFSET) * ZOOM_LEVEL + 1,
                  (ROWS * 8 + OFFSET) * ZOOM_LEVEL + 1};
     setMinimumSize(_sizeHint);
 
     setMouseTracking(true);
+
+    for (auto& dirty : _charsetImageDirty)
+        dirty = true;
 }
 
 void CharsetWidget::updateCharIndex(int charIndex)
@@ -231,31 +236,26 @@ void CharsetWidget::paintEvent(QPaintEvent *event)
     painter.setBrush(QColor(0,0,0));
     painter.setPen(Qt::NoPen);
 
-    for (int w=0; w<COLUMNS; w++) {
-        for (int h=0; h<ROWS; h++) {
-
-            int index = w + h * COLUMNS;
-
-            utilsDrawCharInPainter(state, &painter, QSizeF(1,1), QPoint(OFFSET, OFFSET), QPoint(w, h), index);
-        }
-    }
+    // one blit for the exposed part of the charset. Scaled without filtering,
+    // so each C64 pixel is still a zoomLevel x zoomLevel square
+    updateCharsetImage(state);
+    QRectF exposed(event->rect().x() / _zoomLevel - OFFSET, event->rect().y() / _zoomLevel - OFFSET,
+                   event->rect().width() / _zoomLevel, event->rect().height() / _zoomLevel);
+    QRect source = exposed.toAlignedRect().intersected(_charsetImage.rect());
+    if (!source.isEmpty())
+        painter.drawImage(QRectF(source).translated(OFFSET, OFFSET), _charsetImage, source);
 
     if (_displayGrid)
     {
-        auto pen = painter.pen();
-        pen.setColor(Preferences::getInstance().getGridColor());
-        pen.setStyle(Qt::DashLine);
-        pen.setWidthF(1.0 / _zoomLevel);
-        painter.setPen(pen);
-
-
-        for (int y=0; y <= ROWS; ++y)
-            painter.drawLine(QPointF(0 + OFFSET, y * 8 + OFFSET),
-                             QPointF(COLUMNS * 8 + OFFSET, y * 8 + OFFSET));
-
-        for (int x=0; x <= COLUMNS; ++x)
-            painter.drawLine(QPointF(x * 8 + OFFSET, OFFSET),
-                             QPointF(x * 8 + OFFSET, ROWS * 8 + OFFSET));
+        updateGridLayer();
+
+        // the layer is in device pixels
+        const int ratio = devicePixelRatio();
+        painter.save();
+        painter.resetTransform();
+        painter.drawPixmap(event->rect().topLeft(), _gridLayer,
+                           QRect(event->rect().topLeft() * ratio, event->rect().size() * ratio));
+        painter.restore();
     }
 
     QPen pen;
@@ -299,6 +299,81 @@ QSize CharsetWidget::sizeHint() const
 //
 // Helpers
 //
+void CharsetWidget::updateCharsetImage(State* state)
+{
+    for (int charIndex=0; charIndex<256; ++charIndex)
+    {
+        if (_charsetImageDirty[charIndex])
+        {
+            QPoint offset((charIndex % COLUMNS) * 8, (charIndex / COLUMNS) * 8);
+            utilsDrawCharInImage(state, &_charsetImage, offset, charIndex);
+            _charsetImageDirty[charIndex] = false;
+        }
+    }
+}
+
+void CharsetWidget::updateGridLayer()
+{
+    const auto gridColor = Preferences::getInstance().getGridColor();
+    const int ratio = devicePixelRatio();
+
+    if (!_gridLayer.isNull()
+            && _gridLayer.size() == size() * ratio
+            && _gridLayerColor == gridColor
+            && _gridLayerZoomLevel == _zoomLevel)
+        return;
+
+    _gridLayer = QPixmap(size() * ratio);
+    _gridLayer.setDevicePixelRatio(ratio);
+    _gridLayer.fill(Qt::transparent);
+    _gridLayerColor = gridColor;
+    _gridLayerZoomLevel = _zoomLevel;
+
+    QPainter painter(&_gridLayer);
+    painter.scale(_zoomLevel, _zoomLevel);
+
+    QPen pen;
+    pen.setColor(gridColor);
+    pen.setStyle(Qt::DashLine);
+    pen.setWidthF(1.0 / _zoomLevel);
+    painter.setPen(pen);
+
+    for (int y=0; y <= ROWS; ++y)
+        painter.drawLine(QPointF(0 + OFFSET, y * 8 + OFFSET),
+                         QPointF(COLUMNS * 8 + OFFSET, y * 8 + OFFSET));
+
+    for (int x=0; x <= COLUMNS; ++x)
+        painter.drawLine(QPointF(x * 8 + OFFSET, OFFSET),
+                         QPointF(x * 8 + OFFSET, ROWS * 8 + OFFSET));
+}
+
+QRect CharsetWidget::charRect(int charIndex) const
+{
+    QRectF rect(((charIndex % COLUMNS) * 8 + OFFSET) * _zoomLevel,
+                ((charIndex / COLUMNS) * 8 + OFFSET) * _zoomLevel,
+                8 * _zoomLevel,
+                8 * _zoomLevel);
+
+    // include the cursor / grid lines that might overlap the char
+    return rect.toAlignedRect().adjusted(-2, -2, 2, 2);
+}
+
+void CharsetWidget::invalidateChar(int charIndex)
+{
+    if (charIndex < 0 || charIndex >= 256)
+        return;
+
+    _charsetImageDirty[charIndex] = true;
+    update(charRect(charIndex));
+}
+
+void CharsetWidget::invalidateAllChars()
+{
+    for (auto& dirty : _charsetImageDirty)
+        dirty = true;
+    update();
+}
+
 void CharsetWidget::paintFocus(QPainter &painter)
 {
     if (hasFocus())
@@ -344,24 +419,46 @@ void CharsetWidget::onCharIndexUpdated(int charIndex)
 void CharsetWidget::onMulticolorModeToggled(bool state)
 {
     Q_UNUSED(state);
-    update();
+    invalidateAllChars();
 }
 
 void CharsetWidget::onColorPropertiesUpdated(int pen)
 {
     Q_UNUSED(pen);
-    update();
+    invalidateAllChars();
 }
 
 void CharsetWidget::onTileUpdated(int tileIndex)
 {
-    Q_UNUSED(tileIndex);
-    update();
+    auto state = MainWindow::getCurrentState();
+    if (!state)
+        return;
+
+    auto properties = state->getTileProperties();
+    const int charsPerTile = properties.size.width() * properties.size.height();
+    int charIndex = state->getCharIndexFromTileIndex(tileIndex);
+
+    for (int i=0; i<charsPerTile; ++i)
+    {
+        invalidateChar(charIndex);
+        charIndex += properties.interleaved;
+    }
 }
 
 void CharsetWidget::onCharsetUpdated()
 {
-    update();
+    invalidateAllChars();
+}
+
+void CharsetWidget::onBytesUpdated(int pos, int count)
+{
+    if (count <= 0)
+        return;
+
+    const int first = pos / 8;
+    const int last = (pos + count - 1) / 8;
+    for (int charIndex=first; charIndex<=last; ++charIndex)
+        invalidateChar(charIndex);
 }
 
 //
@@ -16,6 +16,9 @@ limitations under the License.
 
 #pragma once
 
+#include <QColor>
+#include <QImage>
+#include <QPixmap>
 #include <QWidget>
 
 #include "state.h"
@@ -41,6 +44,7 @@ public slots:
     void onColorPropertiesUpdated(int pen);
     void onTileUpdated(int tileIndex);
     void onCharsetUpdated();
+    void onBytesUpdated(int pos, int count);
     void enableGrid(bool enabled);
     void setZoomLevel(int zoomLevel);
 
@@ -53,6 +57,11 @@ protected:
 
     void updateCharIndex(int charIndex);
     void paintFocus(QPainter &painter);
+    void updateCharsetImage(State* state);
+    void updateGridLayer();
+    void invalidateChar(int charIndex);
+    void invalidateAllChars();
+    QRect charRect(int charIndex) const;
 
     QPoint _cursorPos;
     bool _selecting;
@@ -61,5 +70,15 @@ protected:
     QSize _sizeHint;
     float _zoomLevel;
     bool _displayGrid;
+
+    // the whole charset is composed in one image, and only the
+    // modified chars are composed again
+    QImage _charsetImage;
+    bool _charsetImageDirty[256];
+
+    // grid is pre-rendered in its own layer, at device resolution
+    QPixmap _gridLayer;
+    QColor _gridLayerColor;
+    float _gridLayerZoomLevel;
 };
 
@@ -0,0 +1,92 @@
+#
+# The VChar64 editor: main window, widgets and dialogs.
+# Everything but main.cpp, so that other targets (eg: bench) can link it.
+#
+
+QT += core gui network widgets concurrent
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/aboutdialog.cpp \
+    $$PWD/autoupdater.cpp \
+    $$PWD/bigcharwidget.cpp \
+    $$PWD/charsetwidget.cpp \
+    $$PWD/colorrectwidget.cpp \
+    $$PWD/exportdialog.cpp \
+    $$PWD/fileutils.cpp \
+    $$PWD/importkoalabitmapwidget.cpp \
+    $$PWD/importkoalacharsetwidget.cpp \
+    $$PWD/importkoaladialog.cpp \
+    $$PWD/importvicecharsetwidget.cpp \
+    $$PWD/importvicedialog.cpp \
+    $$PWD/importvicescreenramwidget.cpp \
+    $$PWD/mainwindow.cpp \
+    $$PWD/mappropertiesdialog.cpp \
+    $$PWD/mapwidget.cpp \
+    $$PWD/palettewidget.cpp \
+    $$PWD/preferences.cpp \
+    $$PWD/preferencesdialog.cpp \
+    $$PWD/previewtarget.cpp \
+    $$PWD/selectcolordialog.cpp \
+    $$PWD/serverconnectdialog.cpp \
+    $$PWD/serverpreview.cpp \
+    $$PWD/tilepropertiesdialog.cpp \
+    $$PWD/tilesetwidget.cpp \
+    $$PWD/updatedialog.cpp \
+    $$PWD/utils.cpp \
+    $$PWD/vchar64application.cpp \
+    $$PWD/vicepreview.cpp \
+    $$PWD/xlinkpreview.cpp
+
+HEADERS  += \
+    $$PWD/aboutdialog.h \
+    $$PWD/autoupdater.h \
+    $$PWD/bigcharwidget.h \
+    $$PWD/charsetwidget.h \
+    $$PWD/colorrectwidget.h \
+    $$PWD/exportdialog.h \
+    $$PWD/fileutils.h \
+    $$PWD/importkoalabitmapwidget.h \
+    $$PWD/importkoalacharsetwidget.h \
+    $$PWD/importkoaladialog.h \
+    $$PWD/importvicecharsetwidget.h \
+    $$PWD/importvicedialog.h \
+    $$PWD/importvicescreenramwidget.h \
+    $$PWD/koalacell.h \
+    $$PWD/mainwindow.h \
+    $$PWD/mappropertiesdialog.h \
+    $$PWD/mapwidget.h \
+    $$PWD/palettewidget.h \
+    $$PWD/preferences.h \
+    $$PWD/preferencesdialog.h \
+    $$PWD/previewtarget.h \
+    $$PWD/selectcolordialog.h \
+    $$PWD/serverconnectdialog.h \
+    $$PWD/serverpreview.h \
+    $$PWD/serverprotocol.h \
+    $$PWD/tilepropertiesdialog.h \
+    $$PWD/tilesetwidget.h \
+    $$PWD/updatedialog.h \
+    $$PWD/utils.h \
+    $$PWD/vchar64application.h \
+    $$PWD/vicemonitorprotocol.h \
+    $$PWD/vicepreview.h \
+    $$PWD/xlinkpreview.h
+
+FORMS    += \
+    $$PWD/aboutdialog.ui \
+    $$PWD/exportdialog.ui \
+    $$PWD/importkoaladialog.ui \
+    $$PWD/importvicedialog.ui \
+    $$PWD/mainwindow.ui \
+    $$PWD/mappropertiesdialog.ui \
+    $$PWD/preferencesdialog.ui \
+    $$PWD/selectcolordialog.ui \
+    $$PWD/serverconnectdialog.ui \
+    $$PWD/tilepropertiesdialog.ui \
+    $$PWD/updatedialog.ui
+
+RESOURCES += \
+    $$PWD/resources.qrc
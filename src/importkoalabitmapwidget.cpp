@@ -24,6 +24,7 @@ limitations under the License.
 #include <QPaintEvent>
 #include <QPainter>
 
+#include "chardecoder.h"
 #include "mainwindow.h"
 #include "palette.h"
 #include "state.h"
@@ -260,41 +261,33 @@ void ImportKoalaBitmapWidget::resetColors()
 
 void ImportKoalaBitmapWidget::findUniqueCells()
 {
-    static const char hex[] = "0123456789ABCDEF";
-
     auto region = getSelectedRegion();
 
     for (int y=region.y(); y < region.y() + region.height(); ++y)
     {
         for (int x=region.x(); x < region.x() + region.width(); ++x)
         {
-            // 8 * 4
-            char key[33];
-            key[32] = 0;
+            // 8 * 4 pixels, 4 bits each: pixel i*4+j goes to nibble i*4+j
+            quint64 words[2] = {0, 0};
 
             for (int i=0; i<8; ++i)
             {
+                const quint8* scanline = &_framebuffer[(y * 8 + i) * 160 + x * 4];
                 for (int j=0; j<4; ++j)
                 {
-                    quint8 colorIndex = _framebuffer[(y * 8 + i) * 160 + (x * 4 + j)];
+                    quint8 colorIndex = scanline[j];
                     Q_ASSERT(colorIndex<16 && "Invalid color");
-                    key[i*4+j] = hex[colorIndex];
+                    const int nibble = i * 4 + j;
+                    words[nibble / 16] |= (quint64)colorIndex << ((nibble % 16) * 4);
                     _colorsUsed[colorIndex].first++;
                 }
             }
-            std::string skey(key);
-            Q_ASSERT(skey.size() == 8*4 && "Invalid Key");
 
-            if (_uniqueCells.find(skey) == _uniqueCells.end())
-            {
-                std::vector<std::pair<int,int>> v;
-                v.emplace_back(x,y);
-                _uniqueCells[skey] = v;
-            }
-            else
-            {
-                _uniqueCells[skey].push_back(std::make_pair(x,y));
-            }
+            KoalaCell key;
+            key.lo = words[0];
+            key.hi = words[1];
+
+            _uniqueCells[key].emplace_back(x,y);
         }
     }
 
@@ -311,50 +304,29 @@ void ImportKoalaBitmapWidget::toFrameBuffer()
         // 40 cols
         for (int x=0; x<COLUMNS; ++x)
         {
+            const int cell = y * COLUMNS + x;
+
+            // pen -> color
+            const quint8 colorIndices[] = {
+                // bitmask 00: background ($d021)
+                (quint8)(_koala.backgroundColor & 0x0f),
+                // bitmask 01: #4-7 screen ram
+                (quint8)(_koala.screenRAM[cell] >> 4),
+                // bitmask 10: #0-3 screen ram
+                (quint8)(_koala.screenRAM[cell] & 0xf),
+                // bitmask 11: color ram
+                (quint8)(_koala.colorRAM[cell] & 0xf)
+            };
+
             // 8 pixels Y
             for (int i=0; i<8; ++i)
             {
-                quint8 byte = _koala.bitmap[(y * COLUMNS + x) * 8 + i];
+                const quint8* pens = CharDecoder::decodeMulticolorByte(_koala.bitmap[cell * 8 + i]);
+                quint8* dst = &_framebuffer[(y * 8 + i) * 160 + x * 4];
 
-                static const quint8 masks[] = {192, 48, 12, 3};
                 // 4 wide-pixels X
                 for (int j=0; j<4; ++j)
-                {
-                    quint8 colorIndex = 0;
-                    // get the two bits that reprent the color
-                    quint8 color = byte & masks[j];
-                    color >>= 6-j*2;
-
-                    switch (color)
-                    {
-                    // bitmask 00: background ($d021)
-                    case 0x0:
-                        colorIndex = _koala.backgroundColor & 0x0f;
-                        break;
-
-                    // bitmask 01: #4-7 screen ram
-                    case 0x1:
-                        colorIndex = _koala.screenRAM[y * COLUMNS + x] >> 4;
-                        break;
-
-                    // bitmask 10: #0-3 screen ram
-                    case 0x2:
-                        colorIndex = _koala.screenRAM[y * COLUMNS + x] & 0xf;
-                        break;
-
-                    // bitmask 11: color ram
-                    case 0x3:
-                        colorIndex = _koala.colorRAM[y * COLUMNS + x] & 0xf;
-                        break;
-                    default:
-                        qDebug() << "ImportKoalaWidget::paintEvent Invalid color: " << color << " at x,y=" << x << y;
-                        break;
-                    }
-
-                    Q_ASSERT(colorIndex<16 && "Invalid colorIndex");
-
-                    _framebuffer[(y * 8 + i) * 160 + (x * 4 + j)] = colorIndex;
-                }
+                    dst[j] = colorIndices[pens[j]];
             }
         }
     }
@@ -372,17 +344,11 @@ void ImportKoalaBitmapWidget::reportResults()
     for (auto& _uniqueCell : _uniqueCells)
     {
         bool keyIsValid = true;
-        auto key = _uniqueCell.first;
-        // key is 4 * 32 bytes long. Each element of
-        // the key, is a pixel
-        for (char i : key)
+        const auto& key = _uniqueCell.first;
+        // 32 pixels per key
+        for (int i=0; i<32 && keyIsValid; ++i)
         {
-            // convert Hex to int
-            char c = i - '0';
-            if (c > 9)
-                c -= 7;         // 'A' - '9'
-
-            int color = c;
+            int color = key.getColor(i % 4, i / 4);
 
             // determine whether or not the char can be drawn with current selected colors
 
@@ -390,11 +356,8 @@ void ImportKoalaBitmapWidget::reportResults()
             if (std::find(std::begin(_d02xColors), std::end(_d02xColors), color) != std::end(_d02xColors))
                 continue;
 
-            if (c<8)
-            {
+            if (color<8)
                 keyIsValid = false;
-                break;
-            }
         }
 
         if (keyIsValid)
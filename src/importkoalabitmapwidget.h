@@ -21,6 +21,7 @@ limitations under the License.
 #include <QWidget>
 #include <QRect>
 
+#include "koalacell.h"
 #include "state.h"
 
 class ImportKoalaBitmapWidget : public QWidget
@@ -71,9 +72,9 @@ protected:
     // Bits 0-3 contains the C64 colors
     quint8 _framebuffer[160 * 200];
 
-    // key: color sequence
+    // key: the cell colors
     // data: positions in screen ram
-    std::unordered_map<std::string, std::vector<std::pair<int,int>>> _uniqueCells;
+    std::unordered_map<KoalaCell, std::vector<std::pair<int,int>>, KoalaCellHash> _uniqueCells;
 
     // first: count, second: color index
     std::vector<std::pair<int,int>> _colorsUsed;
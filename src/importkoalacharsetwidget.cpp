@@ -23,6 +23,7 @@ limitations under the License.
 #include <QPaintEvent>
 #include <QPainter>
 
+#include "chardecoder.h"
 #include "mainwindow.h"
 #include "palette.h"
 #include "state.h"
@@ -92,46 +93,18 @@ void ImportKoalaCharsetWidget::paintEvent(QPaintEvent *event)
         for (int x=0; x<40; ++x)
         {
             auto c = _screenRAM[y * 40 + x];
-            auto chardef = &_charset[c * 8];
+
+            // pens: $d021, $d022, $d023, color RAM
+            const int colorIndices[] = { _d02x[0], _d02x[1], _d02x[2], _colorRAMForChars[c] - 8 };
+
+            quint8 pens[64];
+            CharDecoder::decodeChar(&_charset[c * 8], true, pens);
 
             for (int i=0; i<8; ++i)
             {
-                static const quint8 masks[] = {192, 48, 12, 3};
-                auto byte = chardef[i];
-
                 for (int j=0; j<4; ++j)
                 {
-                    quint8 colorIndex = 0;
-                    // get the two bits that reprent the color
-                    quint8 color = byte & masks[j];
-                    color >>= 6-j*2;
-
-                    switch (color)
-                    {
-                    // bitmask 00: background ($d021)
-                    case 0x0:
-                        colorIndex = _d02x[0];
-                        break;
-
-                    // bitmask 01: multicolor #1 ($d022)
-                    case 0x1:
-                        colorIndex = _d02x[1];
-                        break;
-
-                    // bitmask 10: multicolor #2 ($d023)
-                    case 0x2:
-                        colorIndex = _d02x[2];
-                        break;
-
-                    // bitmask 11: color RAM
-                    case 0x3:
-                        colorIndex = _colorRAMForChars[c] -8 ;
-                        break;
-                    default:
-                        qDebug() << "ImportKoalaWidget::paintEvent Invalid color: " << color << " at x,y=" << x << y;
-                        break;
-                    }
-                    painter.setBrush(Palette::getColor(colorIndex));
+                    painter.setBrush(Palette::getColor(colorIndices[pens[i * 8 + j * 2]]));
                     painter.drawRect( (x*8 + j*2) * PIXEL_SIZE + OFFSET,
                                      (y*8 + i) * PIXEL_SIZE + OFFSET,
                                      PIXEL_SIZE * 2,
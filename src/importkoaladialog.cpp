@@ -17,26 +17,19 @@ limitations under the License.
 #include "importkoaladialog.h"
 #include "ui_importkoaladialog.h"
 
+#include <algorithm>
 #include <string>
 
 #include <QDebug>
 #include <QFileDialog>
 #include <QMouseEvent>
+#include <QtConcurrent>
 
 #include "mainwindow.h"
 #include "palette.h"
 #include "preferences.h"
 #include "selectcolordialog.h"
 
-static const char* _hex ="0123456789ABCDEF";
-static quint8 dehexify(char h)
-{
-    h -= '0';
-    if (h>9)
-        h -= 7;
-    return h;
-}
-
 ImportKoalaDialog::ImportKoalaDialog(QWidget *parent)
     : QDialog(parent)
     , ui(new Ui::ImportKoalaDialog)
@@ -117,40 +110,40 @@ void ImportKoalaDialog::validateKoalaFile(const QString& filepath)
     }
 }
 
-int ImportKoalaDialog::findColorRAM(const std::vector<std::pair<int,int>>& usedColors, int* outHiColor)
+int ImportKoalaDialog::findColorRAM(const ConvertContext& context, const std::vector<std::pair<int,int>>& usedColors, int* outHiColor) const
 {
     int cacheColor = -1;
     for (int i=0; i<16; i++)
     {
         auto color = usedColors[i].second;
         if (usedColors[i].first > 0 &&
-                color != ui->widgetKoala->_d02xColors[0] &&
-                color != ui->widgetKoala->_d02xColors[1] &&
-                color != ui->widgetKoala->_d02xColors[2])
+                color != context.d02xColors[0] &&
+                color != context.d02xColors[1] &&
+                color != context.d02xColors[2])
         {
             // valid both for "low" and "any"
             if (color < 8)
                 return color;
 
             // only for "any"
-            if (ui->radioForegroundMostUsed->isChecked() || cacheColor == -1)
+            if (context.foregroundMostUsed || cacheColor == -1)
             {
                 std::vector<int> colorsToFind;
                 for (int i=0; i<8; i++)
                 {
-                    if (i != ui->widgetKoala->_d02xColors[0] &&
-                        i != ui->widgetKoala->_d02xColors[1] &&
-                        i != ui->widgetKoala->_d02xColors[2])
+                    if (i != context.d02xColors[0] &&
+                        i != context.d02xColors[1] &&
+                        i != context.d02xColors[2])
                         colorsToFind.push_back(i);
                 }
 
-                if (ui->radioButtonLuminance->isChecked())
+                if (context.luminanceProximity)
                     cacheColor = getColorByLuminanceProximity(color, colorsToFind);
                 else
                     cacheColor = getColorByPaletteProximity(color, colorsToFind);
 
                 // inform which is the Hi Color used to create the Color Ram
-                if (ui->radioForegroundMostUsed->isChecked())
+                if (context.foregroundMostUsed)
                 {
                     *outHiColor = cacheColor;
                     return *outHiColor;
@@ -168,15 +161,14 @@ int ImportKoalaDialog::findColorRAM(const std::vector<std::pair<int,int>>& usedC
 }
 
 
-static int getValueFromKey(int x, int y, const char* key)
+static int getValueFromKey(int x, int y, const KoalaCell& key)
 {
     if (x<0 || x>=4 || y<0 || y>=8)
         return -1;
-    int c = dehexify(key[y*4+x]);
-    return c;
+    return key.getColor(x, y);
 }
 
-bool ImportKoalaDialog::tryChangeKey(int x, int y, char* key, quint8 mask, int hiColorRAM)
+bool ImportKoalaDialog::tryChangeKey(const ConvertContext& context, int x, int y, KoalaCell* key, quint8 mask, int colorRAM, int hiColorRAM) const
 {
     static const int masks[8][2] = {
         {-1, 1},   // top-left
@@ -191,17 +183,17 @@ bool ImportKoalaDialog::tryChangeKey(int x, int y, char* key, quint8 mask, int h
     const int totalMasks = sizeof(masks) / sizeof(masks[0]);
 
     // find invalid colors
-    int colorIndex = getValueFromKey(x, y, key);
-    if (colorIndex != _colorRAM &&
-            colorIndex != ui->widgetKoala->_d02xColors[0] &&
-            colorIndex != ui->widgetKoala->_d02xColors[1] &&
-            colorIndex != ui->widgetKoala->_d02xColors[2])
+    int colorIndex = getValueFromKey(x, y, *key);
+    if (colorIndex != colorRAM &&
+            colorIndex != context.d02xColors[0] &&
+            colorIndex != context.d02xColors[1] &&
+            colorIndex != context.d02xColors[2])
     {
         // both colorIndex and hiColorRAM could be -1 at the same time (valid scenario)
         // prevent that case.
         if (hiColorRAM != -1 && colorIndex == hiColorRAM)
         {
-            key[y*4+x] = _hex[_colorRAM];
+            key->setColor(x, y, colorRAM);
             return true;
         }
 
@@ -218,7 +210,7 @@ bool ImportKoalaDialog::tryChangeKey(int x, int y, char* key, quint8 mask, int h
                 int xdiff = masks[i][0];
                 int ydiff = masks[i][1];
 
-                int neighborColor = getValueFromKey(x+xdiff, y+ydiff, key);
+                int neighborColor = getValueFromKey(x+xdiff, y+ydiff, *key);
                 if (neighborColor != -1)
                     usedColors[neighborColor].first++;
             }
@@ -227,18 +219,18 @@ bool ImportKoalaDialog::tryChangeKey(int x, int y, char* key, quint8 mask, int h
         // use the most frequently color from neighbors
         std::sort(std::begin(usedColors), std::end(usedColors));
         int neighColor = usedColors[15].second;
-        if (neighColor == _colorRAM ||
-                neighColor == ui->widgetKoala->_d02xColors[0] ||
-                neighColor == ui->widgetKoala->_d02xColors[1] ||
-                neighColor == ui->widgetKoala->_d02xColors[2])
+        if (neighColor == colorRAM ||
+                neighColor == context.d02xColors[0] ||
+                neighColor == context.d02xColors[1] ||
+                neighColor == context.d02xColors[2])
         {
-            key[y*4+x] = _hex[neighColor];
+            key->setColor(x, y, neighColor);
             return true;
         }
     }
     return false;
 }
-void ImportKoalaDialog::normalizeWithNeighborStrategy(char* key, int hiColorRAM)
+void ImportKoalaDialog::normalizeWithNeighborStrategy(const ConvertContext& context, KoalaCell* key, int colorRAM, int hiColorRAM) const
 {
     quint8 masks[]
     {
@@ -270,13 +262,13 @@ void ImportKoalaDialog::normalizeWithNeighborStrategy(char* key, int hiColorRAM)
             for (int y=0; y<8; ++y)
             {
                 for (int x=0; x<4; ++x)
-                    keyChanged |= tryChangeKey(x, y, key, mask, hiColorRAM);
+                    keyChanged |= tryChangeKey(context, x, y, key, mask, colorRAM, hiColorRAM);
             }
         } while(keyChanged);
     }
 }
 
-int ImportKoalaDialog::getColorByLuminanceProximity(int colorIndex, const std::vector<int>& colorsToFind)
+int ImportKoalaDialog::getColorByLuminanceProximity(int colorIndex, const std::vector<int>& colorsToFind) const
 {
     Q_ASSERT(colorIndex>=0 && colorIndex<16 && "Invalid Color Index");
 
@@ -307,7 +299,7 @@ int ImportKoalaDialog::getColorByLuminanceProximity(int colorIndex, const std::v
     return usedColors[15].second;
 }
 
-int ImportKoalaDialog::getColorByPaletteProximity(int colorIndex, const std::vector<int>& colorsToFind)
+int ImportKoalaDialog::getColorByPaletteProximity(int colorIndex, const std::vector<int>& colorsToFind) const
 {
     // FIXME:
     // better to have an static table instead of this "magic" heuristic.
@@ -380,7 +372,7 @@ int ImportKoalaDialog::getColorByPaletteProximity(int colorIndex, const std::vec
     return usedColors[15].second;
 }
 
-void ImportKoalaDialog::normalizeWithColorStrategy(char* key, int hiColorRAM)
+void ImportKoalaDialog::normalizeWithColorStrategy(const ConvertContext& context, KoalaCell* key, int colorRAM, int hiColorRAM) const
 {
     Q_UNUSED(hiColorRAM);
 
@@ -388,43 +380,41 @@ void ImportKoalaDialog::normalizeWithColorStrategy(char* key, int hiColorRAM)
     {
         for (int x=0; x<4; ++x)
         {
-            int colorIndex = getValueFromKey(x, y, key);
+            int colorIndex = getValueFromKey(x, y, *key);
 
-            if (colorIndex != _colorRAM &&
-                    colorIndex != ui->widgetKoala->_d02xColors[0] &&
-                    colorIndex != ui->widgetKoala->_d02xColors[1] &&
-                    colorIndex != ui->widgetKoala->_d02xColors[2])
+            if (colorIndex != colorRAM &&
+                    colorIndex != context.d02xColors[0] &&
+                    colorIndex != context.d02xColors[1] &&
+                    colorIndex != context.d02xColors[2])
             {
                 int newColor = -1;
-                const std::vector<int> colorsToFind = {ui->widgetKoala->_d02xColors[0],
-                                                 ui->widgetKoala->_d02xColors[1],
-                                                 ui->widgetKoala->_d02xColors[2],
-                                                 _colorRAM};
+                const std::vector<int> colorsToFind = {context.d02xColors[0],
+                                                 context.d02xColors[1],
+                                                 context.d02xColors[2],
+                                                 colorRAM};
 
                 // Palette proximity Strategy
-                if (ui->radioButtonLuminance->isChecked())
+                if (context.luminanceProximity)
                     newColor = getColorByLuminanceProximity(colorIndex, colorsToFind);
                 else
                     newColor = getColorByPaletteProximity(colorIndex, colorsToFind);
-                key[y*4+x] = _hex[newColor];
+                key->setColor(x, y, newColor);
             }
         }
     }
 }
 
-void ImportKoalaDialog::normalizeKey(char* key, int hiColorRAM)
+void ImportKoalaDialog::normalizeKey(const ConvertContext& context, KoalaCell* key, int colorRAM, int hiColorRAM) const
 {
-    if (ui->radioButtonNeighbor->isChecked())
-        normalizeWithNeighborStrategy(key, hiColorRAM);
+    if (context.neighborStrategy)
+        normalizeWithNeighborStrategy(context, key, colorRAM, hiColorRAM);
     else /* Luminance or Palette */
-        normalizeWithColorStrategy(key, hiColorRAM);
+        normalizeWithColorStrategy(context, key, colorRAM, hiColorRAM);
 }
 
 
-bool ImportKoalaDialog::processChardef(const std::string& key, quint8* outKey, quint8* outColorRAM)
+bool ImportKoalaDialog::processChardef(const ConvertContext& context, const KoalaCell& key, quint8* outKey, quint8* outColorRAM) const
 {
-    Q_ASSERT(key.size() == 8*4 && "Invalid Key Size");
-
     // For the heuristic:
     // used colors that are not the same as d021, d022 and d023
     // vector<used_colors,color_index>
@@ -442,13 +432,13 @@ bool ImportKoalaDialog::processChardef(const std::string& key, quint8* outKey, q
         quint8 bits = 0;
         for (int x=0; x<4; ++x)
         {
-            int colorIndex = getValueFromKey(x,y,key.c_str());
+            int colorIndex = getValueFromKey(x,y,key);
 
-            if (colorIndex == ui->widgetKoala->_d02xColors[0])
+            if (colorIndex == context.d02xColors[0])
                 ;
-            else if (colorIndex == ui->widgetKoala->_d02xColors[1])
+            else if (colorIndex == context.d02xColors[1])
                 bits |= (1 << (6-(x*2)));
-            else if (colorIndex == ui->widgetKoala->_d02xColors[2])
+            else if (colorIndex == context.d02xColors[2])
                 bits |= (2 << (6-(x*2)));
             else
                 invalidCoords.emplace_back(x,y);
@@ -461,25 +451,22 @@ bool ImportKoalaDialog::processChardef(const std::string& key, quint8* outKey, q
     std::sort(std::begin(usedColors), std::end(usedColors));
     std::reverse(std::begin(usedColors), std::end(usedColors));
 
-    int hiColorRAM = _colorRAM = -1;
-    _colorRAM = findColorRAM(usedColors, &hiColorRAM);
+    int hiColorRAM = -1;
+    int colorRAM = findColorRAM(context, usedColors, &hiColorRAM);
 
     // no colorRAM detected? That means that all colors are d020, d021, d022
-    if (_colorRAM == -1)
+    if (colorRAM == -1)
     {
         Q_ASSERT(invalidCoords.empty() && "error in heuristic");
         // pick a random color for RAMcolor... like black
-        _colorRAM = 0;
+        colorRAM = 0;
     }
 
 
     if (!invalidCoords.empty())
     {
-        char copyKey[8*4 + 1];
-        memcpy(copyKey, key.c_str(), sizeof(copyKey));
-        copyKey[8*4] = 0;       // used when printing the key
-
-        normalizeKey(copyKey, hiColorRAM);
+        KoalaCell copyKey = key;
+        normalizeKey(context, &copyKey, colorRAM, hiColorRAM);
 
         bool error = false;
         // by now, all invalid colors should have valid ones in the key
@@ -490,13 +477,13 @@ bool ImportKoalaDialog::processChardef(const std::string& key, quint8* outKey, q
 
             int colorIndex = getValueFromKey(x, y, copyKey);
 
-            if (colorIndex == ui->widgetKoala->_d02xColors[0])
+            if (colorIndex == context.d02xColors[0])
                 ;
-            else if (colorIndex == ui->widgetKoala->_d02xColors[1])
+            else if (colorIndex == context.d02xColors[1])
                 outKey[y] |= (1 << (6-(x*2)));
-            else if (colorIndex == ui->widgetKoala->_d02xColors[2])
+            else if (colorIndex == context.d02xColors[2])
                 outKey[y] |= (2 << (6-(x*2)));
-            else if (colorIndex == _colorRAM)
+            else if (colorIndex == colorRAM)
                 outKey[y] |= (3 << (6-(x*2)));
             else {
                 error = true;
@@ -506,12 +493,12 @@ bool ImportKoalaDialog::processChardef(const std::string& key, quint8* outKey, q
         {
             auto deb = qDebug();
             deb << "Key with error" \
-                     << "key:" << key.c_str() \
-                     << "new key:" << copyKey \
-                     << "(" << ui->widgetKoala->_d02xColors[0] << "," \
-                     << ui->widgetKoala->_d02xColors[1] << "," \
-                     << ui->widgetKoala->_d02xColors[2] << ","\
-                     << _colorRAM << ")" \
+                     << "key:" << key.toString().c_str() \
+                     << "new key:" << copyKey.toString().c_str() \
+                     << "(" << context.d02xColors[0] << "," \
+                     << context.d02xColors[1] << "," \
+                     << context.d02xColors[2] << ","\
+                     << colorRAM << ")" \
                      << "\n";
 
             for (auto& pair: usedColors)
@@ -522,13 +509,13 @@ bool ImportKoalaDialog::processChardef(const std::string& key, quint8* outKey, q
         }
     }
 
-    *outColorRAM = _colorRAM + 8;
+    *outColorRAM = colorRAM + 8;
 
-//    qDebug() << "key:" << key.c_str()
-//             << "(" << ui->widgetKoala->_d02xColors[0] << ","
-//             << ui->widgetKoala->_d02xColors[1] << ","
-//             << ui->widgetKoala->_d02xColors[2] << ","
-//             << _colorRAM << ")";
+//    qDebug() << "key:" << key.toString().c_str()
+//             << "(" << context.d02xColors[0] << ","
+//             << context.d02xColors[1] << ","
+//             << context.d02xColors[2] << ","
+//             << colorRAM << ")";
 
     return true;
 }
@@ -567,31 +554,58 @@ bool ImportKoalaDialog::convert()
             colorRects[i]->setColorIndex(bitmap->_d02xColors[i]);
     }
 
+    // read the options from the widgets before converting the cells in other threads
+    ConvertContext context;
+    for (int i=0; i<3; ++i)
+        context.d02xColors[i] = bitmap->_d02xColors[i];
+    context.neighborStrategy = ui->radioButtonNeighbor->isChecked();
+    context.luminanceProximity = ui->radioButtonLuminance->isChecked();
+    context.foregroundMostUsed = ui->radioForegroundMostUsed->isChecked();
+
+    struct CellJob {
+        const KoalaCell* cell;
+        const std::vector<std::pair<int,int>>* coords;
+        KoalaChar chr;
+    };
+
+    std::vector<CellJob> jobs;
+    jobs.reserve(bitmap->_uniqueCells.size());
+    for (const auto& uniqueCell: bitmap->_uniqueCells)
+        jobs.push_back({&uniqueCell.first, &uniqueCell.second, KoalaChar()});
+
+    // sort by the position of the first cell, not by hash order,
+    // so that the generated charset is always the same
+    std::sort(std::begin(jobs), std::end(jobs), [](const CellJob& a, const CellJob& b) {
+        const auto& posA = a.coords->front();
+        const auto& posB = b.coords->front();
+        return (posA.second < posB.second) || (posA.second == posB.second && posA.first < posB.first);
+    });
+
+    // each cell is converted independently
+    QtConcurrent::blockingMap(jobs, [this, &context](CellJob& job) {
+        processChardef(context, *job.cell, job.chr.chardef, &job.chr.colorRAM);
+    });
+
     // find uniqueChars, which could be smaller than bitmap->_uniqueCells
     _uniqueChars.clear();
-    for (auto it = std::begin(bitmap->_uniqueCells); it != std::end(bitmap->_uniqueCells); ++it)
+    std::unordered_map<KoalaChar, int, KoalaCharHash> charIndices;
+    charIndices.reserve(jobs.size());
+    for (const auto& job: jobs)
     {
-        quint8 chardef[8];
-        memset(chardef, 0, sizeof(chardef));
-
-        quint8 colorRAM;
-        // it->first: key
-        processChardef(it->first, chardef, &colorRAM);
-        Q_ASSERT(colorRAM<16 && "Invalid colorRAM");
+        Q_ASSERT(job.chr.colorRAM<16 && "Invalid colorRAM");
 
-        // chardef + colorRAM == unique Char
-        std::string key;
-        for (unsigned char i: chardef)
+        auto found = charIndices.find(job.chr);
+        if (found == std::end(charIndices))
         {
-            key += _hex[i >> 4];
-            key += _hex[i & 0x0f];
+            charIndices.emplace(job.chr, (int)_uniqueChars.size());
+            _uniqueChars.emplace_back(job.chr, *job.coords);
         }
-        key += _hex[colorRAM];
-
-        if (_uniqueChars.find(key) != std::end(_uniqueChars))
+        else
+        {
             // append coordinates since they all share the same key
-            _uniqueChars[key].insert(_uniqueChars[key].end(), it->second.begin(), it->second.end());
-        else _uniqueChars[key] = it->second;
+            auto& coords = _uniqueChars[found->second].second;
+            coords.insert(coords.end(), job.coords->begin(), job.coords->end());
+        }
     }
 
     // check if unique chars are < 256
@@ -616,18 +630,9 @@ bool ImportKoalaDialog::convert()
     int charsetCount = 0;
     for (auto it = std::begin(_uniqueChars); it != std::end(_uniqueChars); ++it)
     {
-        quint8 chardef[8];
-        for (int i=0; i<8; i++)
-        {
-            quint8 hi = dehexify(it->first.c_str()[i*2]);
-            quint8 lo = dehexify(it->first.c_str()[i*2+1]);
-            chardef[i] = (hi << 4) + lo;
-        }
-        quint8 colorRAM = dehexify(it->first.c_str()[16]);
-
         // it->second: list of coordiantes
-        charset->populateScreenAndColorRAM(it->second, charsetCount, colorRAM);
-        charset->setCharset(charsetCount, chardef);
+        charset->populateScreenAndColorRAM(it->second, charsetCount, it->first.colorRAM);
+        charset->setCharset(charsetCount, it->first.chardef);
 
         charsetCount++;
     }
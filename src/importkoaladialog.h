@@ -17,8 +17,12 @@ limitations under the License.
 #pragma once
 
 #include <unordered_map>
+#include <vector>
+
 #include <QDialog>
 
+#include "koalacell.h"
+
 namespace Ui {
 class ImportKoalaDialog;
 }
@@ -36,17 +40,28 @@ public:
 protected:
     void mousePressEvent(QMouseEvent* event) Q_DECL_OVERRIDE;
 
+    /**
+     * @brief The ConvertContext struct the conversion options, taken from the widgets.
+     * processChardef only reads from it, so cells can be converted in parallel
+     */
+    struct ConvertContext {
+        int d02xColors[3];
+        bool neighborStrategy;      // else luminance or palette proximity
+        bool luminanceProximity;    // else palette proximity
+        bool foregroundMostUsed;    // else most used "low" color
+    };
+
     void validateKoalaFile(const QString& filepath);
-    bool processChardef(const std::string& key, quint8 *outKey, quint8* outColorRAM);
+    bool processChardef(const ConvertContext& context, const KoalaCell& key, quint8 *outKey, quint8* outColorRAM) const;
 
-    int findColorRAM(const std::vector<std::pair<int,int>>& usedColors, int *outHiColor);
+    int findColorRAM(const ConvertContext& context, const std::vector<std::pair<int,int>>& usedColors, int *outHiColor) const;
 
-    void normalizeKey(char* key, int hiColorRAM);
-    void normalizeWithColorStrategy(char* key, int hiColorRAM);
-    void normalizeWithNeighborStrategy(char* key, int hiColorRAM);
-    bool tryChangeKey(int x, int y, char* key, quint8 mask, int hiColorRAM);
-    int getColorByLuminanceProximity(int colorIndex, const std::vector<int> &colorsToFind);
-    int getColorByPaletteProximity(int colorIndex, const std::vector<int> &colorsToFind);
+    void normalizeKey(const ConvertContext& context, KoalaCell* key, int colorRAM, int hiColorRAM) const;
+    void normalizeWithColorStrategy(const ConvertContext& context, KoalaCell* key, int colorRAM, int hiColorRAM) const;
+    void normalizeWithNeighborStrategy(const ConvertContext& context, KoalaCell* key, int colorRAM, int hiColorRAM) const;
+    bool tryChangeKey(const ConvertContext& context, int x, int y, KoalaCell* key, quint8 mask, int colorRAM, int hiColorRAM) const;
+    int getColorByLuminanceProximity(int colorIndex, const std::vector<int> &colorsToFind) const;
+    int getColorByPaletteProximity(int colorIndex, const std::vector<int> &colorsToFind) const;
 
     bool convert();
     void updateWidgets();
@@ -74,7 +89,6 @@ private slots:
 
 private:
 
-    int _colorRAM;
     Ui::ImportKoalaDialog *ui;
     bool _validKoalaFile;
     bool _koaLoaded;
@@ -83,6 +97,7 @@ private:
     // the difference between bitmap->uniqueCells and this one
     // is that _uniqueCells is about "bitmaps" unique cells.
     // and where is about the converted chars, which is usually less
-    // since it could have more duplicates
-    std::unordered_map<std::string, std::vector<std::pair<int,int>>> _uniqueChars;
+    // since it could have more duplicates.
+    // In charset order: the first char found in the bitmap goes first
+    std::vector<std::pair<KoalaChar, std::vector<std::pair<int,int>>>> _uniqueChars;
 };
@@ -74,6 +74,10 @@ const QString& ImportVICEDialog::getFilepath() const
 
 void ImportVICEDialog::updateTileImages()
 {
+    // _tmpState is modified directly, without emitting signals
+    _tmpState->invalidateCharImages();
+    _tmpState->invalidateResolvedPens();
+
     for (int tileIdx=0; tileIdx<256; ++tileIdx)
     {
         utilsDrawCharInImage(_tmpState, _tileImages[tileIdx], QPoint(0, 0), tileIdx);
@@ -122,7 +126,7 @@ void ImportVICEDialog::on_spinBoxCharset_editingFinished()
 void ImportVICEDialog::on_spinBoxCharset_valueChanged(int address)
 {
     Q_ASSERT(address <= (65536-2048) && "invalid address");
-    memcpy(_tmpState->_charset, &_memoryRAM[address], sizeof(_tmpState->_charset));
+    memcpy(_tmpState->_charset, &_memoryRAM[address], State::CHAR_BUFFER_SIZE);
     updateTileImages();
 
     ui->widgetCharset->update();
@@ -152,12 +156,12 @@ void ImportVICEDialog::on_spinBoxScreenRAM_valueChanged(int address)
 {
     Q_ASSERT(address <= (65536-1024) && "invalid address");
 
-    memcpy(_tmpState->_map, &_memoryRAM[address], 40*25);
+    _tmpState->_map.copyFrom(&_memoryRAM[address]);
 
     for (int i=40*25-1; i>=0; --i)
     {
         quint8 tileColor = _colorRAM[i];
-        quint8 tileIdx = _tmpState->_map[i];
+        quint8 tileIdx = _memoryRAM[address + i];
 
         _tmpState->_tileColors[tileIdx] = tileColor;
     }
@@ -222,7 +226,7 @@ bool ImportVICEDialog::validateVICEFile(const QString& filepath)
         _tmpState->_penColors[1] = VICRegisters[0x22] & 0xf;
         _tmpState->_penColors[2] = VICRegisters[0x23] & 0xf;
 
-        memset(_tmpState->_tileColors, 11, sizeof(_tmpState->_tileColors));
+        memset(_tmpState->_tileColors, 11, State::TILE_COLORS_BUFFER_SIZE);
 
         int oldCharset = ui->spinBoxCharset->value();
         int oldScreenRAM = ui->spinBoxScreenRAM->value();
@@ -0,0 +1,117 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include <QtGlobal>
+
+// finalizer from MurmurHash3: spreads all the bits of the key
+static inline quint64 koalaHashMix(quint64 x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * @brief The KoalaCell struct the colors of a 4x8 Koala cell.
+ * 32 pixels of 4 bits each, packed in 128 bits:
+ * pixel (x,y) is stored in the nibble y*4+x. Nibbles 0-15 in lo, 16-31 in hi.
+ */
+struct KoalaCell {
+    quint64 lo;
+    quint64 hi;
+
+    KoalaCell()
+        : lo(0)
+        , hi(0)
+    {
+    }
+
+    int getColor(int x, int y) const
+    {
+        const int nibble = y * 4 + x;
+        const quint64 word = (nibble < 16) ? lo : hi;
+        return (word >> ((nibble & 15) * 4)) & 0xf;
+    }
+
+    void setColor(int x, int y, int color)
+    {
+        const int nibble = y * 4 + x;
+        quint64& word = (nibble < 16) ? lo : hi;
+        const int shift = (nibble & 15) * 4;
+        word = (word & ~(0xfULL << shift)) | ((quint64)(color & 0xf) << shift);
+    }
+
+    bool operator==(const KoalaCell& other) const
+    {
+        return lo == other.lo && hi == other.hi;
+    }
+
+    /** @brief toString the colors in hex, one char per pixel. Used for debugging */
+    std::string toString() const
+    {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string str(32, '0');
+        for (int y=0; y<8; ++y)
+            for (int x=0; x<4; ++x)
+                str[y*4+x] = hex[getColor(x,y)];
+        return str;
+    }
+};
+
+struct KoalaCellHash {
+    std::size_t operator()(const KoalaCell& cell) const
+    {
+        return (std::size_t)koalaHashMix(cell.lo ^ koalaHashMix(cell.hi));
+    }
+};
+
+/**
+ * @brief The KoalaChar struct a Koala cell converted to a multicolor char:
+ * its 8 bytes plus the Color RAM value
+ */
+struct KoalaChar {
+    quint8 chardef[8];
+    quint8 colorRAM;
+
+    KoalaChar()
+        : chardef{0}
+        , colorRAM(0)
+    {
+    }
+
+    bool operator==(const KoalaChar& other) const
+    {
+        return colorRAM == other.colorRAM && memcmp(chardef, other.chardef, sizeof(chardef)) == 0;
+    }
+};
+
+struct KoalaCharHash {
+    std::size_t operator()(const KoalaChar& chr) const
+    {
+        quint64 bits;
+        memcpy(&bits, chr.chardef, sizeof(bits));
+        return (std::size_t)koalaHashMix(bits ^ koalaHashMix(chr.colorRAM));
+    }
+};
@@ -54,6 +54,7 @@ limitations under the License.
 #include "serverpreview.h"
 #include "state.h"
 #include "tilepropertiesdialog.h"
+#include "vicepreview.h"
 #include "xlinkpreview.h"
 
 constexpr int MainWindow::MAX_RECENT_FILES;
@@ -91,10 +92,13 @@ MainWindow::MainWindow(QWidget *parent)
     setupMapDock();
     setupStatusBar();
     checkForUpdates();
+
+    MessageSink::setInstance(this);
 }
 
 MainWindow::~MainWindow()
 {
+    MessageSink::setInstance(nullptr);
     delete _ui;
 }
 
@@ -119,6 +123,26 @@ void MainWindow::serverConnected()
 void MainWindow::serverDisconnected()
 {
     _ui->actionServerConnection->setText(tr("Connect"));
+
+    auto serverPreview = ServerPreview::getInstance();
+    showMessageOnStatusBar(tr("Server preview: %1 bytes sent, %2 bytes saved by compression")
+                           .arg(serverPreview->getBytesSent())
+                           .arg(serverPreview->getBytesSaved()));
+}
+
+void MainWindow::viceConnected()
+{
+    _ui->actionViceConnection->setText(tr("Disconnect"));
+}
+
+void MainWindow::viceDisconnected()
+{
+    _ui->actionViceConnection->setText(tr("Connect"));
+
+    auto vicePreview = VicePreview::getInstance();
+    showMessageOnStatusBar(tr("VICE preview: %1 bytes sent, %2 errors")
+                           .arg(vicePreview->getBytesSent())
+                           .arg(vicePreview->getErrors()));
 }
 
 
@@ -323,21 +347,12 @@ void MainWindow::openDefaultDocument()
 BigCharWidget* MainWindow::createDocument(State* state)
 {
     auto bigcharWidget = new BigCharWidget(state, this);
+    state->setUndoMemoryLimit(Preferences::getInstance().getUndoMemoryLimit());
 
-    auto xlinkpreview = XlinkPreview::getInstance();
-    connect(state, &State::fileLoaded, xlinkpreview, &XlinkPreview::fileLoaded);
-    connect(state, &State::bytesUpdated, xlinkpreview, &XlinkPreview::bytesUpdated);
-    connect(state, &State::tileUpdated, xlinkpreview, &XlinkPreview::tileUpdated);
-    connect(state, &State::colorPropertiesUpdated, xlinkpreview, &XlinkPreview::colorPropertiesUpdated);
-    connect(state, &State::multicolorModeToggled, xlinkpreview, &XlinkPreview::colorPropertiesUpdated);
-
-    auto serverpreview = ServerPreview::getInstance();
-    connect(state, &State::fileLoaded, serverpreview, &ServerPreview::fileLoaded);
-    connect(state, &State::bytesUpdated, serverpreview, &ServerPreview::bytesUpdated);
-    connect(state, &State::tileUpdated, serverpreview, &ServerPreview::tileUpdated);
-    connect(state, &State::colorPropertiesUpdated, serverpreview, &ServerPreview::colorPropertiesUpdated);
-    connect(state, &State::multicolorModeToggled, serverpreview, &ServerPreview::multicolorModeUpdated);
-    connect(state, &State::tilePropertiesUpdated, serverpreview, &ServerPreview::tilePropertiesUpdated);
+    // live previews
+    XlinkPreview::getInstance()->connectToState(state);
+    ServerPreview::getInstance()->connectToState(state);
+    VicePreview::getInstance()->connectToState(state);
 
     connect(state, &State::fileLoaded, this, &MainWindow::refresh);
     connect(state, &State::fileLoaded, bigcharWidget, &BigCharWidget::onFileLoaded);
@@ -360,8 +375,12 @@ BigCharWidget* MainWindow::createDocument(State* state)
     connect(state, &State::tileUpdated, _ui->mapWidget, &MapWidget::onTileUpdated);
     connect(state, &State::charsetUpdated, bigcharWidget, &BigCharWidget::onCharsetUpdated);
     connect(state, &State::charsetUpdated, _ui->charsetWidget, &CharsetWidget::onCharsetUpdated);
+    connect(state, &State::bytesUpdated, _ui->charsetWidget, &CharsetWidget::onBytesUpdated);
     connect(state, &State::charsetUpdated, _ui->tilesetWidget, &TilesetWidget::onCharsetUpdated);
     connect(state, &State::charsetUpdated, _ui->mapWidget, &MapWidget::onCharsetUpdated);
+    connect(state, &State::charsetBankCountUpdated, _ui->mapWidget, &MapWidget::onCharsetUpdated);
+    connect(state, &State::charsetBankUpdated, _ui->mapWidget, &MapWidget::onCharsetUpdated);
+    connect(state, &State::charsetBankSelected, this, &MainWindow::onCharsetBankSelected);
     connect(state, &State::charIndexUpdated, this, &MainWindow::onCharIndexUpdated);
     connect(state, &State::colorPropertiesUpdated, this, &MainWindow::onColorPropertiesUpdated);
     connect(state, &State::colorPropertiesUpdated, bigcharWidget, &BigCharWidget::onColorPropertiesUpdated);
@@ -435,6 +454,10 @@ void MainWindow::createActions()
     connect(serverPreview, &ServerPreview::previewConnected, this, &MainWindow::serverConnected);
     connect(serverPreview, &ServerPreview::previewDisconnected, this, &MainWindow::serverDisconnected);
 
+    auto vicePreview = VicePreview::getInstance();
+    connect(vicePreview, &VicePreview::previewConnected, this, &MainWindow::viceConnected);
+    connect(vicePreview, &VicePreview::previewDisconnected, this, &MainWindow::viceDisconnected);
+
     connect(_ui->mdiArea, &QMdiArea::subWindowActivated, this, &MainWindow::onSubWindowActivated);
 
     connect(_ui->spinBox_tileIndex, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, &MainWindow::onSpinBoxValueChanged);
@@ -722,6 +745,18 @@ void MainWindow::showMessageOnStatusBar(const QString& message)
     statusBar()->showMessage(message, 3000);
 }
 
+void MainWindow::showMessage(const QString& message)
+{
+    showMessageOnStatusBar(message);
+}
+
+void MainWindow::showError(const QString& message)
+{
+    showMessageOnStatusBar(message);
+    // beep on error
+    QApplication::beep();
+}
+
 void MainWindow::onCharIndexUpdated(int charIndex)
 {
     auto state = getState();
@@ -792,6 +827,11 @@ void MainWindow::on_actionPreferences_triggered()
 {
     PreferencesDialog dialog(this);
     dialog.exec();
+
+    // the undo memory limit applies to the open documents too
+    const qint64 undoMemoryLimit = Preferences::getInstance().getUndoMemoryLimit();
+    for (auto subWindow: _ui->mdiArea->subWindowList())
+        qobject_cast<BigCharWidget*>(subWindow->widget())->getState()->setUndoMemoryLimit(undoMemoryLimit);
 }
 
 //
@@ -936,13 +976,23 @@ void MainWindow::activatePalette(int paletteIndex)
 
     // FIXME: there should be an event to propage the palette changes...
     // in the meantime, do it manually
+
+    // decoded chars and resolved pens are cached per document
+    for (auto subwindow : _ui->mdiArea->subWindowList())
+    {
+        auto state = qobject_cast<BigCharWidget*>(subwindow->widget())->getState();
+        state->invalidateResolvedPens();
+        state->invalidateCharImages();
+    }
+
     _ui->dockWidget_colors->update();
     _ui->tilesetWidget->update();
-    _ui->charsetWidget->update();
-    _ui->mapWidget->update();
-    auto state = getState();
-    if (state)
-        state->getBigCharWidget()->update();
+    _ui->charsetWidget->onCharsetUpdated();
+    // the map keeps its own pre-rendered tiles
+    _ui->mapWidget->onColorPropertiesUpdated(-1);
+    auto bigchar = getBigcharWidget();
+    if (bigchar)
+        bigchar->update();
 }
 
 void MainWindow::on_actionPalette_0_triggered()
@@ -1497,6 +1547,21 @@ void MainWindow::on_actionServerConnection_triggered()
     }
 }
 
+void MainWindow::on_actionViceConnection_triggered()
+{
+    auto preview = VicePreview::getInstance();
+    if (preview->isConnected())
+    {
+        preview->disconnect();
+    }
+    // VICE's binary monitor only listens in localhost by default
+    else if (!preview->connect("127.0.0.1"))
+    {
+        QMessageBox msgBox(QMessageBox::Warning, "", tr("Could not connect to VICE. Start it with -binarymonitor"), nullptr, this);
+        msgBox.exec();
+    }
+}
+
 
 void MainWindow::on_actionNext_Tile_triggered()
 {
@@ -1514,6 +1579,48 @@ void MainWindow::on_actionPrevious_Tile_triggered()
     _ui->spinBox_tileIndex->setValue(value);
 }
 
+void MainWindow::on_actionNext_Charset_Bank_triggered()
+{
+    auto state = getState();
+    if (state)
+        state->setCharsetBank((state->getCharsetBank() + 1) % state->getCharsetBankCount());
+}
+
+void MainWindow::on_actionPrevious_Charset_Bank_triggered()
+{
+    auto state = getState();
+    if (state)
+        state->setCharsetBank((state->getCharsetBank() + state->getCharsetBankCount() - 1) % state->getCharsetBankCount());
+}
+
+void MainWindow::on_actionAdd_Charset_Bank_triggered()
+{
+    auto state = getState();
+    if (!state)
+        return;
+
+    if (state->getCharsetBankCount() >= State::MAX_CHARSET_BANKS)
+    {
+        showMessageOnStatusBar(tr("Error: no more than %1 charset banks").arg(State::MAX_CHARSET_BANKS));
+        return;
+    }
+    state->setCharsetBankCount(state->getCharsetBankCount() + 1);
+}
+
+void MainWindow::on_actionRemove_Charset_Bank_triggered()
+{
+    auto state = getState();
+    if (state && state->getCharsetBankCount() > 1)
+        state->setCharsetBankCount(state->getCharsetBankCount() - 1);
+}
+
+void MainWindow::onCharsetBankSelected(int bank)
+{
+    auto state = getState();
+    if (state)
+        showMessageOnStatusBar(tr("Charset bank: %1 of %2").arg(bank).arg(state->getCharsetBankCount()));
+}
+
 void MainWindow::on_actionReset_Layout_triggered()
 {
     auto& preferences = Preferences::getInstance();
@@ -1659,7 +1766,9 @@ State::CopyRange MainWindow::bufferToClipboard(State* state) const
     }
     else /* MAP */
     {
-        array.append((const char*)state->getMapBuffer(), state->getMapSize().width() * state->getMapSize().height());
+        std::vector<quint16> cells(state->getMap().getCellCount());
+        state->getMap().copyTo(cells.data());
+        array.append((const char*)cells.data(), cells.size() * sizeof(quint16));
     }
 
     mimeData->setData("vchar64/range", array);
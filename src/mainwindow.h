@@ -20,6 +20,7 @@ limitations under the License.
 #include <QString>
 #include <QVector>
 
+#include "messagesink.h"
 #include "state.h"
 
 QT_BEGIN_NAMESPACE
@@ -38,7 +39,7 @@ class MainWindow;
 class BigCharWidget;
 class State;
 
-class MainWindow : public QMainWindow
+class MainWindow : public QMainWindow, public MessageSink
 {
     Q_OBJECT
 
@@ -76,15 +77,22 @@ public:
 
     void readSettings();
 
+    // MessageSink
+    void showMessage(const QString& message) Q_DECL_OVERRIDE;
+    void showError(const QString& message) Q_DECL_OVERRIDE;
+
 public slots:
     void xlinkConnected();
     void xlinkDisconnected();
     void serverConnected();
     void serverDisconnected();
+    void viceConnected();
+    void viceDisconnected();
     void documentWasModified();
     void onCharIndexUpdated(int);
     void onMulticolorModeToggled(bool);
     void onTilePropertiesUpdated();
+    void onCharsetBankSelected(int bank);
     bool openFile(const QString& fileName);
     void showMessageOnStatusBar(const QString& message);
     void onColorPropertiesUpdated(int pen);
@@ -175,6 +183,10 @@ private slots:
     void on_actionDocumentation_triggered();
     void on_actionNext_Tile_triggered();
     void on_actionPrevious_Tile_triggered();
+    void on_actionNext_Charset_Bank_triggered();
+    void on_actionPrevious_Charset_Bank_triggered();
+    void on_actionAdd_Charset_Bank_triggered();
+    void on_actionRemove_Charset_Bank_triggered();
     void on_actionImportVICESnapshot_triggered();
     void on_actionReset_Layout_triggered();
     void on_actionClose_triggered();
@@ -182,6 +194,7 @@ private slots:
 
     void on_actionXlinkConnection_triggered();
     void on_actionServerConnection_triggered();
+    void on_actionViceConnection_triggered();
 
     void on_actionImportKoalaImage_triggered();
 
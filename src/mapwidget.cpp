@@ -16,6 +16,8 @@ limitations under the License.
 
 #include "mapwidget.h"
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
 
 #include <QDebug>
@@ -24,6 +26,7 @@ limitations under the License.
 #include <QImage>
 #include <QPaintEvent>
 #include <QPainter>
+#include <QtCore/qmath.h>
 
 #include "mainwindow.h"
 #include "palette.h"
@@ -33,6 +36,12 @@ limitations under the License.
 
 static const int ZOOM_LEVEL = 2;
 static const int OFFSET = 0;
+// version of the cells whose charset bank was removed. They are drawn in black
+static const quint32 MISSING_TILE_VERSION = 1;
+// the map image is cached in chunks of about CHUNK_SIZE x CHUNK_SIZE pixels: 256 KiB each
+static const int CHUNK_SIZE = 256;
+// past this number, the chunks that are not visible are discarded: 64 MiB
+static const int MAX_CACHED_CHUNKS = 256;
 
 MapWidget::MapWidget(QWidget *parent)
     : QWidget(parent)
@@ -46,6 +55,7 @@ MapWidget::MapWidget(QWidget *parent)
     , _commandMergeable(false)
     , _zoomLevel(ZOOM_LEVEL)
     , _altValue(-1)
+    , _lastTileVersion(MISSING_TILE_VERSION)
 {
     // FIXME: should be updated when the map size changes
     _sizeHint = {(int)(_mapSize.width() * _tileSize.width() * _zoomLevel * 8),
@@ -53,9 +63,6 @@ MapWidget::MapWidget(QWidget *parent)
     setMinimumSize(_sizeHint);
 
     setMouseTracking(true);
-
-    for (auto& _tileImage : _tileImages)
-        _tileImage = nullptr;
 }
 
 //
@@ -69,13 +76,32 @@ void MapWidget::paintEvent(QPaintEvent *event)
     if (!state)
         return;
 
-    updateTileImages();
-
     auto mapSize = state->getMapSize();
 
     // FIXME:
+    // the chunk keys depend on the map width
+    if (_mapSize != mapSize)
+        _mapChunks.clear();
     _mapSize = mapSize;
 
+    auto tileProperties = state->getTileProperties();
+    _tileSize = tileProperties.size;
+    const int tw = _tileSize.width();
+    const int th = _tileSize.height();
+
+    // only the exposed cells are rendered and blitted
+    const int cellWidth = tw * 8;
+    const int cellHeight = th * 8;
+    QRectF exposed(event->rect().x() / _zoomLevel, event->rect().y() / _zoomLevel,
+                   event->rect().width() / _zoomLevel, event->rect().height() / _zoomLevel);
+    QRect source = exposed.toAlignedRect().intersected(QRect(0, 0, mapSize.width() * cellWidth, mapSize.height() * cellHeight));
+    QRect exposedCells;
+    if (!source.isEmpty())
+        exposedCells = QRect(QPoint(source.left() / cellWidth, source.top() / cellHeight),
+                             QPoint(source.right() / cellWidth, source.bottom() / cellHeight));
+
+    updateMapImage(exposedCells);
+
     QPainter painter;
     painter.begin(this);
     painter.scale(_zoomLevel, _zoomLevel);
@@ -85,23 +111,25 @@ void MapWidget::paintEvent(QPaintEvent *event)
     painter.setBrush(QColor(0,0,0));
     painter.setPen(Qt::NoPen);
 
-    auto tileProperties = state->getTileProperties();
-    _tileSize = tileProperties.size;
-    const int tw = _tileSize.width();
-    const int th = _tileSize.height();
-
-    for (int y=0; y<mapSize.height(); y++)
+    // the exposed part of each chunk
+    const QRect exposedChunks = chunksForCells(exposedCells);
+    const int chunksPerRow = (mapSize.width() + _chunkCells.width() - 1) / qMax(_chunkCells.width(), 1);
+    for (int cy=exposedChunks.top(); cy<=exposedChunks.bottom(); ++cy)
     {
-        for (int x=0; x<mapSize.width(); ++x)
+        for (int cx=exposedChunks.left(); cx<=exposedChunks.right(); ++cx)
         {
-            auto tileIdx = state->getTileIndexFromMap(QPoint(x,y));
-            QRectF target(x * _tileSize.width() * 8, y * _tileSize.height() * 8,
-                          _tileSize.width() * 8, _tileSize.height() * 8);
-            painter.drawImage(target, *_tileImages[tileIdx], _tileImages[tileIdx]->rect());
+            auto it = _mapChunks.constFind(cy * chunksPerRow + cx);
+            if (it == _mapChunks.constEnd() || it->image.isNull())
+                continue;
+
+            const QRect chunkRect(QPoint(cx * _chunkCells.width() * cellWidth, cy * _chunkCells.height() * cellHeight),
+                                  it->image.size());
+            const QRect target = chunkRect & source;
+            painter.drawImage(target, it->image, target.translated(-chunkRect.topLeft()));
         }
     }
 
-    if (_displayGrid)
+    if (_displayGrid && !exposedCells.isEmpty())
     {
         auto pen = painter.pen();
         pen.setColor(Preferences::getInstance().getGridColor());
@@ -109,13 +137,18 @@ void MapWidget::paintEvent(QPaintEvent *event)
         pen.setWidthF(1 / ZOOM_LEVEL);
         painter.setPen(pen);
 
-        for (int y=0; y<=mapSize.height(); ++y)
-            painter.drawLine(QPointF(0, y * th * 8),
-                             QPointF(mapSize.width() * tw * 8, y * th * 8));
+        const qreal left = exposedCells.left() * cellWidth;
+        const qreal right = (exposedCells.right() + 1) * cellWidth;
+        const qreal top = exposedCells.top() * cellHeight;
+        const qreal bottom = (exposedCells.bottom() + 1) * cellHeight;
+
+        for (int y=exposedCells.top(); y<=exposedCells.bottom()+1; ++y)
+            painter.drawLine(QPointF(left, y * cellHeight),
+                             QPointF(right, y * cellHeight));
 
-        for (int x=0; x<=mapSize.width(); ++x)
-            painter.drawLine(QPointF(x * tw * 8, 0),
-                             QPointF(x * tw * 8, mapSize.height() * th *8));
+        for (int x=exposedCells.left(); x<=exposedCells.right()+1; ++x)
+            painter.drawLine(QPointF(x * cellWidth, top),
+                             QPointF(x * cellWidth, bottom));
     }
 
     QPen pen;
@@ -475,7 +508,7 @@ void MapWidget::getSelectionRange(State::CopyRange* copyRange) const
     copyRange->tileProperties.size = {-1, -1};
     copyRange->tileProperties.interleaved = -1;
 
-    copyRange->bufferSize = _mapSize.width() * _mapSize.height();
+    copyRange->bufferSize = _mapSize.width() * _mapSize.height() * (int)sizeof(quint16);
 }
 
 int MapWidget::getCursorPos() const
@@ -505,6 +538,7 @@ void MapWidget::setZoomLevel(int zoomLevel)
 void MapWidget::onTilePropertiesUpdated()
 {
     _tileSize = MainWindow::getCurrentState()->getTileProperties().size;
+    invalidateAllTiles();
 
     _sizeHint = QSize(_mapSize.width() * _tileSize.width() * _zoomLevel * 8,
                       _mapSize.height() * _tileSize.height() * _zoomLevel * 8);
@@ -516,6 +550,7 @@ void MapWidget::onTilePropertiesUpdated()
 void MapWidget::onMapSizeUpdated()
 {
     _mapSize = MainWindow::getCurrentState()->getMapSize();
+    _mapChunks.clear();
 
     _sizeHint = QSize(_mapSize.width() * _tileSize.width() * _zoomLevel * 8,
                       _mapSize.height() * _tileSize.height() * _zoomLevel * 8);
@@ -524,32 +559,36 @@ void MapWidget::onMapSizeUpdated()
     update();
 }
 
-void MapWidget::onMapContentUpdated()
+void MapWidget::onMapContentUpdated(const QRect& rect)
 {
-    update();
+    // the cells whose tile changed are detected when painting them
+    update(mapRectToWidget(rect));
 }
 
 void MapWidget::onMulticolorModeToggled(bool state)
 {
     Q_UNUSED(state);
-    update();
+    invalidateAllTiles();
 }
 
 void MapWidget::onColorPropertiesUpdated(int pen)
 {
     Q_UNUSED(pen);
-    update();
+    invalidateAllTiles();
 }
 
 void MapWidget::onTileUpdated(int tileIndex)
 {
-    Q_UNUSED(tileIndex);
+    // only the tiles of the selected bank can be modified
+    const int index = MainWindow::getCurrentState()->getCharsetBank() * 256 + tileIndex;
+    if (tileIndex >= 0 && tileIndex < 256 && index < (int)_tileImagesDirty.size())
+        _tileImagesDirty[index] = true;
     update();
 }
 
 void MapWidget::onCharsetUpdated()
 {
-    update();
+    invalidateAllTiles();
 }
 
 void MapWidget::setMode(MapMode mode)
@@ -564,44 +603,189 @@ void MapWidget::onFileLoaded()
     onMapSizeUpdated();
 }
 
+void MapWidget::invalidateAllTiles()
+{
+    std::fill(_tileImagesDirty.begin(), _tileImagesDirty.end(), true);
+    update();
+}
+
+QRect MapWidget::mapRectToWidget(const QRect& mapRect) const
+{
+    const float cellWidth = _tileSize.width() * 8 * _zoomLevel;
+    const float cellHeight = _tileSize.height() * 8 * _zoomLevel;
+
+    QRectF rect(mapRect.x() * cellWidth + OFFSET, mapRect.y() * cellHeight + OFFSET,
+                mapRect.width() * cellWidth, mapRect.height() * cellHeight);
+
+    // include the cursor, which is drawn on top of the cells
+    const int margin = qCeil(_zoomLevel * 2);
+    return rect.toAlignedRect().adjusted(-margin, -margin, margin, margin);
+}
+
 void MapWidget::updateTileImages()
 {
     auto state = MainWindow::getCurrentState();
     if (!state)
         return;
 
-    auto properties = state->getTileProperties();
-    const int totalTiles = 256 / (properties.size.width() * properties.size.height());
+    const auto tileProperties = state->getTileProperties();
+    const int tw = tileProperties.size.width();
+    const int th = tileProperties.size.height();
+    const int totalTiles = 256 / (tw * th);
+    const int banks = state->getCharsetBankCount();
+
+    // resize atlas
+    const QSize atlasSize(tw * 8, banks * totalTiles * th * 8);
+    if (_tileAtlas.size() != atlasSize || _tileVersions.size() != (std::size_t)banks * 256)
+    {
+        _tileAtlas = QImage(atlasSize, QImage::Format_ARGB32_Premultiplied);
+        _tileImagesDirty.assign(banks * 256, true);
+        _tileVersions.resize(banks * 256);
+        // the atlas was recreated: the cells must be drawn again
+        for (auto& version : _tileVersions)
+            version = ++_lastTileVersion;
+    }
 
-    // resize tiles
-    for (int i=0; i<totalTiles; ++i)
+    for (int bank=0; bank<banks; ++bank)
     {
-        if (!_tileImages[i] || _tileImages[i]->size() != properties.size)
+        for (int tileIdx=0; tileIdx<totalTiles; ++tileIdx)
         {
-            if (_tileImages[i])
-                delete _tileImages[i];
-            _tileImages[i] = new QImage(properties.size * 8, QImage::Format_RGB888);
+            const int index = bank * 256 + tileIdx;
+            if (!_tileImagesDirty[index])
+                continue;
+            _tileImagesDirty[index] = false;
+            _tileVersions[index] = ++_lastTileVersion;
+
+            quint8 charIdx = tileProperties.interleaved == 1 ?
+                                                        tileIdx * tw * th :
+                                                        tileIdx;
+
+            for (int char_quadrant=0; char_quadrant < (tw * th); char_quadrant++)
+            {
+                int offset_x = (char_quadrant % tw) * 8;
+                int offset_y = (bank * totalTiles + tileIdx) * th * 8 + (char_quadrant / tw) * 8;
+
+                utilsDrawCharInImage(state, &_tileAtlas, QPoint(offset_x,offset_y), charIdx, bank);
+
+                charIdx += tileProperties.interleaved;
+            }
         }
     }
+}
 
-    const auto tileProperties = state->getTileProperties();
-    const int tw = tileProperties.size.width();
-    const int th = tileProperties.size.height();
+QRect MapWidget::chunksForCells(const QRect& cells) const
+{
+    if (cells.isEmpty() || _chunkCells.isEmpty())
+        return QRect();
+    return QRect(QPoint(cells.left() / _chunkCells.width(), cells.top() / _chunkCells.height()),
+                 QPoint(cells.right() / _chunkCells.width(), cells.bottom() / _chunkCells.height()));
+}
+
+void MapWidget::evictMapChunks(const QRect& visibleChunks)
+{
+    if (_mapChunks.size() <= MAX_CACHED_CHUNKS)
+        return;
+
+    // the visible ones are kept: they are about to be painted
+    const int chunksPerRow = (_mapSize.width() + _chunkCells.width() - 1) / _chunkCells.width();
+    for (auto it = _mapChunks.begin(); it != _mapChunks.end();)
+    {
+        if (visibleChunks.contains(it.key() % chunksPerRow, it.key() / chunksPerRow))
+            ++it;
+        else
+            it = _mapChunks.erase(it);
+    }
+}
+
+void MapWidget::updateMapImage(const QRect& visibleCells)
+{
+    auto state = MainWindow::getCurrentState();
+    if (!state)
+        return;
+
+    updateTileImages();
 
-    for (int tileIdx=0; tileIdx<totalTiles; ++tileIdx)
+    const int tileWidth = _tileSize.width() * 8;
+    const int tileHeight = _tileSize.height() * 8;
+    const QSize chunkCells(qMax(1, CHUNK_SIZE / tileWidth), qMax(1, CHUNK_SIZE / tileHeight));
+    if (chunkCells != _chunkCells)
     {
-        quint8 charIdx = tileProperties.interleaved == 1 ?
-                                                    tileIdx * tw * th :
-                                                    tileIdx;
+        _mapChunks.clear();
+        _chunkCells = chunkCells;
+    }
+
+    // outdated cells outside the visible area are drawn once they are scrolled into view
+    const QRect cells = visibleCells & QRect(QPoint(0,0), _mapSize);
+    const QRect chunks = chunksForCells(cells);
+    if (chunks.isEmpty())
+        return;
+    evictMapChunks(chunks);
+
+    const int totalTiles = 256 / (_tileSize.width() * _tileSize.height());
+    const int banks = state->getCharsetBankCount();
+    const int chunksPerRow = (_mapSize.width() + _chunkCells.width() - 1) / _chunkCells.width();
 
-        for (int char_quadrant=0; char_quadrant < (tw * th); char_quadrant++)
+    for (int cy=chunks.top(); cy<=chunks.bottom(); ++cy)
+    {
+        for (int cx=chunks.left(); cx<=chunks.right(); ++cx)
         {
-            int offset_x = (char_quadrant % tw) * 8;
-            int offset_y = (char_quadrant / tw) * 8;
+            auto& chunk = _mapChunks[cy * chunksPerRow + cx];
+            if (chunk.image.isNull())
+            {
+                chunk.image = QImage(_chunkCells.width() * tileWidth, _chunkCells.height() * tileHeight, _tileAtlas.format());
+                chunk.cellVersions.assign(_chunkCells.width() * _chunkCells.height(), 0);
+                // out of memory: the chunk is not painted
+                if (chunk.image.isNull())
+                    continue;
+            }
 
-            utilsDrawCharInImage(state, _tileImages[tileIdx], QPoint(offset_x,offset_y), charIdx);
+            const QPoint origin(cx * _chunkCells.width(), cy * _chunkCells.height());
+            const QRect chunkCellsRect = QRect(origin, _chunkCells) & cells;
+            for (int y=chunkCellsRect.top(); y<=chunkCellsRect.bottom(); ++y)
+            {
+                for (int x=chunkCellsRect.left(); x<=chunkCellsRect.right(); ++x)
+                {
+                    const QPoint mapCoord(x,y);
+                    const int tileIdx = state->getTileIndexFromMap(mapCoord);
+                    const int bank = state->getCharsetBankFromMap(mapCoord);
+                    const bool missing = (bank >= banks);
+                    const quint32 version = missing ? MISSING_TILE_VERSION : _tileVersions[bank * 256 + tileIdx];
+
+                    const QPoint chunkCoord = mapCoord - origin;
+                    auto& cellVersion = chunk.cellVersions[chunkCoord.y() * _chunkCells.width() + chunkCoord.x()];
+                    if (cellVersion != version)
+                    {
+                        drawTileInMapImage(&chunk.image, chunkCoord, missing ? -1 : bank * totalTiles + tileIdx);
+                        cellVersion = version;
+                    }
+                }
+            }
+        }
+    }
+}
 
-            charIdx += tileProperties.interleaved;
+// chunkCoord: position of the cell in the chunk.
+// atlasIdx: position of the tile in the atlas, or -1 to draw it in black
+void MapWidget::drawTileInMapImage(QImage* image, const QPoint& chunkCoord, int atlasIdx)
+{
+    const int tileWidth = _tileSize.width() * 8;
+    const int tileHeight = _tileSize.height() * 8;
+    const int dstX = chunkCoord.x() * tileWidth;
+    const int dstY = chunkCoord.y() * tileHeight;
+    const int srcY = atlasIdx * tileHeight;
+
+    // map cells pointing past the last tile are drawn in black
+    if (atlasIdx < 0 || srcY + tileHeight > _tileAtlas.height())
+    {
+        for (int i=0; i<tileHeight; ++i)
+        {
+            auto dst = reinterpret_cast<QRgb*>(image->scanLine(dstY + i)) + dstX;
+            std::fill(dst, dst + tileWidth, qRgb(0,0,0));
         }
+        return;
     }
+
+    // both images are ARGB32 premultiplied: copy whole scanlines
+    for (int i=0; i<tileHeight; ++i)
+        memcpy(image->scanLine(dstY + i) + dstX * 4, _tileAtlas.constScanLine(srcY + i), tileWidth * 4);
 }
@@ -16,13 +16,14 @@ limitations under the License.
 
 #pragma once
 
+#include <vector>
+
+#include <QHash>
+#include <QImage>
+#include <QRect>
 #include <QWidget>
 #include "state.h"
 
-QT_BEGIN_NAMESPACE
-class QImage;
-QT_END_NAMESPACE
-
 // draws the map of the state (screen RAM + color RAM + charset)
 class MapWidget : public QWidget
 {
@@ -50,7 +51,7 @@ signals:
 public slots:
     void onTilePropertiesUpdated();
     void onMapSizeUpdated();
-    void onMapContentUpdated();
+    void onMapContentUpdated(const QRect& rect);
     void onMulticolorModeToggled(bool state);
     void onColorPropertiesUpdated(int pen);
     void onTileUpdated(int tileIndex);
@@ -67,6 +68,12 @@ protected:
     QSize sizeHint() const Q_DECL_OVERRIDE;
 
     void updateTileImages();
+    void updateMapImage(const QRect& visibleCells);
+    void drawTileInMapImage(QImage* image, const QPoint& chunkCoord, int atlasIdx);
+    QRect chunksForCells(const QRect& cells) const;
+    void evictMapChunks(const QRect& visibleChunks);
+    void invalidateAllTiles();
+    QRect mapRectToWidget(const QRect& mapRect) const;
 
 private:
     bool _displayGrid;
@@ -81,7 +88,30 @@ private:
     float _zoomLevel;
     int _altValue;      // value entered pressing ALT + number
 
-    // For gain speed, each tile will be pre-renderer in a QImage
-    // a QImages will be renderer
-    QImage *_tileImages[256];
+    // For gain speed, each tile is pre-rendered in the tile atlas: one
+    // ARGB32 premultiplied image with all the tiles stacked vertically,
+    // bank after bank, so the scanlines of a tile can be copied straight to the map image
+    QImage _tileAtlas;
+    // tiles that must be rendered again. 256 entries per charset bank
+    std::vector<bool> _tileImagesDirty;
+    // incremented each time a tile is rendered again, so it is unique per rendering.
+    // 256 entries per charset bank
+    std::vector<quint32> _tileVersions;
+    quint32 _lastTileVersion;
+
+    /**
+     * @brief The MapChunk struct the backing image of a block of cells,
+     * in the same format as the atlas
+     */
+    struct MapChunk {
+        QImage image;
+        // version of the tile drawn in each cell of the chunk. 0 means not drawn.
+        // Only the visible cells whose version is outdated are drawn again
+        std::vector<quint32> cellVersions;
+    };
+    // the map is too big for a single image: only the chunks that were
+    // visible are cached. Key: chunk y * chunks per row + chunk x
+    QHash<int, MapChunk> _mapChunks;
+    // cells per chunk. Depends on the tile size
+    QSize _chunkCells;
 };
@@ -198,3 +198,15 @@ QString Preferences::getServerIPAddress() const
 {
     return _settings.value(QLatin1String("server/ipaddress"), "10.0.1.64").toString();
 }
+
+// undo memory limit
+void Preferences::setUndoMemoryLimit(qint64 bytes)
+{
+    _settings.setValue(QLatin1String("undo/memoryLimit"), bytes);
+}
+
+qint64 Preferences::getUndoMemoryLimit() const
+{
+    // 0: no limit
+    return _settings.value(QLatin1String("undo/memoryLimit"), 0).toLongLong();
+}
@@ -71,6 +71,9 @@ public:
     void setServerIPAddress(const QString& ipaddress);
     QString getServerIPAddress() const;
 
+    void setUndoMemoryLimit(qint64 bytes);
+    qint64 getUndoMemoryLimit() const;
+
 private:
     Preferences();
     ~Preferences();
@@ -33,12 +33,14 @@ PreferencesDialog::PreferencesDialog(QWidget *parent) :
     connect(ui->pushButtonCheckNow, &QPushButton::clicked, this, &PreferencesDialog::onUpdateNow);
     connect(ui->checkBoxStartupFiles, &QCheckBox::toggled, this, &PreferencesDialog::onStartUpFiles);
     connect(ui->checkBoxAutoCheck, &QCheckBox::toggled, this, &PreferencesDialog::onAutoCheckUpdates);
+    connect(ui->spinBoxUndoMemoryLimit, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, &PreferencesDialog::onUndoMemoryLimit);
     auto& updateInstance = AutoUpdater::getInstance();
     connect(&updateInstance, &AutoUpdater::updateCheckFinished, this, &PreferencesDialog::onUpdateCheckFinished);
 
     setGridColor(Preferences::getInstance().getGridColor());
     ui->checkBoxStartupFiles->setChecked(Preferences::getInstance().getOpenLastFiles());
     ui->checkBoxAutoCheck->setChecked(Preferences::getInstance().getCheckUpdates());
+    ui->spinBoxUndoMemoryLimit->setValue(Preferences::getInstance().getUndoMemoryLimit() / (1024 * 1024));
 
     onUpdateCheckFinished();
 }
@@ -77,6 +79,11 @@ void PreferencesDialog::onAutoCheckUpdates(bool checked)
     Preferences::getInstance().setCheckUpdates(checked);
 }
 
+void PreferencesDialog::onUndoMemoryLimit(int mebibytes)
+{
+    Preferences::getInstance().setUndoMemoryLimit((qint64)mebibytes * 1024 * 1024);
+}
+
 void PreferencesDialog::onUpdateNow()
 {
     AutoUpdater::getInstance().checkUpdate();
@@ -35,6 +35,7 @@ private slots:
     void onSelectColor();
     void onStartUpFiles(bool checked);
     void onAutoCheckUpdates(bool checked);
+    void onUndoMemoryLimit(int mebibytes);
     void onUpdateNow();
     void onUpdateCheckFinished();
 
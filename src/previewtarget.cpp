@@ -0,0 +1,419 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#include "previewtarget.h"
+
+#include <cstring>
+
+#include <QTimer>
+
+#include "mainwindow.h"
+
+// updates are written at most once per frame: 50Hz, PAL
+static const int FLUSH_INTERVAL_MS = 20;
+
+static const quint16 COLOR_RAM_ADDRESS = 0xd800;
+static const int SCREEN_SIZE = 40 * 25;
+// the tileset is shown below the charset, from this row. 10 rows
+static const int TILESET_ROW = 12;
+static const int TILESET_ROWS = 10;
+
+PreviewTarget::PreviewTarget(const MemoryLayout& layout, QObject* parent)
+    : QObject(parent)
+    , _layout(layout)
+    , _state(nullptr)
+    , _pendingUpdates(0)
+    , _dirtyChars(256)
+    , _flushes(0)
+    , _memoryWrites(0)
+    , _bytesWritten(0)
+{
+    _flushTimer = new QTimer(this);
+    _flushTimer->setSingleShot(true);
+    _flushTimer->setInterval(FLUSH_INTERVAL_MS);
+    QObject::connect(_flushTimer, &QTimer::timeout, this, &PreviewTarget::flushPendingUpdates);
+
+    _shadowMemory.assign(64 * 1024, 0);
+    _shadowValid.assign(64 * 1024, false);
+}
+
+PreviewTarget::~PreviewTarget()
+= default;
+
+void PreviewTarget::connectToState(State* state)
+{
+    QObject::connect(state, &State::fileLoaded, this, &PreviewTarget::fileLoaded);
+    QObject::connect(state, &State::bytesUpdated, this, &PreviewTarget::bytesUpdated);
+    QObject::connect(state, &State::tileUpdated, this, &PreviewTarget::tileUpdated);
+    QObject::connect(state, &State::colorPropertiesUpdated, this, &PreviewTarget::colorPropertiesUpdated);
+    QObject::connect(state, &State::multicolorModeToggled, this, &PreviewTarget::multicolorModeUpdated);
+    QObject::connect(state, &State::tilePropertiesUpdated, this, &PreviewTarget::tilePropertiesUpdated);
+    QObject::connect(state, &State::charsetBankSelected, this, &PreviewTarget::fileLoaded);
+}
+
+void PreviewTarget::setState(State* state)
+{
+    _state = state;
+}
+
+State* PreviewTarget::getState() const
+{
+    return _state ? _state : MainWindow::getCurrentState();
+}
+
+bool PreviewTarget::hasPendingUpdates() const
+{
+    return _pendingUpdates != 0 || _dirtyChars.count(true) != 0;
+}
+
+//
+// Slots
+//
+void PreviewTarget::fileLoaded()
+{
+    if(!isConnected()) return;
+
+    // only what differs from the shadow memory is written
+    markUpdated(UPDATE_ALL);
+}
+
+void PreviewTarget::bytesUpdated(int pos, int count)
+{
+    if(!isConnected()) return;
+    if (count <= 0) return;
+
+    // chars are tracked whole: a partially modified char is dirty too
+    const int firstChar = pos / 8;
+    const int lastChar = (pos + count - 1) / 8;
+    markCharsUpdated(firstChar, lastChar - firstChar + 1);
+}
+
+void PreviewTarget::tileUpdated(int tileIndex)
+{
+    if(!isConnected()) return;
+    auto state = getState();
+
+    State::TileProperties properties = state->getTileProperties();
+
+    int charIndex = state->getCharIndexFromTileIndex(tileIndex);
+    int numChars = properties.size.width() * properties.size.height();
+
+    if(properties.interleaved == 1) {
+        markCharsUpdated(charIndex, numChars);
+    }
+    else {
+        for(int i=0; i<numChars; i++) {
+            markCharsUpdated(charIndex, 1);
+            charIndex += properties.interleaved;
+        }
+    }
+}
+
+void PreviewTarget::colorPropertiesUpdated(int pen)
+{
+    Q_UNUSED(pen);
+    if(!isConnected()) return;
+
+    // a handful of bytes: comparing them with the shadow memory is cheaper than tracking each pen
+    markUpdated(UPDATE_REGISTERS | UPDATE_COLOR_RAM);
+}
+
+void PreviewTarget::multicolorModeUpdated(bool toggled)
+{
+    Q_UNUSED(toggled);
+    if(!isConnected()) return;
+
+    // $d016. The Color RAM keeps the pen colors: like in the editor,
+    // only the chars with a color >= 8 are multicolor
+    markUpdated(UPDATE_REGISTERS);
+}
+
+void PreviewTarget::tilePropertiesUpdated()
+{
+    if(!isConnected()) return;
+
+    markUpdated(UPDATE_SCREEN | UPDATE_COLOR_RAM);
+}
+
+//
+// Pending updates
+//
+void PreviewTarget::markUpdated(int updates)
+{
+    _pendingUpdates |= updates;
+    scheduleFlush();
+}
+
+void PreviewTarget::markCharsUpdated(int charIdx, int count)
+{
+    for (int i=qMax(charIdx, 0); i<qMin(charIdx + count, 256); i++)
+        _dirtyChars.setBit(i);
+    scheduleFlush();
+}
+
+void PreviewTarget::scheduleFlush()
+{
+    // not restarted if it is already running: a continuous stream
+    // of updates is still written once per frame
+    if (!_flushTimer->isActive())
+        _flushTimer->start();
+}
+
+void PreviewTarget::discardPendingUpdates()
+{
+    _flushTimer->stop();
+    _pendingUpdates = 0;
+    _dirtyChars.fill(false);
+}
+
+void PreviewTarget::resetTarget()
+{
+    _shadowMemory.assign(64 * 1024, 0);
+    _shadowValid.assign(64 * 1024, false);
+
+    _dirtyChars.fill(false);
+    _pendingUpdates = UPDATE_ALL;
+}
+
+void PreviewTarget::flushPendingUpdates()
+{
+    _flushTimer->stop();
+
+    if (!isConnected())
+    {
+        discardPendingUpdates();
+        return;
+    }
+
+    if (!hasPendingUpdates())
+        return;
+
+    // the transport calls flushPendingUpdates() again once it is ready
+    if (!canFlush())
+        return;
+
+    auto state = getState();
+    if (!state)
+    {
+        discardPendingUpdates();
+        return;
+    }
+
+    beginFlush();
+
+    if (_pendingUpdates & UPDATE_REGISTERS)
+    {
+        const quint8 background = state->getColorForPen(State::PEN_BACKGROUND);
+        const quint8 registers[] = {
+            background,
+            background,
+            (quint8) state->getColorForPen(State::PEN_MULTICOLOR1),
+            (quint8) state->getColorForPen(State::PEN_MULTICOLOR2),
+        };
+        const quint8 control = state->isMulticolorMode() ? 0x18 : 0x08;
+        syncMemory(0xd016, &control, 1);
+        if (_layout.vicMemoryControl >= 0)
+        {
+            const quint8 memoryControl = _layout.vicMemoryControl;
+            syncMemory(0xd018, &memoryControl, 1);
+        }
+        syncMemory(0xd020, registers, sizeof(registers));
+    }
+
+    if (_pendingUpdates & UPDATE_SCREEN)
+    {
+        quint8 screen[SCREEN_SIZE];
+        buildScreen(screen);
+        syncMemory(_layout.screenAddress, screen, sizeof(screen));
+    }
+
+    if (_pendingUpdates & UPDATE_COLOR_RAM)
+    {
+        quint8 colors[SCREEN_SIZE];
+        buildColorRAM(colors);
+        syncMemory(COLOR_RAM_ADDRESS, colors, sizeof(colors));
+    }
+
+    // from the first dirty char to the last one: the clean ones
+    // in between are skipped by the comparison with the shadow memory
+    int firstChar = 0;
+    int lastChar = 255;
+    if (!(_pendingUpdates & UPDATE_CHARSET))
+    {
+        while (firstChar < 256 && !_dirtyChars.testBit(firstChar))
+            firstChar++;
+        while (lastChar >= firstChar && !_dirtyChars.testBit(lastChar))
+            lastChar--;
+    }
+    if (firstChar <= lastChar)
+        syncMemory(_layout.charsetAddress + firstChar * 8, state->getCharAtIndex(firstChar), (lastChar - firstChar + 1) * 8);
+
+    _pendingUpdates = 0;
+    _dirtyChars.fill(false);
+
+    endFlush();
+    _flushes++;
+}
+
+//
+// Shadow memory: what the target memory has, once it processes the writes
+//
+void PreviewTarget::updateShadowMemory(quint16 addr, const quint8* buf, int count)
+{
+    for (int i=0; i<count; i++)
+    {
+        const quint16 a = addr + i;
+        _shadowMemory[a] = buf[i];
+        _shadowValid[a] = true;
+    }
+}
+
+void PreviewTarget::fillShadowMemory(quint16 addr, quint8 value, int count)
+{
+    for (int i=0; i<count; i++)
+    {
+        const quint16 a = addr + i;
+        _shadowMemory[a] = value;
+        _shadowValid[a] = true;
+    }
+}
+
+bool PreviewTarget::isInShadowMemory(quint16 addr, const quint8* buf, int count) const
+{
+    for (int i=0; i<count; i++)
+    {
+        const quint16 a = addr + i;
+        if (!_shadowValid[a] || _shadowMemory[a] != buf[i])
+            return false;
+    }
+    return true;
+}
+
+void PreviewTarget::syncMemory(quint16 addr, const quint8* buf, int count)
+{
+    const int overhead = getWriteOverhead();
+
+    int i = 0;
+    while (i < count)
+    {
+        if (isInShadowMemory(addr + i, &buf[i], 1))
+        {
+            i++;
+            continue;
+        }
+
+        // a gap of equal bytes cheaper than a new write is written too
+        int end = i + 1;
+        for (int j=end; j<count && j - end < overhead; j++)
+        {
+            if (!isInShadowMemory(addr + j, &buf[j], 1))
+                end = j + 1;
+        }
+
+        writeMemory(addr + i, &buf[i], end - i);
+        updateShadowMemory(addr + i, &buf[i], end - i);
+        _memoryWrites++;
+        _bytesWritten += end - i;
+        i = end;
+    }
+}
+
+//
+// The memory the preview shows
+//
+void PreviewTarget::buildTilesetLayout(int* layout) const
+{
+    auto currentTileProperties = getState()->getTileProperties();
+
+    // -1: empty cell
+    for (int i=0; i<40 * TILESET_ROWS; i++)
+        layout[i] = -1;
+
+    int tw = currentTileProperties.size.width();
+    int th = currentTileProperties.size.height();
+
+    int max_tiles = 256 / (tw*th);
+
+    // 32 columns
+    int columns = (32 / currentTileProperties.size.width()) * currentTileProperties.size.width();
+
+    for (int i=0; i<max_tiles;i++)
+    {
+        quint8 index = currentTileProperties.interleaved == 1 ?
+                    i * tw * th :
+                    i;
+        int w = (i * tw) % columns;
+        int h = th * ((i * tw) / columns);
+
+        for (int char_idx=0; char_idx < (tw * th); char_idx++)
+        {
+            int local_w = w + char_idx % tw;
+            int local_h = h + char_idx / tw;
+
+            layout[local_h * 40 + local_w] = index;
+
+            index += currentTileProperties.interleaved;
+        }
+    }
+}
+
+void PreviewTarget::buildScreen(quint8* screen) const
+{
+    memset(screen, 0x20, SCREEN_SIZE);
+
+    // the charset, 32 x 8 chars
+    for (int i=0; i<256; i++)
+        screen[(i / 32) * 40 + (i % 32)] = i;
+
+    // and below it, the tileset
+    int layout[40 * TILESET_ROWS];
+    buildTilesetLayout(layout);
+    for (int i=0; i<40 * TILESET_ROWS; i++)
+    {
+        if (layout[i] >= 0)
+            screen[TILESET_ROW * 40 + i] = layout[i];
+    }
+}
+
+void PreviewTarget::buildColorRAM(quint8* colors) const
+{
+    auto state = getState();
+
+    // the colors as they are: the editor shows a char as multicolor only
+    // when its foreground color is 8 or more, and so does the VIC-II
+    if (state->getForegroundColorMode() == State::FOREGROUND_COLOR_GLOBAL)
+    {
+        memset(colors, state->getColorForPen(State::PEN_FOREGROUND, -1), SCREEN_SIZE);
+        return;
+    }
+
+    auto tileColors = state->getTileColors();
+
+    // the empty cells don't show anything
+    memset(colors, 0x08, SCREEN_SIZE);
+
+    for (int i=0; i<256; i++)
+        colors[(i / 32) * 40 + (i % 32)] = tileColors[state->getTileIndexFromCharIndex(i)];
+
+    int layout[40 * TILESET_ROWS];
+    buildTilesetLayout(layout);
+    for (int i=0; i<40 * TILESET_ROWS; i++)
+    {
+        if (layout[i] >= 0)
+            colors[TILESET_ROW * 40 + i] = tileColors[state->getTileIndexFromCharIndex(layout[i])];
+    }
+}
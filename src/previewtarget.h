@@ -0,0 +1,163 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#pragma once
+
+#include <vector>
+
+#include <QBitArray>
+#include <QObject>
+
+#include "state.h"
+
+QT_BEGIN_NAMESPACE
+class QTimer;
+QT_END_NAMESPACE
+
+/**
+ * @brief The PreviewTarget class base class of the live previews: a C64 running vchar64d,
+ * a C64 attached with an xlink cable, etc.
+ * It tracks the changes of the State and builds the memory the preview shows: charset,
+ * screen, Color RAM and VIC registers. At most once per frame, what differs from the
+ * shadow copy of the target memory is written with writeMemory().
+ * Subclasses only implement the transport.
+ */
+class PreviewTarget : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief The MemoryLayout struct where the preview lives in the target memory
+     */
+    struct MemoryLayout {
+        quint16 charsetAddress;
+        quint16 screenAddress;
+        /** @brief value for $d018, or -1 if the target sets up the VIC by itself */
+        int vicMemoryControl;
+    };
+
+    virtual ~PreviewTarget();
+
+    virtual bool isConnected() = 0;
+
+    /**
+     * @brief connectToState the State signals that update the preview
+     * @param state one of the documents
+     */
+    void connectToState(State* state);
+
+    /**
+     * @brief setState the state to preview. By default, the one of the current document.
+     * Used when there is no MainWindow, like in the benchmarks
+     */
+    void setState(State* state);
+    State* getState() const;
+
+    /** @brief hasPendingUpdates true if there are changes not written yet */
+    bool hasPendingUpdates() const;
+
+    // metrics, shared by all the targets
+    /** @brief getFlushes times the pending updates were written */
+    qint64 getFlushes() const { return _flushes; }
+    /** @brief getMemoryWrites calls to writeMemory(). Each one is a range that differs from the shadow memory */
+    qint64 getMemoryWrites() const { return _memoryWrites; }
+    /** @brief getBytesWritten bytes passed to writeMemory() */
+    qint64 getBytesWritten() const { return _bytesWritten; }
+
+signals:
+    void previewConnected();
+    void previewDisconnected();
+
+public slots:
+    // file loaded, or new project
+    void fileLoaded();
+
+    // when a range of bytes in the charset changes (e.g. due to a paste)
+    void bytesUpdated(int pos, int count);
+
+    // when the whole tile changes
+    void tileUpdated(int tileIndex);
+
+    // multi-color / hires or new colors
+    void colorPropertiesUpdated(int pen);
+
+    void multicolorModeUpdated(bool toggled);
+    void tilePropertiesUpdated();
+
+    /**
+     * @brief flushPendingUpdates writes the changes accumulated since the last flush.
+     * Called by the flush timer, at most once per frame
+     */
+    void flushPendingUpdates();
+
+protected:
+    PreviewTarget(const MemoryLayout& layout, QObject* parent = nullptr);
+
+    // what has to be written in the next flush
+    enum {
+        UPDATE_CHARSET = 1 << 0,
+        UPDATE_SCREEN = 1 << 1,
+        UPDATE_COLOR_RAM = 1 << 2,
+        UPDATE_REGISTERS = 1 << 3,
+
+        UPDATE_ALL = UPDATE_CHARSET | UPDATE_SCREEN | UPDATE_COLOR_RAM | UPDATE_REGISTERS
+    };
+
+    // transport
+    /** @brief canFlush false while the transport is busy. It has to call flushPendingUpdates() once it is ready */
+    virtual bool canFlush() { return true; }
+    virtual void beginFlush() {}
+    /** @brief writeMemory writes a range of the target memory */
+    virtual void writeMemory(quint16 addr, const quint8* buf, int count) = 0;
+    virtual void endFlush() {}
+    /** @brief getWriteOverhead cost of a write, in bytes. Smaller gaps between two ranges are written too */
+    virtual int getWriteOverhead() const = 0;
+
+    /** @brief resetTarget the target memory is unknown: everything is written in the next flush */
+    void resetTarget();
+    void discardPendingUpdates();
+    void markUpdated(int updates);
+    void markCharsUpdated(int charIdx, int count);
+    void scheduleFlush();
+
+    // shadow memory: what the target memory has, once it processes the writes
+    void updateShadowMemory(quint16 addr, const quint8* buf, int count);
+    void fillShadowMemory(quint16 addr, quint8 value, int count);
+    bool isInShadowMemory(quint16 addr, const quint8* buf, int count) const;
+    /** @brief syncMemory writes the ranges of buf that differ from the shadow memory */
+    void syncMemory(quint16 addr, const quint8* buf, int count);
+
+    // the memory the preview shows
+    void buildTilesetLayout(int* layout) const;
+    void buildScreen(quint8* screen) const;
+    void buildColorRAM(quint8* colors) const;
+
+    MemoryLayout _layout;
+    State* _state;
+
+    QTimer* _flushTimer;
+    int _pendingUpdates;
+    QBitArray _dirtyChars;
+
+    std::vector<quint8> _shadowMemory;
+    std::vector<bool> _shadowValid;
+
+    qint64 _flushes;
+    qint64 _memoryWrites;
+    qint64 _bytesWritten;
+};
@@ -19,16 +19,77 @@ limitations under the License.
 
 #include <cstring>
 
-#include <QFile>
-#include <QFileInfo>
 #include <QTcpSocket>
+#include <QTimer>
 #include <QtEndian>
 
-#include "mainwindow.h"
 #include "serverprotocol.h"
 
 static ServerPreview *__instance = nullptr;
 
+// a window is the data sent between two pings. It must fit in the server
+// buffer, including the ping that closes it
+static const int PING_PACKET_SIZE = sizeof(struct vchar64d_proto_header) + sizeof(struct vchar64d_proto_ping);
+static const int WINDOW_SIZE = VCHAR64_SERVER_BUFFER_SIZE - PING_PACKET_SIZE;
+
+// windows closed with a ping and still waiting for their pong. No new window is
+// opened until the pong arrives, so the server never buffers more than one window
+static const int MAX_WINDOWS_IN_FLIGHT = 1;
+
+// TYPE_SET_MEM packets must fit in a window: addr and count are 16-bit
+static const int MAX_BYTES_PER_SET_MEM = WINDOW_SIZE - sizeof(struct vchar64d_proto_header) - 4;
+// same for TYPE_SET_MEM_RLE, but counting the compressed bytes
+static const int MAX_RLE_BYTES_PER_SET_MEM = MAX_BYTES_PER_SET_MEM;
+
+// FIXME: Fragile. Same as the screen memory: the server copies
+// the charset to $a800, but it should be queried
+static const quint16 CHARSET_ADDRESS = 0xa800;
+static const quint16 SCREEN_ADDRESS = 0xa400;
+
+// servers older than version 1 don't answer the hello
+static const int HELLO_TIMEOUT_MS = 300;
+
+// TYPE_SET_MEM: type + addr + count
+static const int SET_MEM_HEADER_SIZE = sizeof(struct vchar64d_proto_header) + 4;
+// shorter runs of the same value are cheaper inside a TYPE_SET_MEM than in a TYPE_FILL
+static const int MIN_FILL_RUN = 12;
+
+/**
+ * @brief rleEncode compresses the buffer with the TYPE_SET_MEM_RLE encoding.
+ * Runs of 3 or more equal bytes are repeated, the rest are sent as literals
+ */
+static QByteArray rleEncode(const quint8* buf, int count)
+{
+    QByteArray encoded;
+    int i = 0;
+    while (i < count)
+    {
+        int run = 1;
+        while (i + run < count && run < 129 && buf[i + run] == buf[i])
+            run++;
+
+        if (run >= 3)
+        {
+            encoded.append((char)(0x80 | (run - 2)));
+            encoded.append((char)buf[i]);
+            i += run;
+            continue;
+        }
+
+        // literals, until the next run of 3
+        const int start = i;
+        while (i < count && i - start < 128)
+        {
+            if (i + 2 < count && buf[i] == buf[i + 1] && buf[i] == buf[i + 2])
+                break;
+            i++;
+        }
+        encoded.append((char)(i - start - 1));
+        encoded.append((const char*)&buf[start], i - start);
+    }
+    return encoded;
+}
+
 ServerPreview* ServerPreview::getInstance()
 {
     if (!__instance)
@@ -38,14 +99,24 @@ ServerPreview* ServerPreview::getInstance()
 }
 
 ServerPreview::ServerPreview()
-    : _socket(nullptr)
+    : PreviewTarget({CHARSET_ADDRESS, SCREEN_ADDRESS, -1})
+    , _socket(nullptr)
+    , _windowBytes(0)
+    , _nextSequence(0)
+    , _roundTripTime(-1)
+    , _serverVersion(-1)
+    , _waitingHello(false)
+    , _helloTimer(nullptr)
     , _bytesSent(0)
-    , _alreadyQueued(false)
-    , _readOnlyQueue(false)
+    , _bytesSaved(0)
+    , _packetsSent(0)
+    , _syncStalls(0)
+    , _stalled(false)
 {
-    // default is 1x1, 1: server must display it by itself
-    _prevTileProperties.interleaved = 1;
-    _prevTileProperties.size = {1, 1};
+    _helloTimer = new QTimer(this);
+    _helloTimer->setSingleShot(true);
+    _helloTimer->setInterval(HELLO_TIMEOUT_MS);
+    QObject::connect(_helloTimer, &QTimer::timeout, this, &ServerPreview::onHelloTimeout);
 }
 
 ServerPreview::~ServerPreview()
@@ -56,8 +127,66 @@ bool ServerPreview::isConnected()
     return (_socket && _socket->state() == QTcpSocket::ConnectedState);
 }
 
+qint64 ServerPreview::getRoundTripTime() const
+{
+    return _roundTripTime;
+}
+
+bool ServerPreview::isIdle() const
+{
+    return !_waitingHello && !_flushTimer->isActive() && !hasPendingUpdates()
+            && _commands.isEmpty() && _inFlightWindows.isEmpty();
+}
+
+qint64 ServerPreview::getPacketsSent() const
+{
+    return _packetsSent;
+}
+
+qint64 ServerPreview::getSyncStalls() const
+{
+    return _syncStalls;
+}
+
+qint64 ServerPreview::getBytesSent() const
+{
+    return _bytesSent;
+}
+
+qint64 ServerPreview::getBytesSaved() const
+{
+    return _bytesSaved;
+}
+
+bool ServerPreview::isCompressionSupported() const
+{
+    return _serverVersion >= 1;
+}
+
 bool ServerPreview::connect(const QString &ipaddress)
 {
+    resetFlowControl();
+    resetTarget();
+    _serverVersion = -1;
+    _waitingHello = false;
+    _helloTimer->stop();
+
+    // the only memory known at connection time: the screen set up by vchar64d.
+    // The charset and the tileset, both in 1x1 tiles
+    quint8 screen[40 * 25];
+    memset(screen, 0x20, sizeof(screen));
+    for (int i=0; i<256; i++)
+    {
+        screen[(i / 32) * 40 + (i % 32)] = i;
+        screen[12 * 40 + (i / 32) * 40 + (i % 32)] = i;
+    }
+    updateShadowMemory(SCREEN_ADDRESS, screen, sizeof(screen));
+
+    _bytesSent = 0;
+    _bytesSaved = 0;
+    _packetsSent = 0;
+    _syncStalls = 0;
+
     _socket = new QTcpSocket(this);
 
     QObject::connect(_socket, &QTcpSocket::connected, this, &ServerPreview::onConnected);
@@ -94,392 +223,190 @@ void ServerPreview::onReadyRead()
 #pragma pack(1)
     struct {
         struct vchar64d_proto_header header;
-        struct vchar64d_proto_ping payload;
+        union {
+            struct vchar64d_proto_ping ping;
+            struct vchar64d_proto_hello hello;
+        } payload;
     } data;
 #pragma pack(pop)
 
-    // read pong or peek
-    while (_socket->bytesAvailable() < (qint64) sizeof(data))
+    // read the pongs. Never wait for them: the rest will arrive in another readyRead
+    while (_socket->bytesAvailable() >= (qint64) sizeof(data))
     {
-        if (!_socket->waitForReadyRead(2000))
+        auto r = _socket->read((char*)&data, sizeof(data));
+        if (r<0)
         {
-            qDebug() << "Error waiting";
+            qDebug() << "Error reading";
             return;
         }
-    }
-
-    auto r = _socket->read((char*)&data, sizeof(data));
-    if (r<0)
-    {
-        qDebug() << "Error reading";
-        return;
-    }
 
-    if (data.header.type == TYPE_PONG && data.payload.something == 0)
-    {
-        _bytesSent = 0;
-        _alreadyQueued = false;
-        _readOnlyQueue = true;
-        auto it = _commands.begin();
-        while (it != _commands.end())
+        // servers older than version 1 don't answer the hello
+        if (data.header.type == TYPE_HELLO)
         {
-            auto command = *it;
-            sendOrQueueData(command->_data, command->_dataSize);
-            it = _commands.erase(it);
-            delete command;
+            _serverVersion = data.payload.hello.version;
+            finishHello();
+            continue;
         }
-        _readOnlyQueue = false;
 
-        // not supported in Qt 5.3 (needed for Travis)
-//        _commands.append(_tmpCommands);
-        for (const auto& tmpCommand: _tmpCommands)
-            _commands.append(tmpCommand);
+        if (data.header.type != TYPE_PONG
+                || _inFlightWindows.isEmpty()
+                || _inFlightWindows.head()._sequence != data.payload.ping.sequence)
+        {
+            qDebug() << "Error in ping";
+            continue;
+        }
 
-        _tmpCommands.clear();
+        auto window = _inFlightWindows.dequeue();
+        const qint64 sample = window._sentTimer.nsecsElapsed() / 1000;
+        // smoothed like TCP's SRTT (RFC 6298)
+        _roundTripTime = (_roundTripTime < 0) ? sample : (_roundTripTime * 7 + sample) / 8;
     }
-    else
-        qDebug() << "Error in ping";
+
+    // the server has room for more windows
+    sendQueuedData();
 }
 
 void ServerPreview::onConnected()
 {
     emit previewConnected();
 
-    updateCharset();
-    updateColorProperties();
-    updateTiles();    
+    // the first upload waits for the answer: it decides whether RLE can be used
+    _waitingHello = true;
+    protoHello();
+    _helloTimer->start();
 }
 
-void ServerPreview::onDisconnected()
+void ServerPreview::onHelloTimeout()
 {
-    emit previewDisconnected();
+    // version 0 server: no RLE
+    finishHello();
 }
 
-//
-void ServerPreview::updateBackgroundColor()
+void ServerPreview::finishHello()
 {
-    auto state = MainWindow::getCurrentState();
-    protoPoke(0xd020, (uchar) state->getColorForPen(State::PEN_BACKGROUND));
-    protoPoke(0xd021, (uchar) state->getColorForPen(State::PEN_BACKGROUND));
+    if (!_waitingHello)
+        return;
+
+    _waitingHello = false;
+    _helloTimer->stop();
+    flushPendingUpdates();
 }
 
-void ServerPreview::updateForegroundColorForCharset()
+void ServerPreview::onDisconnected()
 {
-    auto state = MainWindow::getCurrentState();
-    struct vchar64d_proto_header* header;
-    struct vchar64d_proto_set_mem* payload;
-
-    static const quint16 CHARS_TO_COPY = 40 * 8;
-    static const quint16 COLOR_RAM = 0xd800;
-    auto tileColors = state->getTileColors();
-
-    int size = sizeof(*header) + (sizeof(*payload) - sizeof(payload->data)) + CHARS_TO_COPY;
-    char* data = (char*) malloc(size);
-
-    header = (struct vchar64d_proto_header*) data;
-    payload = (struct vchar64d_proto_set_mem*) (data + sizeof(*header));
-    quint8* chars = (quint8*)&payload->data;
-
-    header->type = TYPE_SET_MEM;
-    payload->addr = qToLittleEndian(COLOR_RAM);
-    payload->count = qToLittleEndian(CHARS_TO_COPY);
-
-    // clean the screen memory since "fill" won't fill everything
-    memset(chars, 0x08, CHARS_TO_COPY);
-
-    for (int y=0; y<8; ++y)
-    {
-        for (int x=0; x<32; ++x)
-        {
-            chars[y * 40 + x] = tileColors[state->getTileIndexFromCharIndex(y * 32 + x)];
-        }
-    }
-
-    sendOrQueueData(data, size);
+    _waitingHello = false;
+    _helloTimer->stop();
+    discardPendingUpdates();
+    resetFlowControl();
+    emit previewDisconnected();
 }
 
-void ServerPreview::updateForegroundColorForTileset()
+void ServerPreview::sendMemory(quint16 addr, const quint8* buf, int count)
 {
-    auto state = MainWindow::getCurrentState();
-    struct vchar64d_proto_header* header;
-    struct vchar64d_proto_set_mem* payload;
-
-    static const quint16 CHARS_TO_COPY = 40 * 10;
-    static const quint16 COLOR_RAM = 0xd800 + 12 * 40;
-    auto tileColors = state->getTileColors();
-    auto currentTileProperties = state->getTileProperties();
-
-    int size = sizeof(*header) + (sizeof(*payload) - sizeof(payload->data)) + CHARS_TO_COPY;
-    char* data = (char*) malloc(size);
-
-    header = (struct vchar64d_proto_header*) data;
-    payload = (struct vchar64d_proto_set_mem*) (data + sizeof(*header));
-    quint8* chars = (quint8*)&payload->data;
+    Q_ASSERT(count <= MAX_BYTES_PER_SET_MEM && "Too many bytes");
 
-    header->type = TYPE_SET_MEM;
-    payload->addr = qToLittleEndian(COLOR_RAM);
-    payload->count = qToLittleEndian(CHARS_TO_COPY);
-
-    // clean the screen memory since "fill" won't fill everything
-    memset(chars, 0x08, CHARS_TO_COPY);
-
-    // fill the screen memory
-    int tw = currentTileProperties.size.width();
-    int th = currentTileProperties.size.height();
-
-    int max_tiles = 256 / (tw*th);
-
-    // 32 columns
-    int columns = (32 / currentTileProperties.size.width()) * currentTileProperties.size.width();
-
-
-    for (int i=0; i<max_tiles;i++)
+    if (isCompressionSupported())
     {
-        quint8 index = currentTileProperties.interleaved == 1 ?
-                    i * tw * th :
-                    i;
-        int w = (i * tw) % columns;
-        int h = th * ((i * tw) / columns);
-
-        for (int char_idx=0; char_idx < (tw * th); char_idx++)
+        auto encoded = rleEncode(buf, count);
+        if (encoded.size() < count && encoded.size() <= MAX_RLE_BYTES_PER_SET_MEM)
         {
-            int local_w = w + char_idx % tw;
-            int local_h = h + char_idx / tw;
-
-            chars[local_h * 40 + local_w] = tileColors[state->getTileIndexFromCharIndex(index)];
-
-            index += currentTileProperties.interleaved;
+            protoSetMemRLE(addr, (const quint8*)encoded.constData(), encoded.size());
+            _bytesSaved += count - encoded.size();
+            return;
         }
     }
 
-    sendOrQueueData(data, size);
+    protoSetMem(addr, buf, count);
 }
 
-void ServerPreview::updateForegroundColor()
-{
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-
-    if (state->getForegroundColorMode() == State::FOREGROUND_COLOR_GLOBAL)
-    {
-        uchar foreground = state->getColorForPen(State::PEN_FOREGROUND, -1);
-        protoFill(0xd800, foreground, 40 * 25);
-    }
-    else
-    {
-        updateForegroundColorForCharset();
-        updateForegroundColorForTileset();
-    }
-}
-
-void ServerPreview::updateMulticolor1()
-{
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    protoPoke(0xd022, (uchar) state->getColorForPen(State::PEN_MULTICOLOR1));
-}
-
-void ServerPreview::updateMulticolor2()
-{
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    protoPoke(0xd023, (uchar) state->getColorForPen(State::PEN_MULTICOLOR2));
-}
-
-void ServerPreview::updateColorMode()
-{
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    protoPoke(0xd016, state->isMulticolorMode() ? 0x18 : 0x08);
-}
-
-void ServerPreview::updateColorProperties()
+//
+// PreviewTarget
+//
+bool ServerPreview::canFlush()
 {
-    updateBackgroundColor();
-    updateMulticolor1();
-    updateMulticolor2();
-    updateForegroundColor();
-
-    updateColorMode();
+    return !_waitingHello;
 }
 
-void ServerPreview::updateCharset()
+int ServerPreview::getWriteOverhead() const
 {
-    auto state = MainWindow::getCurrentState();
-    auto charset = state->getCharsetBuffer();
-
-    // send the charset in 2 parts to avoid filling the C64 MTU buffer
-    const int segments = 2;
-    const int segmentSize = 256 / segments;
-    for (int i=0; i<segments; i++)
-    {
-        protoSetChars(segmentSize*i, &charset[segmentSize*8*i], segmentSize);
-    }
+    return SET_MEM_HEADER_SIZE;
 }
 
-void ServerPreview::updateTiles()
+void ServerPreview::writeMemory(quint16 addr, const quint8* buf, int count)
 {
-    auto currentTileProperties = MainWindow::getCurrentState()->getTileProperties();
-    if (currentTileProperties.interleaved != _prevTileProperties.interleaved || currentTileProperties.size != _prevTileProperties.size)
+    // cost model, in bytes, header included:
+    //   TYPE_POKE: 4. TYPE_FILL: 6. TYPE_SET_MEM: 5 + n. TYPE_SET_MEM_RLE: 5 + compressed n
+    while (count > 0)
     {
-        struct vchar64d_proto_header* header;
-        struct vchar64d_proto_set_mem* payload;
-
-        static const quint16 CHARS_TO_COPY = 40 * 10;
-
-        // FIXME: Fragile. Both in the c64 and c128 the screen memory
-        // was remapped to a400, but the best way to do it,
-        // is to query the server.
-        static const quint16 SCREEN_MEMORY = 0xa400 + 12 * 40;
-
-        int size = sizeof(*header) + (sizeof(*payload) - sizeof(payload->data)) + CHARS_TO_COPY;
-        char* data = (char*) malloc(size);
-
-        header = (struct vchar64d_proto_header*) data;
-        payload = (struct vchar64d_proto_set_mem*) (data + sizeof(*header));
-        quint8* chars = (quint8*)&payload->data;
-
-        header->type = TYPE_SET_MEM;
-        payload->addr = qToLittleEndian(SCREEN_MEMORY);
-        payload->count = qToLittleEndian(CHARS_TO_COPY);
-
-        // clean the screen memory since "fill" won't fill everything
-        memset(chars, 0x20, CHARS_TO_COPY);
-
-        // fill the screen memory
-        int tw = currentTileProperties.size.width();
-        int th = currentTileProperties.size.height();
-
-        int max_tiles = 256 / (tw*th);
-
-        // 32 columns
-        int columns = (32 / currentTileProperties.size.width()) * currentTileProperties.size.width();
+        int same = 1;
+        while (same < count && buf[same] == buf[0])
+            same++;
 
+        if (same == count)
+        {
+            if (count == 1)
+                protoPoke(addr, buf[0]);
+            else
+                protoFill(addr, buf[0], count);
+            return;
+        }
 
-        for (int i=0; i<max_tiles;i++)
+        // without compression, splitting a TYPE_SET_MEM to insert a TYPE_FILL
+        // costs 11 bytes: it is worth it for longer runs of the same value
+        if (!isCompressionSupported() && same >= MIN_FILL_RUN)
         {
-            quint8 index = currentTileProperties.interleaved == 1 ?
-                        i * tw * th :
-                        i;
-            int w = (i * tw) % columns;
-            int h = th * ((i * tw) / columns);
+            protoFill(addr, buf[0], same);
+            addr += same;
+            buf += same;
+            count -= same;
+            continue;
+        }
 
-            for (int char_idx=0; char_idx < (tw * th); char_idx++)
+        int len = qMin(count, MAX_BYTES_PER_SET_MEM);
+        if (!isCompressionSupported())
+        {
+            // until the next run worth a TYPE_FILL
+            int run = 1;
+            for (int j=1; j<len; j++)
             {
-                int local_w = w + char_idx % tw;
-                int local_h = h + char_idx / tw;
-
-                chars[local_h * 40 + local_w] = index;
-
-                index += currentTileProperties.interleaved;
+                run = (buf[j] == buf[j - 1]) ? run + 1 : 1;
+                if (run == MIN_FILL_RUN)
+                {
+                    len = j - MIN_FILL_RUN + 1;
+                    break;
+                }
             }
         }
 
-        sendOrQueueData(data, size);
-
-        _prevTileProperties = currentTileProperties;
-    }
-}
-
-void ServerPreview::fileLoaded()
-{
-    if(!isConnected()) return;
-
-    // flush queued commands
-    for (auto it=_tmpCommands.begin(); it!=_tmpCommands.end();)
-    {
-        auto command = *it;
-        free(command->_data);
-        it = _tmpCommands.erase(it);
-        delete command;
-    }
-    _tmpCommands.clear();
-
-
-    // flush queued commands
-    for (auto it=_commands.begin(); it!=_commands.end();)
-    {
-        auto command = *it;
-        free(command->_data);
-        it = _commands.erase(it);
-        delete command;
+        sendMemory(addr, buf, len);
+        addr += len;
+        buf += len;
+        count -= len;
     }
-    _commands.clear();
-
-    _bytesSent = 0;
-    _alreadyQueued = false;
-
-    updateCharset();
-    updateColorProperties();
-    updateTiles();
 }
 
-void ServerPreview::bytesUpdated(int pos, int count)
-{
-    if(!isConnected()) return;
-
-    if (pos % 8 != 0 || count % 8 != 0)
-    {
-        qDebug() << "Invalid values for bytesUpdated:" << pos << count;
-        return;
-    }
-    auto state = MainWindow::getCurrentState();
-
-    protoSetChars(pos/8, state->getCharAtIndex(pos/8), count/8);
-}
-
-void ServerPreview::tileUpdated(int tileIndex)
-{
-    if(!isConnected()) return;
-    auto state = MainWindow::getCurrentState();
-
-    State::TileProperties properties = state->getTileProperties();
-
-    int charIndex = state->getCharIndexFromTileIndex(tileIndex);
-    int numChars = properties.size.width() * properties.size.height();
-
-    if(properties.interleaved == 1) {
-        protoSetChars(charIndex, state->getCharAtIndex(charIndex), numChars);
-    }
-    else {
-        for(int sent=0; sent<numChars; sent++) {
-            protoSetChars(charIndex, state->getCharAtIndex(charIndex), 1);
-            charIndex += properties.interleaved;
-        }
-    }
-}
+//
+// Proto methods
+//
 
-void ServerPreview::colorPropertiesUpdated(int pen)
+void ServerPreview::protoHello()
 {
-    if(!isConnected()) return;
-    updateColorMode();
-
-    if (pen == State::PEN_FOREGROUND)
-        updateForegroundColor();
-}
+#pragma pack(push)
+#pragma pack(1)
+    struct _data {
+        struct vchar64d_proto_header header;
+        struct vchar64d_proto_hello payload;
+    };
+#pragma pack(pop)
 
-void ServerPreview::multicolorModeUpdated(bool toggled)
-{
-    Q_UNUSED(toggled);
-    updateColorMode();
-}
+    struct _data* data = (struct _data*) malloc(sizeof(*data));
 
-void ServerPreview::tilePropertiesUpdated()
-{
-    if(!isConnected()) return;
-    updateTiles();
-    updateForegroundColor();
+    data->header.type = TYPE_HELLO;
+    data->payload.version = PROTO_VERSION;
+    sendOrQueueData((char*)data, sizeof(*data));
 }
 
-//
-// Proto methods
-//
-
-void  ServerPreview::protoPing(quint8 pingValue)
+void ServerPreview::protoPing(quint8 sequence)
 {
 #pragma pack(push)
 #pragma pack(1)
@@ -492,31 +419,8 @@ void  ServerPreview::protoPing(quint8 pingValue)
     struct _data* data = (struct _data*) malloc(sizeof(*data));
 
     data->header.type = TYPE_PING;
-    data->payload.something = pingValue;
+    data->payload.sequence = sequence;
     sendData((char*)data, sizeof(*data));
-
-//    _socket->waitForBytesWritten();
-//    while (_socket->bytesAvailable() < (qint64) sizeof(data))
-//    {
-//        if (!_socket->waitForReadyRead(2000))
-//        {
-//            qDebug() << "Error waiting";
-//            return;
-//        }
-//    }
-
-//    memset(&data, 0, sizeof(data));
-//    auto r = _socket->read((char*)&data, sizeof(data));
-//    if (r<0)
-//    {
-//        qDebug() << "Error reading";
-//        return;
-//    }
-
-//    if (data.header.type == TYPE_PONG && data.payload.something == pingValue)
-//        return;
-
-//    qDebug() << "Error in ping";
 }
 
 void ServerPreview::protoPoke(quint16 addr, quint8 value)
@@ -559,84 +463,55 @@ void ServerPreview::protoFill(quint16 addr, quint8 value, quint16 count)
     data->header.type = TYPE_FILL;
     data->payload.addr = qToLittleEndian(addr);
     data->payload.value = value;
-    data->payload.count = count;
+    data->payload.count = qToLittleEndian(count);
     sendOrQueueData((char*)data, sizeof(*data));
 }
 
-void ServerPreview::protoSetByte(quint16 addr, quint8 value)
+void ServerPreview::protoSetMem(quint16 addr, const quint8* buf, quint16 count)
 {
-#pragma pack(push)
-#pragma pack(1)
-    struct _data {
-        struct vchar64d_proto_header header;
-        struct vchar64d_proto_set_byte payload;
-    };
-#pragma pack(pop)
-
-    struct _data* data = (struct _data*) malloc(sizeof(*data));
-
-    data->header.type = TYPE_SET_BYTE_FOR_CHAR;
-    data->payload.idx = qToLittleEndian(addr);
-    data->payload.byte = value;
-    sendOrQueueData((char*)data, sizeof(*data));
-}
+    struct vchar64d_proto_header* header;
+    struct vchar64d_proto_set_mem* payload;
 
-void ServerPreview::protoSetChar(int charIdx, const quint8 *charBuf)
-{
-#pragma pack(push)
-#pragma pack(1)
-    struct _data {
-        struct vchar64d_proto_header header;
-        struct vchar64d_proto_set_char payload;
-    };
-#pragma pack(pop)
+    int size = sizeof(*header) + (sizeof(*payload) - sizeof(payload->data)) + count;
+    char* data = (char*) malloc(size);
 
-    struct _data* data = (struct _data*) malloc(sizeof(*data));
+    header = (struct vchar64d_proto_header*) data;
+    payload = (struct vchar64d_proto_set_mem*) (data + sizeof(*header));
 
-    data->header.type = TYPE_SET_CHAR;
-    data->payload.idx = charIdx;
-    memcpy(data->payload.chardata, charBuf, sizeof(data->payload.chardata));
+    header->type = TYPE_SET_MEM;
+    payload->addr = qToLittleEndian(addr);
+    payload->count = qToLittleEndian(count);
+    memcpy(&payload->data, buf, count);
 
-    sendOrQueueData((char*)data, sizeof(*data));
+    sendOrQueueData(data, size);
 }
 
-void ServerPreview::protoSetChars(int charIdx, const quint8* charBuf, int totalChars)
+void ServerPreview::protoSetMemRLE(quint16 addr, const quint8* encodedBuf, quint16 encodedCount)
 {
     struct vchar64d_proto_header* header;
-    struct vchar64d_proto_set_chars* payload;
+    struct vchar64d_proto_set_mem_rle* payload;
 
-    int size = sizeof(*header) + (sizeof(*payload) - sizeof(payload->charsdata)) + totalChars * 8;
+    int size = sizeof(*header) + (sizeof(*payload) - sizeof(payload->data)) + encodedCount;
     char* data = (char*) malloc(size);
 
     header = (struct vchar64d_proto_header*) data;
-    payload = (struct vchar64d_proto_set_chars*) (data + sizeof(*header));
+    payload = (struct vchar64d_proto_set_mem_rle*) (data + sizeof(*header));
 
-    header->type = TYPE_SET_CHARS;
-    payload->idx = charIdx;
-    payload->count = totalChars;
-    memcpy(&payload->charsdata, charBuf, totalChars * 8);
+    header->type = TYPE_SET_MEM_RLE;
+    payload->addr = qToLittleEndian(addr);
+    payload->count = qToLittleEndian(encodedCount);
+    memcpy(&payload->data, encodedBuf, encodedCount);
 
     sendOrQueueData(data, size);
 }
 
 void ServerPreview::sendOrQueueData(char* buffer, int bufferSize)
 {
-    if (_alreadyQueued || _bytesSent + bufferSize > VCHAR64_SERVER_BUFFER_SIZE)
-    {
-        // won't enter into infinite loop since
-        // it will go directly to sendData() and sendData() doesn't sync
-        if (!_alreadyQueued)
-            protoPing(0);
-        if (_readOnlyQueue)
-            _tmpCommands.append(new ServerCommand(buffer, bufferSize));
-        else
-            _commands.append(new ServerCommand(buffer, bufferSize));
-        _alreadyQueued = true;
-    }
-    else
-    {
-        sendData(buffer, bufferSize);
-    }
+    Q_ASSERT(bufferSize <= WINDOW_SIZE && "Command doesn't fit in a window");
+
+    // keep the order: queued commands go first
+    _commands.enqueue(new ServerCommand(buffer, bufferSize));
+    sendQueuedData();
 }
 
 void ServerPreview::sendData(char* buffer, int bufferSize)
@@ -644,4 +519,65 @@ void ServerPreview::sendData(char* buffer, int bufferSize)
     _socket->write(buffer, bufferSize);
     free(buffer);
     _bytesSent += bufferSize;
+    _packetsSent++;
+}
+
+//
+// Flow control: the data is sent in windows that fit in the server buffer.
+// Each window is closed with a ping. A new window is opened only when
+// less than MAX_WINDOWS_IN_FLIGHT windows are waiting for their pong.
+//
+void ServerPreview::sendQueuedData()
+{
+    while (!_commands.isEmpty())
+    {
+        auto command = _commands.head();
+        if (_windowBytes + command->_dataSize > WINDOW_SIZE)
+            closeWindow();
+
+        // a new window is opened only if the server has room for it
+        if (_windowBytes == 0 && _inFlightWindows.size() >= MAX_WINDOWS_IN_FLIGHT)
+        {
+            if (!_stalled)
+                _syncStalls++;
+            _stalled = true;
+            break;
+        }
+
+        _stalled = false;
+        _commands.dequeue();
+        sendData(command->_data, command->_dataSize);
+        _windowBytes += command->_dataSize;
+        delete command;
+    }
+}
+
+void ServerPreview::closeWindow()
+{
+    InFlightWindow window;
+    window._sequence = _nextSequence++;
+    window._sentTimer.start();
+    _inFlightWindows.enqueue(window);
+
+    protoPing(window._sequence);
+    _windowBytes = 0;
+}
+
+void ServerPreview::resetFlowControl()
+{
+    discardQueuedData();
+    _inFlightWindows.clear();
+    _windowBytes = 0;
+    _roundTripTime = -1;
+    _stalled = false;
+}
+
+void ServerPreview::discardQueuedData()
+{
+    for (auto command: _commands)
+    {
+        free(command->_data);
+        delete command;
+    }
+    _commands.clear();
 }
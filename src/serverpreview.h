@@ -16,81 +16,91 @@ limitations under the License.
 
 #pragma once
 
-#include <QObject>
-#include <QVector>
+#include <QElapsedTimer>
+#include <QQueue>
 
-#include "state.h"
+#include "previewtarget.h"
 
 QT_BEGIN_NAMESPACE
 class QTcpSocket;
+class QTimer;
 QT_END_NAMESPACE
 
-class ServerPreview : public QObject
+/**
+ * @brief The ServerPreview class a C64 running vchar64d, connected by TCP
+ */
+class ServerPreview : public PreviewTarget
 {
     Q_OBJECT
 
 public:
     static ServerPreview* getInstance();
-    bool isConnected();
+    bool isConnected() override;
     bool connect(const QString& ipaddress);
     void disconnect();
 
-signals:
-    void previewConnected();
-    void previewDisconnected();
+    /**
+     * @brief getRoundTripTime smoothed time between a ping and its pong
+     * @return the time in microseconds, or -1 if no pong was received yet
+     */
+    qint64 getRoundTripTime() const;
+
+    /** @brief isIdle true when everything was sent and acknowledged by the server */
+    bool isIdle() const;
+
+    /** @brief getPacketsSent packets written to the server since the connection, including the pings */
+    qint64 getPacketsSent() const;
+    /** @brief getSyncStalls times the sending stopped waiting for a pong */
+    qint64 getSyncStalls() const;
+    /** @brief getBytesSent bytes written to the server since the connection, including the pings */
+    qint64 getBytesSent() const;
+    /** @brief getBytesSaved bytes not sent thanks to the compression */
+    qint64 getBytesSaved() const;
+    /** @brief isCompressionSupported whether the server understands TYPE_SET_MEM_RLE */
+    bool isCompressionSupported() const;
 
 public slots:
     void onBytesWritten(qint64 bytes);
     void onReadyRead();
     void onConnected();
     void onDisconnected();
-
-    // file loaded, or new project
-    void fileLoaded();
-
-    // when a range of bytes in the charset changes (e.g. due to a paste)
-    void bytesUpdated(int pos, int count);
-
-    // when the whole tile changes
-    void tileUpdated(int tileIndex);
-
-    // multi-color / hires or new colors
-    void colorPropertiesUpdated(int pen);
-
-    void multicolorModeUpdated(bool toggled);
-    void tilePropertiesUpdated();
+    void onHelloTimeout();
 
 protected:
     ServerPreview();
     virtual ~ServerPreview();
 
+    // PreviewTarget
+    bool canFlush() override;
+    void writeMemory(quint16 addr, const quint8* buf, int count) override;
+    int getWriteOverhead() const override;
+
     // Proto: generic
     void protoPoke(quint16 addr, quint8 value);
     void protoPeek(quint16 addr, const quint8* value);
     void protoFill(quint16 addr, quint8 value, quint16 count);
+    void protoHello();
     // don't call it directly. It is used internally for syncing purposes
-    void protoPing(quint8 pingValue);
+    void protoPing(quint8 sequence);
+
+    // Proto: memory
+    void protoSetMem(quint16 addr, const quint8* buf, quint16 count);
+    void protoSetMemRLE(quint16 addr, const quint8* encodedBuf, quint16 encodedCount);
 
-    // Proto: chars related
-    void protoSetByte(quint16 addr, quint8 value);
-    void protoSetChar(int charIdx, const quint8 *charBuf);
-    void protoSetChars(int charIdx, const quint8 *charBuf, int totalChars);
+    // send with TYPE_SET_MEM_RLE when the server supports it and it is smaller
+    void sendMemory(quint16 addr, const quint8* buf, int count);
+
+    // the server answered the hello, or it is too old to answer it
+    void finishHello();
 
     void sendOrQueueData(char* buffer, int bufferSize);
     void sendData(char* buffer, int bufferSize);
 
-    //
-
-    void updateBackgroundColor();
-    void updateForegroundColor();
-    void updateForegroundColorForCharset();
-    void updateForegroundColorForTileset();
-    void updateMulticolor1();
-    void updateMulticolor2();
-    void updateColorMode();
-    void updateCharset();
-    void updateTiles();
-    void updateColorProperties();
+    // flow control
+    void sendQueuedData();
+    void closeWindow();
+    void resetFlowControl();
+    void discardQueuedData();
 
     class ServerCommand
     {
@@ -104,12 +114,31 @@ protected:
 
     };
 
+    class InFlightWindow
+    {
+    public:
+        quint8 _sequence;
+        QElapsedTimer _sentTimer;
+    };
+
     QTcpSocket* _socket;
-    int _bytesSent;
-    bool _alreadyQueued;
-    bool _readOnlyQueue;
-    State::TileProperties _prevTileProperties;
 
-    QVector<ServerCommand*> _commands;
-    QVector<ServerCommand*> _tmpCommands;
+    // bytes sent in the window that is still open
+    int _windowBytes;
+    quint8 _nextSequence;
+    qint64 _roundTripTime;
+    // protocol version of the server. -1 until it answers the hello
+    int _serverVersion;
+    // nothing is sent until the hello is answered: the encoding depends on the version
+    bool _waitingHello;
+    QTimer* _helloTimer;
+    qint64 _bytesSent;
+    qint64 _bytesSaved;
+    qint64 _packetsSent;
+    qint64 _syncStalls;
+    bool _stalled;
+    // windows closed with a ping, waiting for their pong
+    QQueue<InFlightWindow> _inFlightWindows;
+    // commands that don't fit in the open windows
+    QQueue<ServerCommand*> _commands;
 };
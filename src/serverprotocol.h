@@ -48,7 +48,10 @@ enum {
     TYPE_FILL,
     TYPE_PING,
     TYPE_PONG,
-    TYPE_BYEBYE
+    TYPE_BYEBYE,
+
+    // protocol version 1
+    TYPE_SET_MEM_RLE
 };
 
 struct vchar64d_proto_poke
@@ -64,6 +67,17 @@ struct vchar64d_proto_set_mem
     uint8_t* data;
 };
 
+// RLE compressed memory. count is the size of the compressed data.
+// Each run starts with a control byte:
+//   0x00-0x7f: (n + 1) literal bytes follow
+//   0x80-0xff: the next byte is repeated (n & 0x7f) + 2 times
+struct vchar64d_proto_set_mem_rle
+{
+    uint16_t addr;
+    uint16_t count;
+    uint8_t* data;
+};
+
 struct vchar64d_proto_fill
 {
     uint16_t addr;
@@ -93,13 +107,15 @@ struct vchar64d_proto_set_chars
     uint8_t* charsdata;
 };
 
-// a synced ping
+// a synced ping. The server answers with a TYPE_PONG
+// that echoes the sequence number
 struct vchar64d_proto_ping
 {
-    uint8_t something;
+    uint8_t sequence;
 };
 
-#define PROTO_VERSION 0x00
+// 0x01: TYPE_SET_MEM_RLE. The server answers the hello with its version
+#define PROTO_VERSION 0x01
 struct vchar64d_proto_hello
 {
     uint8_t version;
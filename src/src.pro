@@ -51,100 +51,18 @@ DEFINES += GIT_VERSION=\\\"$$GIT_VERSION\\\" VERSION=\\\"$$VERSION\\\"
 CONFIG += c++11
 CONFIG += debug_and_release
 
+include(../core/core.pri)
 
-SOURCES += \
-    aboutdialog.cpp \
-    autoupdater.cpp \
-    bigcharwidget.cpp \
-    charsetwidget.cpp \
-    colorrectwidget.cpp \
-    commands.cpp \
-    exportdialog.cpp \
-    fileutils.cpp \
-    importkoalabitmapwidget.cpp \
-    importkoalacharsetwidget.cpp \
-    importkoaladialog.cpp \
-    importvicecharsetwidget.cpp \
-    importvicedialog.cpp \
-    importvicescreenramwidget.cpp \
-    main.cpp\
-    mainwindow.cpp \
-    mappropertiesdialog.cpp \
-    mapwidget.cpp \
-    palette.cpp \
-    palettewidget.cpp \
-    preferences.cpp \
-    preferencesdialog.cpp \
-    selectcolordialog.cpp \
-    serverconnectdialog.cpp \
-    serverpreview.cpp \
-    state.cpp \
-    stateexport.cpp \
-    stateimport.cpp \
-    tilepropertiesdialog.cpp \
-    tilesetwidget.cpp \
-    updatedialog.cpp \
-    utils.cpp \
-    vchar64application.cpp \
-    xlinkpreview.cpp
-
-HEADERS  += \
-    aboutdialog.h \
-    autoupdater.h \
-    bigcharwidget.h \
-    charsetwidget.h \
-    colorrectwidget.h \
-    commands.h \
-    exportdialog.h \
-    fileutils.h \
-    importkoalabitmapwidget.h \
-    importkoalacharsetwidget.h \
-    importkoaladialog.h \
-    importvicecharsetwidget.h \
-    importvicedialog.h \
-    importvicescreenramwidget.h \
-    mainwindow.h \
-    mappropertiesdialog.h \
-    mapwidget.h \
-    palette.h \
-    palettewidget.h \
-    preferences.h \
-    preferencesdialog.h \
-    selectcolordialog.h \
-    serverconnectdialog.h \
-    serverpreview.h \
-    serverprotocol.h \
-    state.h \
-    stateexport.h \
-    stateimport.h \
-    tilepropertiesdialog.h \
-    tilesetwidget.h \
-    updatedialog.h \
-    utils.h \
-    vchar64application.h \
-    xlinkpreview.h
+include(gui.pri)
 
-FORMS    += \
-    aboutdialog.ui \
-    exportdialog.ui \
-    importkoaladialog.ui \
-    importvicedialog.ui \
-    mainwindow.ui \
-    mappropertiesdialog.ui \
-    preferencesdialog.ui \
-    selectcolordialog.ui \
-    serverconnectdialog.ui \
-    tilepropertiesdialog.ui \
-    updatedialog.ui
+SOURCES += \
+    main.cpp
 
 INCLUDEPATH += src
 
 DISTFILES += \
     res/vchar64-icon-mac.icns
 
-RESOURCES += \
-    resources.qrc
-
 !win32 {
     QMAKE_CXXFLAGS += -Werror
 }
@@ -271,15 +271,22 @@ void TilesetWidget::paintEvent(QPaintEvent *event)
 
     int max_tiles = 256 / (tw*th);
 
+    // only the tiles that intersect the exposed rect are drawn
+    const QRectF exposed(event->rect().x() / _zoomLevel, event->rect().y() / _zoomLevel,
+                         event->rect().width() / _zoomLevel, event->rect().height() / _zoomLevel);
+
     for (int i=0; i<max_tiles;i++)
     {
+        int w = (i * tw) % _columns;
+        int h = th * ((i * tw) / _columns);
+
+        if (!exposed.intersects(QRectF(w * 8 + OFFSET, h * 8 + OFFSET, tw * 8, th * 8)))
+            continue;
+
         quint8 charIdx = tileProperties.interleaved == 1 ?
                                                     i * tw * th :
                                                     i;
 
-        int w = (i * tw) % _columns;
-        int h = th * ((i * tw) / _columns);
-
         for (int char_idx=0; char_idx < (tw * th); char_idx++)
         {
             int local_w = w + char_idx % tw;
@@ -299,13 +306,19 @@ void TilesetWidget::paintEvent(QPaintEvent *event)
         pen.setWidthF(1.0 / _zoomLevel);
         painter.setPen(pen);
 
-        for (int y=0; y <= _tileRows; ++y)
-            painter.drawLine(QPointF(0 + OFFSET, y * 8 * th + OFFSET),
-                             QPointF(_tileColumns * 8 * tw + OFFSET, y * 8 * th + OFFSET));
+        // lines outside the exposed rect are skipped
+        const int firstRow = qBound(0, qFloor((exposed.top() - OFFSET) / (8 * th)), _tileRows);
+        const int lastRow = qBound(0, qCeil((exposed.bottom() - OFFSET) / (8 * th)), _tileRows);
+        const int firstColumn = qBound(0, qFloor((exposed.left() - OFFSET) / (8 * tw)), _tileColumns);
+        const int lastColumn = qBound(0, qCeil((exposed.right() - OFFSET) / (8 * tw)), _tileColumns);
+
+        for (int y=firstRow; y <= lastRow; ++y)
+            painter.drawLine(QPointF(firstColumn * 8 * tw + OFFSET, y * 8 * th + OFFSET),
+                             QPointF(lastColumn * 8 * tw + OFFSET, y * 8 * th + OFFSET));
 
-        for (int x=0; x <= _tileColumns; ++x)
-            painter.drawLine(QPointF(x * 8 * tw + OFFSET, OFFSET),
-                             QPointF(x * 8 * tw + OFFSET, _tileRows * 8 * th + OFFSET));
+        for (int x=firstColumn; x <= lastColumn; ++x)
+            painter.drawLine(QPointF(x * 8 * tw + OFFSET, firstRow * 8 * th + OFFSET),
+                             QPointF(x * 8 * tw + OFFSET, lastRow * 8 * th + OFFSET));
     }
 
     painter.setPen(Qt::NoPen);
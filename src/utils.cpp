@@ -16,91 +16,42 @@ limitations under the License.
 
 #include "utils.h"
 
+#include <cstring>
+
 #include <QDebug>
+#include <QImage>
 #include <QPainter>
 #include <QPoint>
 #include <QSize>
 #include <QtCore/qmath.h>
 
-#include "palette.h"
+#include "chardecoder.h"
 #include "state.h"
 
 void utilsDrawCharInPainter(State* state, QPainter* painter, const QSizeF& pixelSize, const QPoint& offset, const QPoint& orig, int charIdx)
 {
     Q_ASSERT(charIdx >=0 && charIdx < 256 && "Invalid charIdx");
 
-    static const quint8 mc_masks[] = {192, 48, 12, 3};
-    static const quint8 hr_masks[] = {128, 64, 32, 16, 8, 4, 2, 1};
-
     auto charset = state->getCharsetBuffer();
-    auto tileColors = state->getTileColors();
-    int tileIdx = state->getTileIndexFromCharIndex(charIdx);
-    auto ismc = state->shouldBeDisplayedInMulticolor2(tileIdx);
+    const auto& resolved = state->getResolvedPens(state->getTileIndexFromCharIndex(charIdx));
+    const bool ismc = resolved.multicolor;
 
-    auto chardef = &charset[charIdx * 8];
+    QColor colors[State::PEN_MAX];
+    for (int pen=0; pen<State::PEN_MAX; ++pen)
+        colors[pen] = QColor(resolved.rgb[pen][0], resolved.rgb[pen][1], resolved.rgb[pen][2]);
 
-    for (int i=0; i<8; ++i)
-    {
-        auto byte = chardef[i];
+    quint8 pens[64];
+    CharDecoder::decodeChar(&charset[charIdx * 8], ismc, pens);
 
-        int char_width = 8;
-        int bit_width = 1;      /* 8 = 8 * 1 */
-        const quint8* masks = &hr_masks[0];
+    // multicolor pixels are twice as wide: draw every other pen
+    const int bit_width = ismc ? 2 : 1;
 
-        if (ismc)
-        {
-            char_width = 4;
-            bit_width = 2;    /* 8 = 4 * 2 */
-            masks = mc_masks;
-        }
-
-        for (int j=0; j<char_width; ++j)
+    for (int i=0; i<8; ++i)
+    {
+        for (int j=0; j<8; j+=bit_width)
         {
-            quint8 colorIndex = 0;
-            // get the two bits that reprent the color
-            quint8 color = byte & masks[j];
-            color >>= (8 - bit_width) - j * bit_width;
-
-            switch (color)
-            {
-            // bitmask 00: background ($d021)
-            case 0x0:
-                colorIndex = state->getColorForPen(State::PEN_BACKGROUND);
-                break;
-
-            // bitmask 01: multicolor #1 ($d022)
-            case 0x1:
-                if (ismc)
-                    colorIndex = state->getColorForPen(State::PEN_MULTICOLOR1);
-                else
-                {
-                    if (state->getForegroundColorMode() == State::FOREGROUND_COLOR_GLOBAL)
-                        colorIndex = state->getColorForPen(State::PEN_FOREGROUND);
-                    else
-                        colorIndex = tileColors[tileIdx];
-                }
-                break;
-
-            // bitmask 10: multicolor #2 ($d023)
-            case 0x2:
-                Q_ASSERT(ismc && "error in logic");
-                colorIndex = state->getColorForPen(State::PEN_MULTICOLOR2);
-                break;
-
-            // bitmask 11: color RAM
-            case 0x3:
-                Q_ASSERT(ismc && "error in logic");
-                if (state->getForegroundColorMode() == State::FOREGROUND_COLOR_GLOBAL)
-                    colorIndex = state->getColorForPen(State::PEN_FOREGROUND) - 8;
-                else
-                    colorIndex = tileColors[tileIdx] - 8;
-                break;
-            default:
-                qDebug() << "utilsDrawCharInPainter: Invalid color: " << color << " at x,y=" << orig;
-                break;
-            }
-            painter->setBrush(Palette::getColor(colorIndex));
-            painter->drawRect( (orig.x() * 8 + j * bit_width) * pixelSize.width() + offset.x(),
+            painter->setBrush(colors[pens[i * 8 + j]]);
+            painter->drawRect( (orig.x() * 8 + j) * pixelSize.width() + offset.x(),
                              (orig.y() * 8 + i) * pixelSize.height() + offset.y(),
                              qCeil(pixelSize.width() * bit_width),
                              qCeil(pixelSize.height()));
@@ -108,87 +59,46 @@ void utilsDrawCharInPainter(State* state, QPainter* painter, const QSizeF& pixel
     }
 }
 
-void utilsDrawCharInImage(State* state, QImage* image, const QPoint& offset, int charIdx)
+void utilsDrawCharInImage(State* state, QImage* image, const QPoint& offset, int charIdx, int bank)
 {
     Q_ASSERT(charIdx >=0 && charIdx < 256 && "Invalid charIdx");
+    Q_ASSERT(offset.x() >= 0 && offset.x() + 8 <= image->width()
+             && offset.y() >= 0 && offset.y() + 8 <= image->height()
+             && "Char outside image");
 
-    static const quint8 mc_masks[] = {192, 48, 12, 3};
-    static const quint8 hr_masks[] = {128, 64, 32, 16, 8, 4, 2, 1};
-
-    auto charset = state->getCharsetBuffer();
-    auto tileColors = state->getTileColors();
-    int tileIdx = state->getTileIndexFromCharIndex(charIdx);
-    auto ismc = state->shouldBeDisplayedInMulticolor2(tileIdx);
-
-    auto chardef = &charset[charIdx * 8];
+    // pre-decoded by State. Only decoded again when the char or its colors change
+    auto charImage = (bank == -1) ? state->getCharImage(charIdx) : state->getCharImage(bank, charIdx);
 
-    for (int i=0; i<8; ++i)
+    if (image->format() == QImage::Format_RGB888)
     {
-        auto byte = chardef[i];
-
-        int char_width = 8;
-        int bit_width = 1;      /* 8 = 8 * 1 */
-        const quint8* masks = &hr_masks[0];
-
-        if (ismc)
+        for (int i=0; i<8; ++i)
         {
-            char_width = 4;
-            bit_width = 2;    /* 8 = 4 * 2 */
-            masks = mc_masks;
+            memcpy(image->scanLine(i + offset.y()) + offset.x() * 3,
+                   &charImage[i * State::CHAR_IMAGE_SCANLINE_SIZE],
+                   State::CHAR_IMAGE_SCANLINE_SIZE);
         }
-
-        for (int j=0; j<char_width; ++j)
+    }
+    else if (image->format() == QImage::Format_ARGB32_Premultiplied
+             || image->format() == QImage::Format_ARGB32
+             || image->format() == QImage::Format_RGB32)
+    {
+        // pixels are opaque: the same value in the three formats
+        for (int i=0; i<8; ++i)
+        {
+            auto scanline = &charImage[i * State::CHAR_IMAGE_SCANLINE_SIZE];
+            auto dst = reinterpret_cast<QRgb*>(image->scanLine(i + offset.y())) + offset.x();
+            for (int j=0; j<8; ++j)
+                dst[j] = qRgb(scanline[j*3], scanline[j*3+1], scanline[j*3+2]);
+        }
+    }
+    else
+    {
+        for (int i=0; i<8; ++i)
         {
-            quint8 colorIndex = 0;
-            // get the two bits that reprent the color
-            quint8 color = byte & masks[j];
-            color >>= (8 - bit_width) - j * bit_width;
-
-            switch (color)
-            {
-            // bitmask 00: background ($d021)
-            case 0x0:
-                colorIndex = state->getColorForPen(State::PEN_BACKGROUND);
-                break;
-
-            // bitmask 01: multicolor #1 ($d022)
-            case 0x1:
-                if (ismc)
-                    colorIndex = state->getColorForPen(State::PEN_MULTICOLOR1);
-                else
-                {
-                    if (state->getForegroundColorMode() == State::FOREGROUND_COLOR_GLOBAL)
-                        colorIndex = state->getColorForPen(State::PEN_FOREGROUND);
-                    else
-                        colorIndex = tileColors[tileIdx];
-                }
-                break;
-
-            // bitmask 10: multicolor #2 ($d023)
-            case 0x2:
-                Q_ASSERT(ismc && "error in logic");
-                colorIndex = state->getColorForPen(State::PEN_MULTICOLOR2);
-                break;
-
-            // bitmask 11: color RAM
-            case 0x3:
-                Q_ASSERT(ismc && "error in logic");
-                if (state->getForegroundColorMode() == State::FOREGROUND_COLOR_GLOBAL)
-                    colorIndex = state->getColorForPen(State::PEN_FOREGROUND) - 8;
-                else
-                    colorIndex = tileColors[tileIdx] - 8;
-                break;
-            default:
-                qDebug() << "utilsDrawCharInImage: Invalid color: " << color;
-                break;
-            }
-            auto rgb = Palette::getColor(colorIndex).rgb();
-            if (ismc) {
-                image->setPixel(j * 2 + offset.x(), i + offset.y(), rgb);
-                image->setPixel(j * 2 + 1 + offset.x(), i + offset.y(), rgb);
-            } else {
-                image->setPixel(j + offset.x(), i + offset.y(), rgb);
-            }
+            auto scanline = &charImage[i * State::CHAR_IMAGE_SCANLINE_SIZE];
+            for (int j=0; j<8; ++j)
+                image->setPixel(j + offset.x(), i + offset.y(),
+                                qRgb(scanline[j*3], scanline[j*3+1], scanline[j*3+2]));
         }
     }
 }
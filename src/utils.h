@@ -28,5 +28,6 @@ QT_END_NAMESPACE
 class State;
 
 void utilsDrawCharInPainter(State* state, QPainter* painter, const QSizeF& pixelSize, const QPoint& offset, const QPoint &orig, int charIdx);
-void utilsDrawCharInImage(State* state, QImage* image, const QPoint &offset, int charIdx);
+// bank: -1 for the selected bank
+void utilsDrawCharInImage(State* state, QImage* image, const QPoint &offset, int charIdx, int bank=-1);
 quint8 utilsAsciiToScreenCode(quint8 ascii);
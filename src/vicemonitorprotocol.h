@@ -0,0 +1,100 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * VICE binary remote monitor protocol, API version 2 (VICE 3.5 or newer).
+ * Enabled with: x64sc -binarymonitor -binarymonitoraddress ip4://127.0.0.1:6502
+ * All the integers are little endian.
+ * Any command stops the emulation until VICE_MONITOR_CMD_EXIT is received.
+ */
+
+#define VICE_MONITOR_LISTEN_PORT 6502
+
+#define VICE_MONITOR_STX 0x02
+#define VICE_MONITOR_API_VERSION 0x02
+
+// request id of the events sent by VICE, like VICE_MONITOR_RESPONSE_STOPPED
+#define VICE_MONITOR_EVENT_REQUEST_ID 0xffffffff
+
+#pragma pack(push)
+#pragma pack(1)
+
+struct vice_monitor_command_header
+{
+    uint8_t stx;
+    uint8_t api_version;
+    // size of the body that follows the header
+    uint32_t body_length;
+    uint32_t request_id;
+    uint8_t command_type;
+};
+
+struct vice_monitor_response_header
+{
+    uint8_t stx;
+    uint8_t api_version;
+    // size of the body that follows the header
+    uint32_t body_length;
+    // the command type, or one of the events
+    uint8_t response_type;
+    uint8_t error_code;
+    uint32_t request_id;
+};
+
+// followed by the (end_address - start_address + 1) bytes to write
+struct vice_monitor_memory_set
+{
+    uint8_t side_effects;
+    uint16_t start_address;
+    // inclusive
+    uint16_t end_address;
+    uint8_t memspace;
+    uint16_t bank_id;
+};
+
+#pragma pack(pop)
+
+enum {
+    VICE_MONITOR_CMD_MEMORY_GET = 0x01,
+    VICE_MONITOR_CMD_MEMORY_SET = 0x02,
+    VICE_MONITOR_CMD_PING = 0x81,
+    VICE_MONITOR_CMD_EXIT = 0xaa,
+};
+
+enum {
+    VICE_MONITOR_RESPONSE_STOPPED = 0x62,
+    VICE_MONITOR_RESPONSE_RESUMED = 0x63,
+};
+
+enum {
+    VICE_MONITOR_ERROR_OK = 0x00,
+    VICE_MONITOR_ERROR_INVALID_LENGTH = 0x82,
+    VICE_MONITOR_ERROR_INVALID_PARAMETER = 0x83,
+    VICE_MONITOR_ERROR_INVALID_API_VERSION = 0x84,
+    VICE_MONITOR_ERROR_INVALID_COMMAND = 0x85,
+};
+
+enum {
+    VICE_MONITOR_MEMSPACE_MAIN = 0x00,
+};
+
+// the memory as seen by the CPU: with the I/O area mapped, like the BASIC prompt has it
+#define VICE_MONITOR_BANK_DEFAULT 0x0000
@@ -0,0 +1,229 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#include "vicepreview.h"
+
+#include <cstring>
+
+#include <QTcpSocket>
+#include <QtEndian>
+
+#include "vicemonitorprotocol.h"
+
+static VicePreview *__instance = nullptr;
+
+// the same layout as the xlink preview: the charset at $3000 and the screen at $0400
+static const PreviewTarget::MemoryLayout VICE_LAYOUT = {0x3000, 0x0400, 0x1c};
+
+// MEMORY_SET: command header + start, end, memspace, bank...
+static const int MEMORY_SET_HEADER_SIZE = sizeof(struct vice_monitor_command_header) + sizeof(struct vice_monitor_memory_set);
+
+VicePreview* VicePreview::getInstance()
+{
+    if (!__instance)
+        __instance = new VicePreview();
+
+    return __instance;
+}
+
+VicePreview::VicePreview()
+    : PreviewTarget(VICE_LAYOUT)
+    , _socket(nullptr)
+    , _nextRequestId(0)
+    , _pendingResponses(0)
+    , _commandsSent(0)
+    , _bytesSent(0)
+    , _errors(0)
+{
+}
+
+VicePreview::~VicePreview()
+= default;
+
+bool VicePreview::isConnected()
+{
+    return (_socket && _socket->state() == QTcpSocket::ConnectedState);
+}
+
+bool VicePreview::isIdle() const
+{
+    return !_flushTimer->isActive() && !hasPendingUpdates() && _pendingResponses == 0;
+}
+
+bool VicePreview::connect(const QString& ipaddress, quint16 port)
+{
+    // whatever VICE has, everything is sent again
+    resetTarget();
+    _pendingResponses = 0;
+    _received.clear();
+    _commandsSent = 0;
+    _bytesSent = 0;
+    _errors = 0;
+
+    _socket = new QTcpSocket(this);
+
+    QObject::connect(_socket, &QTcpSocket::connected, this, &VicePreview::onConnected);
+    QObject::connect(_socket, &QTcpSocket::disconnected, this, &VicePreview::onDisconnected);
+    QObject::connect(_socket, &QTcpSocket::readyRead, this, &VicePreview::onReadyRead);
+
+    _socket->connectToHost(ipaddress, port ? port : VICE_MONITOR_LISTEN_PORT);
+
+    if(!_socket->waitForConnected(3000))
+    {
+        qDebug() << "Error: " << _socket->errorString();
+        return false;
+    }
+    return true;
+}
+
+void VicePreview::disconnect()
+{
+    if (_socket)
+        _socket->disconnectFromHost();
+}
+
+// SLOTS
+void VicePreview::onConnected()
+{
+    emit previewConnected();
+
+    flushPendingUpdates();
+}
+
+void VicePreview::onDisconnected()
+{
+    discardPendingUpdates();
+    _pendingResponses = 0;
+    emit previewDisconnected();
+}
+
+void VicePreview::onReadyRead()
+{
+    _received.append(_socket->readAll());
+
+    const int headerSize = sizeof(struct vice_monitor_response_header);
+    int offset = 0;
+    while (_received.size() - offset >= headerSize)
+    {
+        struct vice_monitor_response_header header;
+        memcpy(&header, _received.constData() + offset, headerSize);
+
+        if (header.stx != VICE_MONITOR_STX)
+        {
+            // out of sync: nothing else can be parsed
+            qDebug() << "Error: invalid response from VICE";
+            _errors++;
+            offset = _received.size();
+            break;
+        }
+
+        const int size = headerSize + qFromLittleEndian(header.body_length);
+        if (_received.size() - offset < size)
+            break;
+        offset += size;
+
+        // the events, like STOPPED or RESUMED, don't answer any command
+        if (qFromLittleEndian(header.request_id) == VICE_MONITOR_EVENT_REQUEST_ID)
+            continue;
+
+        if (header.error_code != VICE_MONITOR_ERROR_OK)
+        {
+            qDebug() << "Error: VICE answered" << header.error_code << "to command" << header.response_type;
+            _errors++;
+        }
+        if (_pendingResponses > 0)
+            _pendingResponses--;
+    }
+    _received.remove(0, offset);
+
+    // what was updated while VICE was busy
+    if (_pendingResponses == 0 && hasPendingUpdates())
+        scheduleFlush();
+}
+
+//
+// PreviewTarget
+//
+bool VicePreview::canFlush()
+{
+    // the emulation is stopped while a batch is processed:
+    // one batch at a time, so it can run between them
+    return _pendingResponses == 0;
+}
+
+void VicePreview::writeMemory(quint16 addr, const quint8* buf, int count)
+{
+    monitorMemorySet(addr, buf, count);
+}
+
+void VicePreview::endFlush()
+{
+    if (_pendingResponses > 0)
+        monitorExit();
+}
+
+int VicePreview::getWriteOverhead() const
+{
+    return MEMORY_SET_HEADER_SIZE;
+}
+
+//
+// Monitor commands
+//
+void VicePreview::monitorMemorySet(quint16 addr, const quint8* buf, int count)
+{
+    Q_ASSERT(count > 0 && addr + count <= 0x10000 && "Invalid range");
+
+    struct vice_monitor_memory_set payload;
+    // the VIC registers only change with side effects
+    payload.side_effects = (addr >= 0xd000 && addr < 0xd400) ? 1 : 0;
+    payload.start_address = qToLittleEndian(addr);
+    payload.end_address = qToLittleEndian((quint16)(addr + count - 1));
+    payload.memspace = VICE_MONITOR_MEMSPACE_MAIN;
+    payload.bank_id = qToLittleEndian((quint16)VICE_MONITOR_BANK_DEFAULT);
+
+    QByteArray body((const char*)&payload, sizeof(payload));
+    body.append((const char*)buf, count);
+    sendCommand(VICE_MONITOR_CMD_MEMORY_SET, body);
+}
+
+void VicePreview::monitorExit()
+{
+    sendCommand(VICE_MONITOR_CMD_EXIT, QByteArray());
+}
+
+void VicePreview::sendCommand(quint8 commandType, const QByteArray& body)
+{
+    struct vice_monitor_command_header header;
+    header.stx = VICE_MONITOR_STX;
+    header.api_version = VICE_MONITOR_API_VERSION;
+    header.body_length = qToLittleEndian((quint32)body.size());
+    header.request_id = qToLittleEndian(_nextRequestId++);
+    // reserved for the events
+    if (_nextRequestId == VICE_MONITOR_EVENT_REQUEST_ID)
+        _nextRequestId = 0;
+    header.command_type = commandType;
+
+    // header and body in a single write
+    QByteArray command((const char*)&header, sizeof(header));
+    command.append(body);
+    _socket->write(command);
+
+    _pendingResponses++;
+    _commandsSent++;
+    _bytesSent += command.size();
+}
@@ -0,0 +1,88 @@
+/****************************************************************************
+Copyright 2016 Ricardo Quesada
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+****************************************************************************/
+
+
+#pragma once
+
+#include <QByteArray>
+
+#include "previewtarget.h"
+
+QT_BEGIN_NAMESPACE
+class QTcpSocket;
+QT_END_NAMESPACE
+
+/**
+ * @brief The VicePreview class the VICE emulator, through its binary remote monitor.
+ * Each flush is a batch of MEMORY_SET commands followed by an EXIT, which
+ * resumes the emulation. A new batch is not sent until the previous one was answered
+ */
+class VicePreview : public PreviewTarget
+{
+    Q_OBJECT
+
+public:
+    static VicePreview* getInstance();
+    bool isConnected() override;
+    /**
+     * @brief connect connects to the binary monitor of a running VICE
+     * @param ipaddress VICE only listens in localhost by default
+     * @param port VICE_MONITOR_LISTEN_PORT by default
+     * @return false if VICE could not be reached
+     */
+    bool connect(const QString& ipaddress, quint16 port = 0);
+    void disconnect();
+
+    /** @brief isIdle true when everything was sent and answered by VICE */
+    bool isIdle() const;
+
+    /** @brief getCommandsSent commands written to VICE since the connection, including the EXITs */
+    qint64 getCommandsSent() const { return _commandsSent; }
+    /** @brief getBytesSent bytes written to VICE since the connection */
+    qint64 getBytesSent() const { return _bytesSent; }
+    /** @brief getErrors responses with an error code */
+    qint64 getErrors() const { return _errors; }
+
+public slots:
+    void onReadyRead();
+    void onConnected();
+    void onDisconnected();
+
+protected:
+    VicePreview();
+    virtual ~VicePreview();
+
+    // PreviewTarget
+    bool canFlush() override;
+    void writeMemory(quint16 addr, const quint8* buf, int count) override;
+    void endFlush() override;
+    int getWriteOverhead() const override;
+
+    void monitorMemorySet(quint16 addr, const quint8* buf, int count);
+    void monitorExit();
+    void sendCommand(quint8 commandType, const QByteArray& body);
+
+    QTcpSocket* _socket;
+    quint32 _nextRequestId;
+    // commands not answered yet
+    int _pendingResponses;
+    // unprocessed bytes: a response can be split in two reads
+    QByteArray _received;
+
+    qint64 _commandsSent;
+    qint64 _bytesSent;
+    qint64 _errors;
+};
@@ -16,13 +16,17 @@ limitations under the License.
 
 #include "xlinkpreview.h"
 
-#include <QFile>
-#include <QFileInfo>
-
-#include "mainwindow.h"
+#include <QtConcurrent>
 
 static XlinkPreview *__instance = nullptr;
 
+// the charset at $3000 and the screen at $0400: $d018 = $1c
+static const PreviewTarget::MemoryLayout XLINK_LAYOUT = {0x3000, 0x0400, 0x1c};
+
+// a transfer costs more than a few extra bytes: ranges separated
+// by a smaller gap are sent together
+static const int WRITE_OVERHEAD = 32;
+
 XlinkPreview* XlinkPreview::getInstance()
 {
     if (!__instance)
@@ -33,21 +37,19 @@ XlinkPreview* XlinkPreview::getInstance()
 
 bool XlinkPreview::isConnected()
 {
-    if(!_available) return false;
-    if(!_connected) return false;
-
-    if(!xlink_ping()) {
-        _connected = false;
-        emit previewDisconnected();
-        return false;
-    }
-    return true;
+    // the connection is checked by each transfer, not here:
+    // a ping would block the GUI thread
+    return _available && _connected;
 }
 
 bool XlinkPreview::connect()
 {
+    waitForTransfer();
+
     if((_connected = xlink_ping())) {
-        fileLoaded();
+        // whatever the C64 had, everything is sent again
+        resetTarget();
+        scheduleFlush();
         emit previewConnected();
     }
     return _connected;
@@ -55,12 +57,16 @@ bool XlinkPreview::connect()
 
 void XlinkPreview::disconnect()
 {
+    waitForTransfer();
+    discardPendingUpdates();
+
     _connected = false;
     emit previewDisconnected();
 }
 
 XlinkPreview::XlinkPreview()
-    : _available(false)
+    : PreviewTarget(XLINK_LAYOUT)
+    , _available(false)
     , _connected(false)
     , xlink_ping(nullptr)
     , xlink_load(nullptr)
@@ -68,6 +74,9 @@ XlinkPreview::XlinkPreview()
     , xlink_poke(nullptr)
     , xlink_fill(nullptr)
 {
+    _transferWatcher = new QFutureWatcher<bool>(this);
+    QObject::connect(_transferWatcher, &QFutureWatcher<bool>::finished, this, &XlinkPreview::onTransferFinished);
+
     _xlink = new QLibrary("xlink");
     _xlink->load();
     if(_xlink->isLoaded()) {
@@ -82,156 +91,98 @@ XlinkPreview::XlinkPreview()
     }
 }
 
-void XlinkPreview::updateBackgroundColor()
+void XlinkPreview::waitForTransfer()
 {
-    if(!_xlink->isLoaded()) return;
-
-    auto state = MainWindow::getCurrentState();
-    xlink_poke(0x37, 0x00, 0xd020, (uchar) state->getColorForPen(State::PEN_BACKGROUND));
-    xlink_poke(0x37, 0x00, 0xd021, (uchar) state->getColorForPen(State::PEN_BACKGROUND));
+    _transferWatcher->waitForFinished();
 }
 
-void XlinkPreview::updateForegroundColor()
+//
+// PreviewTarget: the writes of a flush are merged in the GUI thread, sent by the worker thread
+//
+bool XlinkPreview::canFlush()
 {
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    uchar foreground = state->getColorForPen(State::PEN_FOREGROUND, state->getTileIndex());
-    foreground |= state->isMulticolorMode() ? 8 : 0;
-
-    xlink_fill(0xb7, 0x00, 0xd800, foreground, 1000);
-    xlink_poke(0x37, 0x00, 0x0286, foreground);
+    // only one transfer at a time. onTransferFinished() flushes the rest
+    return !_transferWatcher->isRunning();
 }
 
-void XlinkPreview::updateMulticolor1()
+void XlinkPreview::beginFlush()
 {
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    xlink_poke(0x37, 0x00, 0xd022, (uchar) state->getColorForPen(State::PEN_MULTICOLOR1));
+    _transfer.clear();
 }
 
-void XlinkPreview::updateMulticolor2()
+void XlinkPreview::writeMemory(quint16 addr, const quint8* buf, int count)
 {
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    xlink_poke(0x37, 0x00, 0xd023, (uchar) state->getColorForPen(State::PEN_MULTICOLOR2));
+    _transfer.append({addr, QByteArray((const char*)buf, count)});
 }
 
-void XlinkPreview::updateColorMode()
+void XlinkPreview::endFlush()
 {
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    uchar control = 0x08;
+    if (_transfer.isEmpty())
+        return;
 
-    xlink_peek(0x37, 0x00, 0xd016, &control);
-    xlink_poke(0x37, 0x00, 0xd016, state->isMulticolorMode() ? 0x18 : 0x08);
+    const auto transfer = _transfer;
+    _transfer.clear();
 
-    updateForegroundColor();
+    _transferWatcher->setFuture(QtConcurrent::run([this, transfer]() {
+        return sendTransfer(transfer);
+    }));
 }
 
-void XlinkPreview::updateColorProperties()
+int XlinkPreview::getWriteOverhead() const
 {
-    updateBackgroundColor();
-    updateMulticolor1();
-    updateMulticolor2();
-    updateColorMode(); // also updates foreground color
-}
-
-void XlinkPreview::updateCharset()
-{
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-
-    xlink_load(0xb7, 0x00, 0x3000, (const uchar*) state->getCharsetBuffer(), State::CHAR_BUFFER_SIZE);
-    xlink_poke(0x37, 0x00, 0xd018, 0x1c);
+    return WRITE_OVERHEAD;
 }
 
-bool XlinkPreview::updateScreen(const QString& filename)
+void XlinkPreview::onTransferFinished()
 {
-    if(!isConnected()) return false;
-
-    QFile file(filename);
-
-    if (!file.open(QIODevice::ReadOnly))
-        return false;
-
-    char *screen = (char*) calloc(1000, sizeof(char));
-    if(screen == nullptr) return false;
-
-    int size = file.read(screen, 1000);
-    file.close();
-
-    xlink_load(0x37, 0x00, 0x0400, (uchar*) screen, size);
-
-    free(screen);
-    return true;
-}
-
-void XlinkPreview::install()
-{
-    updateScreen(":/c64-screen.bin");
-    updateCharset();
-    updateColorProperties();
-}
-
-void XlinkPreview::fileLoaded()
-{
-    if(!isConnected()) return;
-
-    install();
-}
-
-void XlinkPreview::bytesUpdated(int pos, int count)
-{
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-    xlink_load(0xb7, 0x00, 0x3000+pos, state->getCharsetBuffer()+pos, count);
-}
-
-void XlinkPreview::tileUpdated(int tileIndex)
-{
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
-
-    State::TileProperties properties = state->getTileProperties();
-
-    int charIndex = state->getCharIndexFromTileIndex(tileIndex);
-    int numChars = properties.size.width() * properties.size.height();
-
-    if(properties.interleaved == 1) {
-        xlink_load(0xb7, 0x00, 0x3000 + charIndex * 8, (uchar*) state->getCharAtIndex(charIndex), numChars*8);
-    }
-    else {
-        for(int sent=0; sent<numChars; sent++) {
-            xlink_load(0xb7, 0x00, 0x3000 + charIndex * 8, (uchar*) state->getCharAtIndex(charIndex), 8);
-            charIndex += properties.interleaved;
+    if (!_transferWatcher->result())
+    {
+        discardPendingUpdates();
+        if (_connected)
+        {
+            _connected = false;
+            emit previewDisconnected();
         }
+        return;
     }
+
+    // what was updated while transferring
+    if (hasPendingUpdates())
+        scheduleFlush();
 }
 
-void XlinkPreview::colorSelected()
+bool XlinkPreview::sendTransfer(const Transfer& transfer) const
 {
-    if(!isConnected()) return;
-
-    auto state = MainWindow::getCurrentState();
+    if(!xlink_ping())
+        return false;
 
-    switch(state->getSelectedPen()) {
-    case 0: updateBackgroundColor(); break;
-    case 1: updateMulticolor1(); break;
-    case 2: updateMulticolor2(); break;
-    case 3: updateForegroundColor(); break;
+    for (const auto& write: transfer)
+    {
+        const auto buf = (const uchar*) write.data.constData();
+        const int count = write.data.size();
+
+        // the VIC registers and the screen with the default memory configuration,
+        // the charset and the Color RAM with 0xb7
+        const bool vic = (write.addr >= 0xd000 && write.addr < 0xd400);
+        const bool screen = (write.addr >= XLINK_LAYOUT.screenAddress && write.addr < XLINK_LAYOUT.screenAddress + 1000);
+        const uchar memory = (vic || screen) ? 0x37 : 0xb7;
+
+        bool same = true;
+        for (int i=1; i<count && same; i++)
+            same = (buf[i] == buf[0]);
+
+        bool ok;
+        if (count == 1)
+            ok = xlink_poke(memory, 0x00, write.addr, buf[0]);
+        else if (same)
+            ok = xlink_fill(memory, 0x00, write.addr, buf[0], count);
+        else
+            ok = xlink_load(memory, 0x00, write.addr, buf, count);
+
+        // the rest of the transfer would be lost too: onTransferFinished() disconnects
+        if (!ok)
+            return false;
     }
-}
 
-void XlinkPreview::colorPropertiesUpdated()
-{
-    if(!isConnected()) return;
-
-    updateColorMode();
+    return true;
 }
@@ -16,10 +16,12 @@ limitations under the License.
 
 #pragma once
 
-#include <QObject>
+#include <QByteArray>
+#include <QFutureWatcher>
 #include <QLibrary>
+#include <QVector>
 
-#include "state.h"
+#include "previewtarget.h"
 
 typedef bool (*xlink_ping_t)(void);
 typedef bool (*xlink_load_t)(uchar, uchar, ushort, const uchar*, int);
@@ -27,57 +29,59 @@ typedef bool (*xlink_peek_t)(uchar, uchar, ushort, uchar*);
 typedef bool (*xlink_poke_t)(uchar, uchar, ushort, uchar);
 typedef bool (*xlink_fill_t)(uchar, uchar, ushort, uchar, uint);
 
-class XlinkPreview : public QObject
+/**
+ * @brief The XlinkPreview class a C64 attached with an xlink cable.
+ * The xlink calls block: the writes of each flush are sent from a worker thread
+ */
+class XlinkPreview : public PreviewTarget
 {
     Q_OBJECT
 
     bool _available;
     bool _connected;
 
-    void updateBackgroundColor();
-    void updateForegroundColor();
-    void updateMulticolor1();
-    void updateMulticolor2();
-    void updateColorMode();
-    void updateCharset();
-    bool updateScreen(const QString &filename);
-    void updateColorProperties();
-    void install();
+    /**
+     * @brief The MemoryWrite struct a write of the transfer. A copy of the data,
+     * taken in the GUI thread
+     */
+    struct MemoryWrite {
+        quint16 addr;
+        QByteArray data;
+    };
+    typedef QVector<MemoryWrite> Transfer;
+
+    void waitForTransfer();
+    // runs in the worker thread: only uses the transfer and the xlink functions
+    bool sendTransfer(const Transfer& transfer) const;
 
 public:
     static XlinkPreview* getInstance();
-    bool isConnected();
+    bool isConnected() override;
     bool isAvailable() { return _available; }
     bool connect();
     void disconnect();
 
-signals:
-    void previewConnected();
-    void previewDisconnected();
-
-public slots:
-    // file loaded, or new project
-    void fileLoaded();
-
-    // when a range of bytes in the charset changes (e.g. due to a paste)
-    void bytesUpdated(int pos, int count);
-
-    // when the whole tile changes
-    void tileUpdated(int);
-
-    // multi-color / hires or new colors
-    void colorPropertiesUpdated();
-
-    // a color was selected
-    void colorSelected();
+protected slots:
+    void onTransferFinished();
 
 protected:
     XlinkPreview();
 
+    // PreviewTarget
+    bool canFlush() override;
+    void beginFlush() override;
+    void writeMemory(quint16 addr, const quint8* buf, int count) override;
+    void endFlush() override;
+    int getWriteOverhead() const override;
+
     QLibrary *_xlink;
     xlink_ping_t xlink_ping;
     xlink_load_t xlink_load;
     xlink_peek_t xlink_peek;
     xlink_poke_t xlink_poke;
     xlink_fill_t xlink_fill;
+
+    QFutureWatcher<bool>* _transferWatcher;
+    // the writes of the flush in progress
+    Transfer _transfer;
 };
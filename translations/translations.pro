@@ -40,7 +40,7 @@ LUPDATE = $$fixSlashes($$[QT_INSTALL_BINS]/lupdate) -locations relative -no-obso
 LRELEASE = $$QMAKE_LRELEASE
 isEmpty(LRELEASE):LRELEASE = $$fixSlashes($$[QT_INSTALL_BINS]/lrelease)
 
-ts.commands = cd $$PWD/.. && $$LUPDATE src -ts $$TRANSLATIONS
+ts.commands = cd $$PWD/.. && $$LUPDATE src core cli -ts $$TRANSLATIONS
 QMAKE_EXTRA_TARGETS += ts
 
 win32 {
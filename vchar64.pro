@@ -1,3 +1,8 @@
 TEMPLATE  = subdirs
 CONFIG   += ordered
-SUBDIRS = src translations
+SUBDIRS = core src cli translations
+
+# micro-benchmarks: qmake CONFIG+=bench
+bench {
+    SUBDIRS += bench
+}